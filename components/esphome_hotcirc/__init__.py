@@ -1,12 +1,41 @@
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
 from esphome.components import sensor, switch, time, output, binary_sensor
-from esphome.const import CONF_ID
+from esphome.const import (
+    CONF_ID,
+    CONF_ENERGY,
+    CONF_UPDATE_INTERVAL,
+    DEVICE_CLASS_DURATION,
+    DEVICE_CLASS_ENERGY,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_HOUR,
+    UNIT_KILOWATT_HOURS,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+)
+from esphome.core import CORE, ID, EsphomeError
 
 DEPENDENCIES = ["sensor", "switch", "time", "output", "binary_sensor"]
+# One controller per circulation circuit (riser); see CONF_CIRCUIT
+MULTI_CONF = True
+DOMAIN = "esphome_hotcirc"
 
 esphome_hotcirc_ns = cg.esphome_ns.namespace("esphome_hotcirc")
 HotWaterController = esphome_hotcirc_ns.class_("HotWaterController", cg.Component)
+CircuitCoordinator = esphome_hotcirc_ns.class_("CircuitCoordinator")
+SmartPlugSwitch = esphome_hotcirc_ns.class_("SmartPlugSwitch", switch.Switch, cg.Component)
+ProfileChannel = esphome_hotcirc_ns.enum("ProfileChannel", is_class=True)
+ProfileStat = esphome_hotcirc_ns.enum("ProfileStat", is_class=True)
+DrawDetector = esphome_hotcirc_ns.enum("DrawDetector", is_class=True)
+StopMode = esphome_hotcirc_ns.enum("StopMode", is_class=True)
+FuseTarget = esphome_hotcirc_ns.enum("FuseTarget", is_class=True)
+EnergyPeriod = esphome_hotcirc_ns.enum("EnergyPeriod", is_class=True)
+EnergyStat = esphome_hotcirc_ns.enum("EnergyStat", is_class=True)
 
 CONF_OUTLET_SENSOR = "outlet_sensor"
 CONF_RETURN_SENSOR = "return_sensor"
@@ -26,9 +55,228 @@ CONF_THERMAL_STAGNATION_RUNTIME = "thermal_stagnation_runtime"
 CONF_THERMAL_STAGNATION_COOLDOWN = "thermal_stagnation_cooldown"
 CONF_THERMAL_STAGNATION_DELTA = "thermal_stagnation_delta"
 CONF_THERMAL_STAGNATION_MIN_RETURN = "thermal_stagnation_min_return"
+CONF_PREHEAT_LEAD_MINUTES = "preheat_lead_minutes"
+CONF_PREHEAT_LEAD_AUTO = "preheat_lead_auto"
+CONF_SLOTS_PER_DAY = "slots_per_day"
+CONF_COMPACT_STORAGE = "compact_storage"
+CONF_JOURNAL_SYNC = "journal_sync"
+CONF_LIGHT_SLEEP = "light_sleep"
+CONF_DRAW_DETECTOR = "draw_detector"
+CONF_DRAW_SLOPE_WINDOW = "draw_slope_window"
+CONF_DRAW_SLOPE_MIN_RATE = "draw_slope_min_rate"
+CONF_DRAW_SLOPE_MIN_T = "draw_slope_min_t"
+CONF_STOP_MODE = "stop_mode"
+CONF_RETURN_SENSOR_LAG = "return_sensor_lag"
+CONF_LOOP_VOLUME = "loop_volume"
+CONF_PROFILER = "profiler"
+CONF_TRACE = "trace"
+CONF_RECORDS = "records"
+CONF_RUNTIME = "runtime"
+CONF_SCHEDULE_STATS = "schedule_stats"
+CONF_HIT_WINDOW = "hit_window"
+CONF_HIT_RATE = "hit_rate"
+CONF_WASTED_ENERGY = "wasted_energy"
+CONF_THRESHOLD = "threshold"
+CONF_AUTO_TUNE = "auto_tune"
+CONF_TARGET_HIT_RATE = "target_hit_rate"
+CONF_STEP = "step"
+CONF_MIN_THRESHOLD = "min_threshold"
+CONF_MAX_THRESHOLD = "max_threshold"
+CONF_CIRCUIT = "circuit"
+CONF_START_STAGGER = "start_stagger"
+CONF_CLOCK_HOLDOVER = "clock_holdover"
+CONF_ADAPTIVE_SAMPLING = "adaptive_sampling"
+CONF_IDLE_INTERVAL = "idle_interval"
+CONF_ACTIVE_INTERVAL = "active_interval"
+CONF_HOLD = "hold"
+CONF_FAST_TEMPERATURE_SENSOR = "fast_temperature_sensor"
+CONF_PULSED_CIRCULATION = "pulsed_circulation"
+CONF_SOAK = "soak"
+CONF_ARRIVAL_RATE = "arrival_rate"
+CONF_CONTROL_TASK = "control_task"
+CONF_CORE = "core"
+CONF_PRIORITY = "priority"
+CONF_FAST_TEMPERATURE_FUSE = "fast_temperature_fuse"
+CONF_FAST_TEMPERATURE_TAU = "fast_temperature_tau"
+
+DRAW_DETECTORS = {
+    "classic": DrawDetector.CLASSIC,  # 15 s sustained rise (conservative)
+    "slope": DrawDetector.SLOPE,      # sliding least-squares slope, ~5-8 s
+}
+
+STOP_MODES = {
+    "threshold": StopMode.THRESHOLD,    # stop when the return reading reaches the target
+    "predictive": StopMode.PREDICTIVE,  # also stop when it will within return_sensor_lag
+}
+
+FUSE_TARGETS = {
+    "outlet": FuseTarget.OUTLET,  # fast outlet probe: draw detector on the fused value
+    "return": FuseTarget.RETURN,  # probe in the return line (pump NTC): pump stop on the fused value
+}
+
+# Built-in profiler: per channel optional p50/p99/max sensors (ms)
+PROFILE_CHANNELS = {
+    "loop_gap": ProfileChannel.LOOP_GAP,
+    "pump_control": ProfileChannel.PUMP_CONTROL,
+    "check_schedule": ProfileChannel.CHECK_SCHEDULE,
+    "outlet_sample": ProfileChannel.OUTLET_SAMPLE,
+    "heatmap": ProfileChannel.HEATMAP,
+    "http": ProfileChannel.HTTP,
+}
+PROFILE_STATS = {
+    "p50": ProfileStat.P50,
+    "p99": ProfileStat.P99,
+    "max": ProfileStat.MAX,
+}
+_PROFILE_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    accuracy_decimals=2,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    icon="mdi:timer-outline",
+)
+PROFILER_SCHEMA = cv.Schema({
+    cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+    **{
+        cv.Optional(channel): cv.Schema({cv.Optional(stat): _PROFILE_SENSOR_SCHEMA for stat in PROFILE_STATS})
+        for channel in PROFILE_CHANNELS
+    },
+})
+
+# Energy / runtime totals: per period optional energy (kWh) and runtime (h)
+# sensors, summed over all triggers or for one PumpTrigger
+ENERGY_PERIODS = {
+    "daily": EnergyPeriod.DAILY,
+    "weekly": EnergyPeriod.WEEKLY,
+    "lifetime": EnergyPeriod.LIFETIME,
+}
+ENERGY_TRIGGERS = {  # PumpTrigger index (NONE = 0 never accumulates)
+    "manual_button": 1,
+    "manual_webui": 2,
+    "water_draw": 3,
+    "scheduled": 4,
+    "disinfection": 5,
+    "anti_stagnation": 6,
+    "thermal_stagnation": 7,
+    "calibration": 8,
+}
+_ENERGY_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_KILOWATT_HOURS,
+    accuracy_decimals=3,
+    device_class=DEVICE_CLASS_ENERGY,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+)
+_RUNTIME_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_HOUR,
+    accuracy_decimals=2,
+    device_class=DEVICE_CLASS_DURATION,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    icon="mdi:timer-outline",
+)
+_ENERGY_PAIR_SCHEMA = {
+    cv.Optional(CONF_ENERGY): _ENERGY_SENSOR_SCHEMA,
+    cv.Optional(CONF_RUNTIME): _RUNTIME_SENSOR_SCHEMA,
+}
+ENERGY_SCHEMA = cv.Schema({
+    cv.Optional(period): cv.Schema({
+        **_ENERGY_PAIR_SCHEMA,
+        **{cv.Optional(trigger): cv.Schema(_ENERGY_PAIR_SCHEMA) for trigger in ENERGY_TRIGGERS},
+    })
+    for period in ENERGY_PERIODS
+})
+
+# Scheduled-run hit/miss analytics, optional ECO auto-tuner
+def _validate_auto_tune(config):
+    if config[CONF_MIN_THRESHOLD] > config[CONF_MAX_THRESHOLD]:
+        raise cv.Invalid("min_threshold must not exceed max_threshold")
+    return config
+
+
+SCHEDULE_STATS_SCHEMA = cv.Schema({
+    cv.Optional(CONF_HIT_WINDOW, default="30min"): cv.All(
+        cv.positive_time_period_seconds,
+        cv.Range(min=cv.TimePeriod(minutes=10), max=cv.TimePeriod(hours=2)),
+    ),
+    cv.Optional(CONF_HIT_RATE): sensor.sensor_schema(
+        unit_of_measurement=UNIT_PERCENT,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        icon="mdi:bullseye-arrow",
+    ),
+    cv.Optional(CONF_WASTED_ENERGY): _ENERGY_SENSOR_SCHEMA,
+    cv.Optional(CONF_THRESHOLD): sensor.sensor_schema(
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        icon="mdi:leaf",
+    ),
+    cv.Optional(CONF_AUTO_TUNE): cv.All(cv.Schema({
+        cv.Optional(CONF_TARGET_HIT_RATE, default="60%"): cv.All(cv.percentage, cv.Range(min=0.2, max=0.95)),
+        cv.Optional(CONF_STEP, default=5): cv.int_range(min=1, max=50),
+        cv.Optional(CONF_MIN_THRESHOLD, default=60): cv.int_range(min=0, max=255),
+        cv.Optional(CONF_MAX_THRESHOLD, default=240): cv.int_range(min=0, max=255),
+    }), _validate_auto_tune),
+})
+
+# Adaptive sampling: the controller sets the outlet / return sensors' poll
+# period (both must be polling components, e.g. dallas_temp)
+def _validate_adaptive_sampling(config):
+    if config[CONF_ACTIVE_INTERVAL] > config[CONF_IDLE_INTERVAL]:
+        raise cv.Invalid("active_interval must not exceed idle_interval")
+    return config
+
+
+ADAPTIVE_SAMPLING_SCHEMA = cv.All(cv.Schema({
+    cv.Optional(CONF_IDLE_INTERVAL, default="5s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=1), max=cv.TimePeriod(seconds=60))
+    ),
+    # 12-bit DS18B20 conversion takes 750 ms
+    cv.Optional(CONF_ACTIVE_INTERVAL, default="1s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(milliseconds=750), max=cv.TimePeriod(seconds=10))
+    ),
+    # Fast rate kept after the pump stopped, a draw ended or the outlet rose
+    cv.Optional(CONF_HOLD, default="60s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(minutes=10))
+    ),
+}), _validate_adaptive_sampling)
+
+# Pulsed circulation for SCHEDULED / WATER_DRAW runs; the bursts are sized
+# from the calibrated loop transit time (continuous until calibrated)
+PULSED_CIRCULATION_SCHEMA = cv.Schema({
+    # Pause between bursts: long enough for the return sensor to catch up
+    cv.Optional(CONF_SOAK, default="10s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=2), max=cv.TimePeriod(seconds=60))
+    ),
+    # Return slope that shows the hot water arrived (°C/s)
+    cv.Optional(CONF_ARRIVAL_RATE, default=0.05): cv.float_range(min=0.005, max=1.0),
+})
+
+# Control core on its own FreeRTOS task (ESP-IDF); core is clamped to 0 on
+# single-core chips
+CONTROL_TASK_SCHEMA = cv.All(cv.Schema({
+    cv.Optional(CONF_CORE, default=1): cv.int_range(min=0, max=1),
+    # Above the loop task (1), below WiFi / lwIP
+    cv.Optional(CONF_PRIORITY, default=5): cv.int_range(min=2, max=17),
+}), cv.only_with_esp_idf)
+
+
+# Multi-circuit mode: per-circuit name, used in logs, preference keys and URLs
+def _validate_circuit(value):
+    value = cv.string_strict(value)
+    if not re.fullmatch(r"[a-z0-9_]{1,16}", value):
+        raise cv.Invalid("circuit must be 1-16 characters out of a-z, 0-9 and _")
+    return value
+
 
 CONFIG_SCHEMA = cv.Schema({
     cv.GenerateID(): cv.declare_id(HotWaterController),
+    # Multi-circuit mode: required on all controllers but one; suffixes the
+    # flash keys, so leave it unset on an existing single loop
+    cv.Optional(CONF_CIRCUIT): _validate_circuit,
+    # Minimum gap between automatic pump starts of different circuits
+    cv.Optional(CONF_START_STAGGER, default="30s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(minutes=10))
+    ),
     cv.Required(CONF_OUTLET_SENSOR): cv.use_id(sensor.Sensor),
     cv.Required(CONF_RETURN_SENSOR): cv.use_id(sensor.Sensor),
     cv.Required(CONF_PUMP_SWITCH): cv.use_id(switch.Switch),
@@ -47,16 +295,99 @@ CONFIG_SCHEMA = cv.Schema({
     cv.Optional(CONF_THERMAL_STAGNATION_COOLDOWN, default=1800): cv.uint32_t,  # 30 min cooldown
     cv.Optional(CONF_THERMAL_STAGNATION_DELTA, default=2.0): cv.float_range(min=-5.0, max=10.0),
     cv.Optional(CONF_THERMAL_STAGNATION_MIN_RETURN, default=40.0): cv.float_range(min=20.0, max=60.0),
+    cv.Optional(CONF_PREHEAT_LEAD_MINUTES, default=0): cv.int_range(min=0, max=30),  # 0 = start inside the slot
+    cv.Optional(CONF_PREHEAT_LEAD_AUTO, default=False): cv.boolean,  # learn lead from SCHEDULED run durations
+    # Keep running on last valid time + millis() when the time source turns
+    # invalid; 0s = off (old behaviour: automatic operation pauses)
+    cv.Optional(CONF_CLOCK_HOLDOVER, default="24h"): cv.All(
+        cv.positive_time_period_seconds, cv.Range(max=cv.TimePeriod(days=7))
+    ),
+    # Compile-time matrix resolution: 48 = 30 min, 96 = 15 min, 144 = 10 min slots
+    cv.Optional(CONF_SLOTS_PER_DAY, default=48): cv.one_of(48, 96, 144, int=True),
+    cv.Optional(CONF_COMPACT_STORAGE, default=False): cv.boolean,  # 4-bit quantized flash snapshot
+    # Flush the preferences after each learning journal append (false: wait
+    # for flash_write_interval, a power cut can lose the draws learned since)
+    cv.Optional(CONF_JOURNAL_SYNC, default=True): cv.boolean,
+    # Configure ESP-IDF power management for automatic light sleep while
+    # loop() idles between deadlines (needs CONFIG_PM_ENABLE + tickless idle)
+    cv.Optional(CONF_LIGHT_SLEEP, default=False): cv.boolean,
+    cv.Optional(CONF_DRAW_DETECTOR, default="classic"): cv.enum(DRAW_DETECTORS, lower=True),
+    cv.Optional(CONF_DRAW_SLOPE_WINDOW, default=6): cv.int_range(min=4, max=32),  # samples (~1 s each)
+    cv.Optional(CONF_DRAW_SLOPE_MIN_RATE, default=0.05): cv.float_range(min=0.005, max=1.0),  # °C/s
+    cv.Optional(CONF_DRAW_SLOPE_MIN_T, default=5.0): cv.float_range(min=2.0, max=50.0),
+    cv.Optional(CONF_STOP_MODE, default="threshold"): cv.enum(STOP_MODES, lower=True),
+    # Without it: the rise time constant measured by calibration, else 10 s
+    cv.Optional(CONF_RETURN_SENSOR_LAG): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(seconds=60))
+    ),
+    # Circulation loop pipe volume (L); lets calibration derive the flow rate
+    cv.Optional(CONF_LOOP_VOLUME, default=0.0): cv.float_range(min=0.0, max=200.0),
+    cv.Optional(CONF_ADAPTIVE_SAMPLING): ADAPTIVE_SAMPLING_SCHEMA,
+    cv.Optional(CONF_PULSED_CIRCULATION): PULSED_CIRCULATION_SCHEMA,
+    # Detection, pump state machine and energy integration off the main loop
+    cv.Optional(CONF_CONTROL_TASK): CONTROL_TASK_SCHEMA,
+    # Fast but offset-prone secondary probe (e.g. the pump's NTC on the ADC),
+    # fused with the outlet or return DS18B20 by a complementary filter
+    cv.Optional(CONF_FAST_TEMPERATURE_SENSOR): cv.use_id(sensor.Sensor),
+    cv.Optional(CONF_FAST_TEMPERATURE_FUSE, default="return"): cv.enum(FUSE_TARGETS, lower=True),
+    # Time constant its offset follows the DS18B20 with (while both are steady)
+    cv.Optional(CONF_FAST_TEMPERATURE_TAU, default="60s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=5), max=cv.TimePeriod(minutes=30))
+    ),
+    cv.Optional(CONF_ENERGY): ENERGY_SCHEMA,
+    cv.Optional(CONF_SCHEDULE_STATS): SCHEDULE_STATS_SCHEMA,
+    cv.Optional(CONF_PROFILER): PROFILER_SCHEMA,
+    # Binary trace ring (8 bytes per record, PSRAM preferred), downloadable
+    # from the web server at /hotcirc/trace.bin (/hotcirc/<circuit>/trace.bin)
+    cv.Optional(CONF_TRACE): cv.Schema({
+        cv.Optional(CONF_RECORDS, default=4096): cv.int_range(min=256, max=1 << 20),
+    }),
 }).extend(cv.COMPONENT_SCHEMA)
 
 
+def _final_validate(config):
+    # All controllers share one firmware: the compile-time options must agree,
+    # and each circuit needs its own name (preference keys, trace URL). One
+    # may stay unnamed - it keeps the single-circuit keys and flash data.
+    confs = fv.full_config.get()[DOMAIN]
+    if len(confs) < 2:
+        return config
+    for option in (CONF_SLOTS_PER_DAY, CONF_COMPACT_STORAGE, CONF_LIGHT_SLEEP):
+        if config[option] != confs[0][option]:
+            raise cv.Invalid(f"{option} must be the same for all {DOMAIN} circuits", path=[option])
+    if sum(1 for conf in confs if conf.get(CONF_CIRCUIT) == config.get(CONF_CIRCUIT)) > 1:
+        if CONF_CIRCUIT not in config:
+            raise cv.Invalid(f"circuit is required on all but one {DOMAIN} circuit")
+        raise cv.Invalid(f"circuit '{config[CONF_CIRCUIT]}' is used more than once", path=[CONF_CIRCUIT])
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
 async def to_code(config):
+    cg.add_define("HOTCIRC_SLOTS_PER_DAY", config[CONF_SLOTS_PER_DAY])
+    if config[CONF_COMPACT_STORAGE]:
+        cg.add_define("HOTCIRC_MATRIX_PACK4")
+    if config[CONF_LIGHT_SLEEP]:
+        cg.add_define("HOTCIRC_LIGHT_SLEEP")
+
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
-    outlet = await cg.get_variable(config[CONF_OUTLET_SENSOR])
-    ret = await cg.get_variable(config[CONF_RETURN_SENSOR])
-    pump = await cg.get_variable(config[CONF_PUMP_SWITCH])
+    # One start coordinator per node, shared by all circuits
+    data = CORE.data.setdefault(DOMAIN, {})
+    if "coordinator" not in data:
+        data["coordinator"] = cg.new_Pvariable(ID("hotcirc_coordinator", is_declaration=True, type=CircuitCoordinator))
+    coordinator = data["coordinator"]
+    cg.add(coordinator.add_circuit(var))
+    cg.add(var.set_coordinator(coordinator, config[CONF_START_STAGGER]))
+    if CONF_CIRCUIT in config:
+        cg.add(var.set_circuit(config[CONF_CIRCUIT]))
+
+    outlet_id, outlet = await cg.get_variable_with_full_id(config[CONF_OUTLET_SENSOR])
+    ret_id, ret = await cg.get_variable_with_full_id(config[CONF_RETURN_SENSOR])
+    pump_id, pump = await cg.get_variable_with_full_id(config[CONF_PUMP_SWITCH])
     clock = await cg.get_variable(config[CONF_TIME_SOURCE])
 
     cg.add(var.set_outlet_sensor(outlet))
@@ -88,3 +419,93 @@ async def to_code(config):
     cg.add(var.set_thermal_stagnation_cooldown(config[CONF_THERMAL_STAGNATION_COOLDOWN]))
     cg.add(var.set_thermal_stagnation_delta(config[CONF_THERMAL_STAGNATION_DELTA]))
     cg.add(var.set_thermal_stagnation_min_return(config[CONF_THERMAL_STAGNATION_MIN_RETURN]))
+    cg.add(var.set_preheat_lead(config[CONF_PREHEAT_LEAD_MINUTES], config[CONF_PREHEAT_LEAD_AUTO]))
+    cg.add(var.set_clock_holdover(config[CONF_CLOCK_HOLDOVER].total_seconds))
+    cg.add(var.set_draw_detector(
+        config[CONF_DRAW_DETECTOR],
+        config[CONF_DRAW_SLOPE_WINDOW],
+        config[CONF_DRAW_SLOPE_MIN_RATE],
+        config[CONF_DRAW_SLOPE_MIN_T]
+    ))
+    lag_s = config[CONF_RETURN_SENSOR_LAG].total_milliseconds / 1000.0 if CONF_RETURN_SENSOR_LAG in config else -1.0
+    cg.add(var.set_stop_mode(config[CONF_STOP_MODE], lag_s))
+    cg.add(var.set_loop_volume(config[CONF_LOOP_VOLUME]))
+    cg.add(var.set_journal_sync(config[CONF_JOURNAL_SYNC]))
+
+    if CONF_ADAPTIVE_SAMPLING in config:
+        sampling = config[CONF_ADAPTIVE_SAMPLING]
+        for sensor_id in (outlet_id, ret_id):
+            if not sensor_id.type.inherits_from(cg.PollingComponent):
+                raise EsphomeError(f"adaptive_sampling: sensor '{sensor_id.id}' is not a polling component")
+        cg.add(var.set_adaptive_sampling(
+            outlet,
+            ret,
+            sampling[CONF_IDLE_INTERVAL],
+            sampling[CONF_ACTIVE_INTERVAL],
+            sampling[CONF_HOLD]
+        ))
+
+    if CONF_PULSED_CIRCULATION in config:
+        pulsed = config[CONF_PULSED_CIRCULATION]
+        cg.add(var.set_pulsed_circulation(pulsed[CONF_SOAK], pulsed[CONF_ARRIVAL_RATE]))
+
+    if CONF_CONTROL_TASK in config:
+        task = config[CONF_CONTROL_TASK]
+        cg.add_define("HOTCIRC_CONTROL_TASK")
+        # A smart plug takes commands from any task: no detour via loop()
+        plug = pump if pump_id.type.inherits_from(SmartPlugSwitch) else cg.nullptr
+        cg.add(var.set_control_task(task[CONF_CORE], task[CONF_PRIORITY], plug))
+
+    if CONF_FAST_TEMPERATURE_SENSOR in config:
+        fast = await cg.get_variable(config[CONF_FAST_TEMPERATURE_SENSOR])
+        cg.add(var.set_fast_sensor(
+            fast,
+            config[CONF_FAST_TEMPERATURE_FUSE],
+            config[CONF_FAST_TEMPERATURE_TAU].total_milliseconds / 1000.0
+        ))
+
+    if CONF_TRACE in config:
+        cg.add_define("HOTCIRC_TRACE")
+        cg.add(var.set_trace_capacity(config[CONF_TRACE][CONF_RECORDS]))
+
+    if CONF_ENERGY in config:
+        stats = {CONF_ENERGY: EnergyStat.ENERGY, CONF_RUNTIME: EnergyStat.RUNTIME}
+        for period, period_enum in ENERGY_PERIODS.items():
+            conf = config[CONF_ENERGY].get(period, {})
+            for trigger, index in [(None, -1), *ENERGY_TRIGGERS.items()]:
+                pair = conf if trigger is None else conf.get(trigger, {})
+                for stat, stat_enum in stats.items():
+                    if stat in pair:
+                        sens = await sensor.new_sensor(pair[stat])
+                        cg.add(var.set_energy_sensor(period_enum, stat_enum, index, sens))
+
+    if CONF_SCHEDULE_STATS in config:
+        stats_conf = config[CONF_SCHEDULE_STATS]
+        cg.add(var.set_schedule_hit_window(stats_conf[CONF_HIT_WINDOW].total_seconds))
+        if CONF_HIT_RATE in stats_conf:
+            sens = await sensor.new_sensor(stats_conf[CONF_HIT_RATE])
+            cg.add(var.set_schedule_hit_rate_sensor(sens))
+        if CONF_WASTED_ENERGY in stats_conf:
+            sens = await sensor.new_sensor(stats_conf[CONF_WASTED_ENERGY])
+            cg.add(var.set_schedule_wasted_energy_sensor(sens))
+        if CONF_THRESHOLD in stats_conf:
+            sens = await sensor.new_sensor(stats_conf[CONF_THRESHOLD])
+            cg.add(var.set_schedule_threshold_sensor(sens))
+        if CONF_AUTO_TUNE in stats_conf:
+            tune = stats_conf[CONF_AUTO_TUNE]
+            cg.add(var.set_schedule_auto_tune(
+                tune[CONF_TARGET_HIT_RATE],
+                tune[CONF_STEP],
+                tune[CONF_MIN_THRESHOLD],
+                tune[CONF_MAX_THRESHOLD]
+            ))
+
+    if CONF_PROFILER in config:
+        prof = config[CONF_PROFILER]
+        cg.add_define("HOTCIRC_PROFILER")
+        cg.add(var.set_profile_interval(prof[CONF_UPDATE_INTERVAL]))
+        for channel, channel_enum in PROFILE_CHANNELS.items():
+            for stat, stat_enum in PROFILE_STATS.items():
+                if stat in prof.get(channel, {}):
+                    sens = await sensor.new_sensor(prof[channel][stat])
+                    cg.add(var.set_profile_sensor(channel_enum, stat_enum, sens))
@@ -7,6 +7,24 @@
 // esphome namespace) and have been removed.
 #include "esphome/core/hal.h"
 #include <cmath>
+#include <cstring>
+#include <cstddef>
+#ifdef USE_ESP32
+#include <esp_rom_crc.h>
+#endif
+#if defined(HOTCIRC_LIGHT_SLEEP) && defined(USE_ESP_IDF)
+#include "esp_pm.h"
+#endif
+#ifdef HOTCIRC_CONTROL_TASK
+#include "smart_plug_switch.h"
+#endif
+#if defined(USE_WEBSERVER) && defined(USE_ESP_IDF)
+#define HOTCIRC_EVENTS_HTTP
+#include "esphome/components/web_server_base/web_server_base.h"
+#ifdef HOTCIRC_TRACE
+#define HOTCIRC_TRACE_HTTP
+#endif
+#endif
 
 namespace esphome {
 namespace esphome_hotcirc {
@@ -16,15 +34,143 @@ namespace esphome_hotcirc {
 // be raised to DEBUG independently in the YAML logger config.
 static const char *const TAG = "hotcirc";
 
+#ifdef HOTCIRC_PROFILER
+namespace {
+// Times the enclosing scope into one profiler channel.
+class ProfileScope {
+ public:
+  ProfileScope(HotWaterController *parent, ProfileChannel channel)
+      : parent_(parent), channel_(channel), start_us_(micros()) {}
+  ~ProfileScope() { parent_->profile_record(channel_, micros() - start_us_); }
+
+ protected:
+  HotWaterController *parent_;
+  ProfileChannel channel_;
+  uint32_t start_us_;
+};
+}  // namespace
+#define HOTCIRC_PROFILE_SCOPE(channel) ProfileScope profile_scope_(this, channel)
+#else
+#define HOTCIRC_PROFILE_SCOPE(channel)
+#endif
+
+// control_task: the control task and the main task take turns on the
+// controller state. Held for single callbacks / passes, never across a wait.
+#ifdef HOTCIRC_CONTROL_TASK
+#define HOTCIRC_CORE_LOCK() std::lock_guard<std::recursive_mutex> core_guard_(this->core_lock_)
+#else
+#define HOTCIRC_CORE_LOCK()
+#endif
+
+#ifdef HOTCIRC_TRACE_HTTP
+namespace {
+// GET /hotcirc/trace.bin (/hotcirc/<circuit>/trace.bin) -> HotWaterController::stream_trace()
+class TraceDownloadHandler : public AsyncWebHandler {
+ public:
+  explicit TraceDownloadHandler(HotWaterController *parent)
+      : parent_(parent),
+        url_(parent->get_circuit().empty() ? "/hotcirc/trace.bin"
+                                           : "/hotcirc/" + parent->get_circuit() + "/trace.bin") {}
+  const std::string &get_url() const { return url_; }
+  bool canHandle(AsyncWebServerRequest *request) const override {
+    return request->method() == HTTP_GET && request->url() == url_;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override {
+    httpd_req_t *req = *request;
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"hotcirc_trace.bin\"");
+    bool ok = true;
+    parent_->stream_trace([req, &ok](const uint8_t *data, size_t len) {
+      ok = httpd_resp_send_chunk(req, (const char *) data, len) == ESP_OK;
+      return ok;
+    });
+    if (ok) httpd_resp_send_chunk(req, nullptr, 0);
+  }
+
+ protected:
+  HotWaterController *parent_;
+  std::string url_;
+};
+}  // namespace
+#endif
+
+#ifdef HOTCIRC_EVENTS_HTTP
+namespace {
+// GET /hotcirc/events.txt (/hotcirc/<circuit>/events.txt) -> HotWaterController::stream_event_log()
+class EventLogHandler : public AsyncWebHandler {
+ public:
+  explicit EventLogHandler(HotWaterController *parent)
+      : parent_(parent),
+        url_(parent->get_circuit().empty() ? "/hotcirc/events.txt"
+                                           : "/hotcirc/" + parent->get_circuit() + "/events.txt") {}
+  const std::string &get_url() const { return url_; }
+  bool canHandle(AsyncWebServerRequest *request) const override {
+    return request->method() == HTTP_GET && request->url() == url_;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override {
+    httpd_req_t *req = *request;
+    httpd_resp_set_type(req, "text/plain; charset=utf-8");
+    bool ok = true;
+    parent_->stream_event_log([req, &ok](const char *line) {
+      ok = httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN) == ESP_OK &&
+           httpd_resp_send_chunk(req, "\n", 1) == ESP_OK;
+      return ok;
+    });
+    if (ok) httpd_resp_send_chunk(req, nullptr, 0);
+  }
+
+ protected:
+  HotWaterController *parent_;
+  std::string url_;
+};
+}  // namespace
+#endif
+
+uint32_t CircuitCoordinator::claim_start(HotWaterController *circuit, uint32_t now_ms, uint32_t stagger_ms,
+                                         bool demand) {
+#ifdef HOTCIRC_CONTROL_TASK
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  if (!demand && last_start_circuit_ != nullptr && last_start_circuit_ != circuit) {
+    uint32_t since_ms = now_ms - last_start_ms_;
+    if (since_ms < stagger_ms) return stagger_ms - since_ms;
+  }
+  last_start_circuit_ = circuit;
+  last_start_ms_ = now_ms;
+  return 0;
+}
+
+uint32_t HotWaterController::pref_key_(const char *name) const {
+  return fnv1_hash(circuit_.empty() ? std::string(name) : std::string(name) + "_" + circuit_);
+}
+
 void HotWaterController::setup() {
+  // Q16 squarings of DECAY for decay_q16_() (lazy matrix decay)
+  decay_pow_q16_[0] = (uint32_t) std::lround(DECAY * 65536.0f);
+  for (int k = 1; k < 9; k++)
+    decay_pow_q16_[k] = (uint32_t) (((uint64_t) decay_pow_q16_[k - 1] * decay_pow_q16_[k - 1] + 32768) >> 16);
+
   // Initialize flash storage preferences
-  pref_ = global_preferences->make_preference<LearnMatrixData>(fnv1_hash("hwc_learn"));
+  pref_ = global_preferences->make_preference<LearnMatrixData>(pref_key_("hwc_learn"));
+  journal_pref_ = global_preferences->make_preference<LearnJournalData>(pref_key_("hwc_journal"));
+  // Before the calibration: a learned preheat lead beats the calibrated guess
+  runtime_pref_ = global_preferences->make_preference<RuntimeStateData>(pref_key_("hwc_runtime"));
+  load_runtime_state_();
+  calibration_pref_ = global_preferences->make_preference<CalibrationData>(pref_key_("hwc_calib"));
+  load_calibration_();
+  energy_pref_ = global_preferences->make_preference<EnergyTotalsData>(pref_key_("hwc_energy"));
+  load_energy_totals_();
+  sched_stats_pref_ = global_preferences->make_preference<ScheduleStatsData>(pref_key_("hwc_sched"));
+  load_schedule_stats_();
 
   // Try to load learning matrix from flash
   load_learning_matrix_();
 
-  ESP_LOGI(TAG, "Setup complete (dT outlet=%.1f°C, dT return=%.1f°C)",
+  ESP_LOGI(TAG, "%sSetup complete (dT outlet=%.1f°C, dT return=%.1f°C)", log_prefix_.c_str(),
            temp_rise_threshold_, return_rise_threshold_);
+  if (coordinator_ != nullptr && coordinator_->get_circuits().size() > 1)
+    ESP_LOGI(TAG, "%sCircuit %s of %u, automatic starts staggered by %u s", log_prefix_.c_str(),
+             circuit_.c_str(), (unsigned) coordinator_->get_circuits().size(), start_stagger_ms_ / 1000);
 
   if (led_green_) {
     led_green_->set_state(false);
@@ -46,92 +192,661 @@ void HotWaterController::setup() {
   // first-difference detector alias against the sensor's own 1 s publish clock
   // and miss draws. The callback fires exactly once per published value, at its
   // true timestamp, so loop jitter no longer affects detection.
+  // The SLOPE detector fits the raw readings: the YAML moving average would
+  // only add lag to a least-squares fit that already averages the noise.
+  // With fast_temperature_sensor fused into the outlet, the detector runs on
+  // the fast sensor's clock instead (see below) and only falls back to the
+  // outlet readings while the fused value is unavailable.
+  // With control_task the callbacks only queue the reading (feed_sample_()).
   if (outlet_) {
-    outlet_->add_on_state_callback([this](float v) { this->on_outlet_sample_(v); });
-    ESP_LOGI(TAG, "Water-draw detection bound to outlet sensor callback");
+    if (draw_detector_ == DrawDetector::SLOPE)
+      outlet_->add_on_raw_state_callback([this](float v) { this->feed_sample_(SampleSource::OUTLET_RAW, v); });
+    outlet_->add_on_state_callback([this](float v) { this->feed_sample_(SampleSource::OUTLET, v); });
+    ESP_LOGI(TAG, "Water-draw detection bound to outlet sensor callback (%s)",
+             draw_detector_ == DrawDetector::SLOPE ? "slope, raw samples" : "classic");
   } else {
     ESP_LOGW(TAG, "Outlet sensor not configured - water-draw detection disabled!");
   }
+
+  // New return / button values are the only other inputs of a loop() pass
+  // that are not time-driven (pump stop on target, button press timing).
+  if (ret_)
+    ret_->add_on_state_callback([this](float v) { this->feed_sample_(SampleSource::RETURN, v); });
+  if (fast_) {
+    fast_->add_on_state_callback([this](float v) { this->feed_sample_(SampleSource::FAST, v); });
+    ESP_LOGI(TAG, "Fast temperature input fused with the %s sensor (offset time constant %.0f s)",
+             fuse_target_ == FuseTarget::OUTLET ? "outlet" : "return", fuse_tau_s_);
+  }
+  if (button_)
+    button_->add_on_state_callback([this](bool) { this->wake_pending_ = true; });
+  // Switch state feedback: our own turn_on()/turn_off() always agree with
+  // pump_running_ (set first). Anything else is the pump switch reporting the
+  // real relay state, e.g. the smart plug switch on an event-stream or
+  // read-back mismatch (plug rebooted, switched at the plug).
+  if (pump_)
+    pump_->add_on_state_callback([this](bool on) { this->on_pump_feedback_(on); });
+
+#ifdef HOTCIRC_TRACE
+  if (trace_capacity_ > 0) {
+    RAMAllocator<TraceRecord> allocator;  // PSRAM first, internal RAM as fallback
+    trace_ = allocator.allocate(trace_capacity_);
+    if (trace_ == nullptr) {
+      ESP_LOGE(TAG, "Trace: could not allocate %u records - recorder disabled", trace_capacity_);
+      trace_capacity_ = 0;
+    } else {
+      // 2 samples/s when idle -> capacity / 7200 hours
+      ESP_LOGI(TAG, "Trace: %u records (%u KB, ~%.1f h of samples)", trace_capacity_,
+               (unsigned) (trace_capacity_ * sizeof(TraceRecord) / 1024), trace_capacity_ / 7200.0f);
+    }
+  }
+#ifdef HOTCIRC_TRACE_HTTP
+  if (trace_ != nullptr && web_server_base::global_web_server_base != nullptr) {
+    auto *handler = new TraceDownloadHandler(this);  // NOLINT
+    web_server_base::global_web_server_base->add_handler(handler);
+    ESP_LOGI(TAG, "Trace download: GET %s", handler->get_url().c_str());
+  }
+#endif
+#endif
+
+#ifdef HOTCIRC_EVENTS_HTTP
+  if (web_server_base::global_web_server_base != nullptr) {
+    auto *handler = new EventLogHandler(this);  // NOLINT
+    web_server_base::global_web_server_base->add_handler(handler);
+    ESP_LOGI(TAG, "Event log: GET %s", handler->get_url().c_str());
+  }
+#endif
+
+#ifdef HOTCIRC_CONTROL_TASK
+  if (control_enabled_) start_control_task_();
+#endif
+
+#ifdef HOTCIRC_LIGHT_SLEEP
+#if defined(USE_ESP_IDF) && defined(CONFIG_PM_ENABLE)
+  // Let the idle task enter light sleep while loop() has nothing due. The
+  // CPU scales down to XTAL (40 MHz) between wakes.
+  esp_pm_config_t pm_config{};
+  pm_config.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+  pm_config.min_freq_mhz = 40;
+  pm_config.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&pm_config);
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Automatic light sleep enabled (%d-%d MHz)", pm_config.min_freq_mhz, pm_config.max_freq_mhz);
+  } else {
+    ESP_LOGW(TAG, "esp_pm_configure() failed: %s", esp_err_to_name(err));
+  }
+#else
+  ESP_LOGW(TAG, "light_sleep requested but CONFIG_PM_ENABLE is not set - see sdkconfig_options");
+#endif
+#endif
 }
 
 void HotWaterController::loop() {
-  static uint32_t last = 0;
   uint32_t now = millis();
-  if (last && now - last > 500)
-    ESP_LOGW(TAG, "loop gap %u ms", now - last);
-  last = now;
+  if (last_loop_ms_ && now - last_loop_ms_ > 500)
+    ESP_LOGW(TAG, "%sloop gap %u ms", log_prefix_.c_str(), now - last_loop_ms_);
+  last_loop_ms_ = now;
+
+#ifdef HOTCIRC_PROFILER
+  // Every call counts, including the early returns below: the gap is what
+  // the rest of the node (LVGL, WiFi, other components) leaves us.
+  uint32_t now_us = micros();
+  if (last_loop_us_ != 0)
+    profile_record(ProfileChannel::LOOP_GAP, now_us - last_loop_us_);
+  last_loop_us_ = now_us;
+  if ((int32_t) (now - profile_next_publish_ms_) >= 0) {
+    if (profile_next_publish_ms_ != 0) publish_profile_();
+    profile_next_publish_ms_ = now + profile_interval_ms_;
+  }
+#endif
+
+#ifdef HOTCIRC_CONTROL_TASK
+  if (main_work_.load(std::memory_order_relaxed) != 0) run_main_work_();
+  if (sample_overruns_ != logged_overruns_) {
+    ESP_LOGW(TAG, "%sControl task fell behind: %u reading(s) dropped", log_prefix_.c_str(),
+             sample_overruns_ - logged_overruns_);
+    logged_overruns_ = sample_overruns_;
+  }
+#endif
+
+  // Nothing due and no callback asked for a pass: return before even
+  // reading the clock.
+  if (!wake_pending_ && (int32_t) (now - next_deadline_ms_) < 0)
+    return;
+  HOTCIRC_CORE_LOCK();
+  wake_pending_ = false;
 
-  if (!clock_ || !clock_->now().is_valid()) {
+  const TickContext t = make_tick_();
+  if (!t.valid) {
     pump_control();
     handle_button();
     update_leds();
+    next_deadline_ms_ = now + 1000;  // poll until SNTP/RTC delivers a valid time
     return;
   }
 
-  // Initialize last_decay_day_ on first valid clock reading to prevent immediate decay on boot
-  static bool decay_day_initialized = false;
-  if (!decay_day_initialized) {
-    last_decay_day_ = clock_->now().day_of_year;
-    decay_day_initialized = true;
-    ESP_LOGI(TAG, "Initialized last_decay_day_ to current day: %d (prevents decay on boot)", last_decay_day_);
-  }
+  // Learning matrix ages by the elapsed days (also in vacation mode)
+  advance_decay_day_(t);
+
+  if (early_draw_count_ > 0) learn_early_draws_(t, now);
 
   // Check for vacation mode (24h with no water draw)
-  check_vacation_mode_();
+  check_vacation_mode_(t);
+
+  // Midnight / Monday: restart the daily and weekly energy counters
+  if (roll_energy_periods_(t)) {
+    save_energy_totals_();
+    publish_energy_();
+  }
+
+  // Scheduled run whose hit window ran out without a draw
+  check_schedule_outcome_(t);
 
   // ALWAYS check anti-stagnation (runs even when pump disabled or in vacation mode)
-  check_anti_stagnation_();
+  check_anti_stagnation_(t);
 
   // Water-draw detection runs from the outlet sensor publish callback
   // (on_outlet_sample_), registered in setup(). It is intentionally NOT called
   // here so it cannot be starved by loop() stalls on the display node.
 
-  // Skip learning, decay, and automatic pump operations in vacation mode
+  // Skip learning and automatic pump operations in vacation mode
   if (!vacation_mode_) {
-    // Normal mode: run learning and decay
-    decay_table();
-
     // Only run automatic pump operations if enabled
     if (pump_enabled_) {
-      detect_disinfection_cycle_();
-      check_schedule();
-      check_thermal_stagnation_();
+      detect_disinfection_cycle_(t);
+      check_schedule(t);
+      check_thermal_stagnation_(t);
     }
   }
 
+  // Automatic start held back by the circuit stagger (see run_pump())
+  if (deferred_trigger_ != PumpTrigger::NONE && (int32_t) (millis() - deferred_until_ms_) >= 0) {
+    PumpTrigger trigger = deferred_trigger_;
+    deferred_trigger_ = PumpTrigger::NONE;
+    if (!pump_running_) run_pump(trigger);
+  }
+
   pump_control();
   handle_button();
   update_leds();
+  update_sampling_(millis());
+
+  save_runtime_state_();
 
-  static uint32_t last_matrix_log = 0;
-  uint32_t now_s = millis() / 1000;
-  if (now_s - last_matrix_log >= 60) {
+  // Matrix dump only when the matrix changed, at most once a minute
+  if (matrix_generation_ != logged_generation_ && millis() / 1000 - last_matrix_log_s_ >= 60)
     log_learning_matrix_();
-    last_matrix_log = now_s;
+
+  next_deadline_ms_ = next_deadline_ms_from_(t, millis());
+}
+
+void HotWaterController::feed_sample_(SampleSource source, float v) {
+#ifdef HOTCIRC_CONTROL_TASK
+  if (control_task_ != nullptr) {
+    if (!samples_.push(ControlSample{source, v})) sample_overruns_++;
+    xTaskNotifyGive(control_task_);
+    return;
+  }
+#endif
+  on_sample_(source, v);
+}
+
+// One sensor reading, in its publish callback or on the control task. With
+// the fast sensor fused into the outlet, the detector runs on the fast
+// sensor's clock and only falls back to the outlet readings while the fused
+// value is unavailable.
+void HotWaterController::on_sample_(SampleSource source, float v) {
+  HOTCIRC_CORE_LOCK();
+  const bool fuse_outlet = fast_ != nullptr && fuse_target_ == FuseTarget::OUTLET;
+  switch (source) {
+    case SampleSource::OUTLET_RAW:  // SLOPE detector only
+      if (!fuse_outlet || !fuse_active_(millis())) on_outlet_sample_(v);
+      break;
+    case SampleSource::OUTLET:
+      if (fuse_outlet) on_fuse_slow_sample_(v);
+      if (draw_detector_ != DrawDetector::SLOPE && (!fuse_outlet || !fuse_active_(millis())))
+        on_outlet_sample_(v);
+      integrate_energy_(millis());
+      wake_pending_ = true;  // disinfection / thermal checks need a pass
+      break;
+    case SampleSource::RETURN:
+#ifdef HOTCIRC_TRACE
+      trace_event_(TraceEvent::RETURN, 0, trace_temp_(v));
+#endif
+      if (fast_ != nullptr && fuse_target_ == FuseTarget::RETURN) on_fuse_slow_sample_(v);
+      on_return_sample_(v);
+      integrate_energy_(millis());
+      wake_pending_ = true;
+      break;
+    case SampleSource::FAST:
+      on_fast_sample_(v);
+      if (fuse_outlet && fuse_active_(millis())) {
+        on_outlet_sample_(fuse_value_);
+      } else if (pump_running_) {
+        wake_pending_ = true;  // Stop threshold on the fused return value
+      }
+      break;
+  }
+}
+
+bool HotWaterController::defer_to_main_([[maybe_unused]] uint8_t work) {
+#ifdef HOTCIRC_CONTROL_TASK
+  if (control_task_ != nullptr && xTaskGetCurrentTaskHandle() == control_task_) {
+    main_work_.fetch_or(work);
+    return true;
+  }
+#endif
+  return false;
+}
+
+// Switches are main-task objects (publish_state() runs the API / automation
+// callbacks). From the control task a smart plug's worker still gets the
+// command at once - it only records it and wakes itself - and loop()
+// publishes the state; a GPIO relay is switched by loop().
+void HotWaterController::set_pump_output_(bool on) {
+  if (defer_to_main_(MAIN_PUMP_OUTPUT)) {
+#ifdef HOTCIRC_CONTROL_TASK
+    if (pump_plug_ != nullptr) pump_plug_->request_state(on);
+#endif
+    return;
+  }
+  if (on)
+    pump_->turn_on();
+  else
+    pump_->turn_off();
+}
+
+// The LEDs are outputs like the pump switch: a BinaryOutput behind a
+// power_supply or on LEDC is not safe to drive from the control task.
+void HotWaterController::set_green_led_(bool on) {
+  if (led_green_ == nullptr || defer_to_main_(MAIN_LEDS)) return;
+  led_green_->set_state(on);
+}
+
+#ifdef HOTCIRC_CONTROL_TASK
+void HotWaterController::start_control_task_() {
+  // Clamped for single-core targets; there the priority alone keeps the
+  // task ahead of the loop task
+  const BaseType_t core = std::min<BaseType_t>(control_core_, portNUM_PROCESSORS - 1);
+  if (xTaskCreatePinnedToCore(&HotWaterController::control_task_entry_, "hotcirc_ctl", CONTROL_TASK_STACK, this,
+                              control_priority_, &control_task_, core) != pdPASS) {
+    control_task_ = nullptr;
+    ESP_LOGE(TAG, "%sControl task could not be started - running in the main loop", log_prefix_.c_str());
+    return;
+  }
+  ESP_LOGI(TAG, "%sControl task on core %d (priority %u)%s", log_prefix_.c_str(), (int) core, control_priority_,
+           pump_plug_ != nullptr ? ", smart plug commanded directly" : "");
+}
+
+void HotWaterController::control_task_entry_(void *arg) { static_cast<HotWaterController *>(arg)->control_loop_(); }
+
+/**
+ * Control task (`control_task:`).
+ *
+ * Drains the readings the sensor callbacks queued - draw detection, fusion,
+ * return slope, energy integration - and runs pump_control() every
+ * CONTROL_TICK_MS while the pump runs: MAX_RUN_TIME, the return target and
+ * the pulse phases no longer wait for a loop() pass. loop() keeps the
+ * schedule, learning, persistence and publishing, and what the control task
+ * left it (run_main_work_()). Both take core_lock_ for their work, so no
+ * state is touched twice at once; the lock is never held while waiting.
+ * Log lines from here go through the logger's task log buffer.
+ */
+void HotWaterController::control_loop_() {
+  for (;;) {
+    bool running;
+    {
+      HOTCIRC_CORE_LOCK();
+      ControlSample sample;
+      while (samples_.pop(sample)) on_sample_(sample.source, sample.value);
+      pump_control();
+      running = pump_running_;
+    }
+    ulTaskNotifyTake(pdTRUE, running ? pdMS_TO_TICKS(CONTROL_TICK_MS) : portMAX_DELAY);
+  }
+}
+
+void HotWaterController::run_main_work_() {
+  HOTCIRC_CORE_LOCK();
+  const uint8_t work = main_work_.exchange(0);
+  if (work & MAIN_PUMP_OUTPUT) {
+    // The state commanded by now; toggles in between cancel out
+    const bool on = pump_running_ && !pulse_soaking_;
+    if (pump_->state != on) {
+      if (pump_plug_ != nullptr)
+        pump_->publish_state(on);  // The worker has the command already
+      else
+        set_pump_output_(on);
+    }
+  }
+  if (work & MAIN_LEARN_DRAW) learn_draw_(pending_draw_tick_);
+  if (work & MAIN_SAVE_ENERGY) save_energy_totals_();
+  if (work & MAIN_PUBLISH_ENERGY) publish_energy_();
+  if (work & MAIN_SAVE_CALIBRATION) save_calibration_();
+  if (work & MAIN_LEDS) {
+    set_green_led_(pump_running_);  // The state by now, like the pump output
+    update_leds();
+  }
+}
+#endif
+
+uint32_t HotWaterController::next_deadline_ms_from_(const TickContext &t, uint32_t now_ms) const {
+  uint32_t wait_ms = MAX_IDLE_MS;
+  auto due_in_s = [&wait_ms](int64_t s) {
+    if (s < 0) s = 0;
+    if (s * 1000 < (int64_t) wait_ms) wait_ms = (uint32_t) (s * 1000);
+  };
+  auto due_at_ms = [&wait_ms, now_ms](uint32_t at) {
+    int32_t d = (int32_t) (at - now_ms);
+    if (d < 0) d = 0;
+    if ((uint32_t) d < wait_ms) wait_ms = (uint32_t) d;
+  };
+
+  const int32_t slot_s = SLOT_MINUTES * 60;
+  const int32_t into_slot_s = (t.minute % SLOT_MINUTES) * 60 + t.second;
+  const int32_t into_day_s = t.hour * 3600 + t.minute * 60 + t.second;
+
+  // Slot boundary (learning target, check_schedule current slot). +1 s so
+  // the pass lands inside the new slot, not on its last second.
+  due_in_s(slot_s - into_slot_s + 1);
+  // Lookahead boundary: the slot at now + lead changes every slot_s, offset
+  // by the lead.
+  const int32_t lead_s = (int32_t) get_preheat_lead_seconds();
+  if (lead_s > 0) {
+    int32_t d = ((slot_s - into_slot_s - lead_s) % slot_s + slot_s) % slot_s;
+    due_in_s((d == 0 ? slot_s : d) + 1);
+  }
+  // Midnight (matrix decay, energy periods); hour boundary for the anti-stagnation window
+  // (Sunday 03:00-03:05), its status log and the vacation hourly log.
+  due_in_s(86400 - into_day_s + 1);
+  due_in_s(3600 - (t.minute * 60 + t.second) + 1);
+  if (t.wd == 6 && t.hour == 3 && t.minute < 5) due_in_s(60 - t.second);
+  // Hit window of the last SCHEDULED run
+  if (sched_pending_cell_ >= 0)
+    due_in_s((int64_t) sched_pending_epoch_ + sched_hit_window_s_ - t.epoch);
+  // Vacation entry and post-anti-stagnation lockout expiry
+  if (!vacation_mode_ && last_water_draw_time_ != 0)
+    due_in_s((int64_t) last_water_draw_time_ + 86400 - t.epoch);
+  if (last_anti_stagnation_run_ != 0 && t.epoch - last_anti_stagnation_run_ < 1800)
+    due_in_s((int64_t) last_anti_stagnation_run_ + 1800 - t.epoch);
+  // Thermal-stagnation hold (10 s) and cooldown expiry
+  if (thermal_stagnation_started_ != 0) due_at_ms(thermal_stagnation_started_ + 10000);
+  if (last_thermal_stagnation_run_ != 0 &&
+      t.epoch - last_thermal_stagnation_run_ < (time_t) THERMAL_STAGNATION_COOLDOWN)
+    due_in_s((int64_t) last_thermal_stagnation_run_ + THERMAL_STAGNATION_COOLDOWN - t.epoch);
+
+  // Pump runtime limits (seconds since start, checked by pump_control())
+  if (pump_running_) {
+    const uint32_t limits[] = {MIN_RUN_TIME, MAX_RUN_TIME, ANTI_STAGNATION_RUNTIME, THERMAL_STAGNATION_RUNTIME};
+    for (uint32_t lim : limits) {
+      uint32_t at = pump_start_ms_ + lim * 1000;
+      if ((int32_t) (at - now_ms) > 0) due_at_ms(at);
+    }
+  }
+
+  // LED timers and a pending matrix dump
+  if (led_flash_remaining_ > 0) due_at_ms(led_flash_next_ms_);
+  if (deferred_trigger_ != PumpTrigger::NONE) due_at_ms(deferred_until_ms_);
+  if (pump_running_ && pulse_active_) due_at_ms(pulse_phase_end_ms_);
+  if (sample_fast_ && (int32_t) (sample_fast_until_ms_ - now_ms) > 0) due_at_ms(sample_fast_until_ms_);
+  if ((int32_t) (yellow_led_on_until_ - now_ms) > 0) due_at_ms(yellow_led_on_until_);
+  if (matrix_generation_ != logged_generation_) due_in_s((int64_t) last_matrix_log_s_ + 60 - now_ms / 1000);
+#ifdef HOTCIRC_PROFILER
+  due_at_ms(profile_next_publish_ms_);
+#endif
+
+  return now_ms + wait_ms;
+}
+
+TickContext HotWaterController::tick_from_time_(const ESPTime &n) {
+  TickContext t;
+  if (!n.is_valid()) return t;
+  t.valid = true;
+  t.epoch = n.timestamp;
+  // ESPTime: 1=Sunday, 2=Monday, ..., 7=Saturday -> 0=Mon, ..., 6=Sun
+  int wd = (n.day_of_week == 1) ? 6 : (n.day_of_week - 2);
+  t.wd = (uint8_t) ((wd < 0 || wd > 6) ? 0 : wd);
+  t.hour = n.hour;
+  t.minute = n.minute;
+  t.second = n.second;
+  t.slot = (uint16_t) time_to_slot(n.hour, n.minute);
+  t.day_of_year = n.day_of_year;
+  // Local midnight as a UTC instant, rounded to whole days: any UTC offset
+  // within +-12 h maps each local date to exactly one number, DST included.
+  const int64_t midnight = (int64_t) t.epoch - (t.hour * 3600 + t.minute * 60 + t.second);
+  t.day = (int32_t) ((midnight + 43200) / 86400);
+  return t;
+}
+
+// The valid reading re-anchors the holdover on every pass. ESP-IDF keeps the
+// system time across software resets (OTA, reboot) via the RTC timer, so
+// the time source is valid right after those; only a power cut leaves the
+// node without time until the first sync (see learn_early_draws_()).
+TickContext HotWaterController::make_tick_() {
+  if (!clock_) return TickContext{};
+  const uint32_t now_ms = millis();
+  TickContext t = tick_from_time_(clock_->now());
+  if (t.valid) {
+    if (clock_estimated_) {
+      const int64_t estimate = (int64_t) clock_anchor_epoch_ + (now_ms - clock_anchor_ms_) / 1000;
+      ESP_LOGI(TAG, "%sClock valid again after %u s holdover (estimate was off by %lld s)", log_prefix_.c_str(),
+               (unsigned) ((now_ms - clock_anchor_ms_) / 1000), (long long) (estimate - t.epoch));
+      clock_estimated_ = false;
+      record_mode_(ModeChange::CLOCK_VALID);
+    }
+    clock_anchored_ = true;
+    clock_anchor_epoch_ = t.epoch;
+    clock_anchor_ms_ = now_ms;
+    return t;
+  }
+  if (!clock_anchored_ || clock_holdover_s_ == 0) return t;
+
+  const uint32_t age_s = (now_ms - clock_anchor_ms_) / 1000;
+  if (age_s > clock_holdover_s_) {
+    ESP_LOGW(TAG, "%sClock holdover expired after %u s - waiting for a valid time", log_prefix_.c_str(), age_s);
+    clock_anchored_ = false;
+    clock_estimated_ = false;
+    record_mode_(ModeChange::CLOCK_LOST);
+    return t;
+  }
+  if (!clock_estimated_) {
+    ESP_LOGW(TAG, "%sClock invalid - running on the estimated time for up to %u s", log_prefix_.c_str(),
+             clock_holdover_s_);
+    clock_estimated_ = true;
+    record_mode_(ModeChange::CLOCK_HOLDOVER);
+  }
+  t = tick_from_time_(ESPTime::from_epoch_local(clock_anchor_epoch_ + (time_t) age_s));
+  t.estimated = t.valid;
+  return t;
+}
+
+/**
+ * Adaptive sensor sampling (`adaptive_sampling:`), once per loop() pass.
+ *
+ * The DS18B20s only matter at full rate while something happens: a draw
+ * candidate or confirmed draw (detector resolution), a pump run (stop on
+ * target, energy integration, predictive stop) and a hold time after
+ * either or after an outlet rise (on_outlet_sample_()). In between the idle
+ * loop changes slowly and idle_ms saves bus and CPU time. The rate is set
+ * on the sensor components' pollers here, never from inside a sensor
+ * callback. The resolution stays as configured: the dallas_temp component
+ * writes it to the scratchpad in setup() only.
+ */
+void HotWaterController::update_sampling_(uint32_t now_ms) {
+  if (sample_idle_ms_ == 0) return;
+  if (pump_running_ || draw_pending_ || draw_detected_)
+    sample_fast_until_ms_ = now_ms + sample_hold_ms_;
+  const bool fast = (int32_t) (sample_fast_until_ms_ - now_ms) > 0;
+  if (sample_applied_ && fast == sample_fast_) return;
+  sample_applied_ = true;
+  sample_fast_ = fast;
+  const uint32_t interval_ms = fast ? sample_active_ms_ : sample_idle_ms_;
+  for (PollingComponent *poller : {sample_outlet_poller_, sample_return_poller_}) {
+    if (poller == nullptr) continue;
+    poller->set_update_interval(interval_ms);
+    poller->start_poller();  // Re-arms the "update" interval with the new period
+  }
+  ESP_LOGD(TAG, "%sSensor sampling: %s (%u ms)", log_prefix_.c_str(), fast ? "fast" : "idle", interval_ms);
+}
+
+/**
+ * Sensor fusion (`fast_temperature_sensor:`), fast sensor publish callback.
+ *
+ * The DS18B20 in its thermowell / clamp is accurate but trails the water by
+ * several seconds; a fast probe such as the pump's internal NTC follows it
+ * within about a second but carries an offset (curve fit, ADC, mounting).
+ * Complementary filter: the fused value takes its dynamics from the fast
+ * reading and its level from the slow one,
+ *
+ *   fused = fast - offset,  offset -> (fast - slow) with time constant tau,
+ *
+ * i.e. the slow sensor's low-pass and the fast sensor's high-pass share. The
+ * offset branch is gated: it only moves while both signals are steady (no
+ * change > FUSE_STEADY_RATE over a full FUSE_STEADY_WINDOW_MS window), so
+ * the slow sensor's lag during a rise never leaks into it and the fused
+ * value leads by the full lag. A pump NTC only sees the return water while
+ * the pump runs, so with FuseTarget::RETURN it learns during runs only (the
+ * flat start before the hot water arrives). A steady difference beyond
+ * FUSE_MAX_OFFSET is a sensor fault: the fast input is then ignored.
+ */
+void HotWaterController::on_fast_sample_(float v) {
+  const uint32_t now_ms = millis();
+  sensor::Sensor *slow = fuse_target_ == FuseTarget::OUTLET ? outlet_ : ret_;
+  if (std::isnan(v) || slow == nullptr || std::isnan(slow->state)) return;  // Goes stale, falls back
+  const bool was_fresh = fuse_fast_ms_ != 0 && now_ms - fuse_fast_ms_ < FUSE_STALE_MS;
+  const float dt = was_fresh ? (now_ms - fuse_fast_ms_) / 1000.0f : 0.0f;
+  fuse_fast_ms_ = now_ms;
+
+  // Steadiness on a lightly smoothed copy: an NTC on the ADC is noisier than
+  // a DS18B20 step
+  fuse_fast_level_ = (!was_fresh || std::isnan(fuse_fast_level_))
+                         ? v
+                         : fuse_fast_level_ + (v - fuse_fast_level_) * std::min(1.0f, dt / FUSE_FAST_SMOOTH_S);
+  fuse_fast_steady_ = steady_window_(fuse_fast_level_, now_ms, fuse_fast_anchor_, fuse_fast_anchor_ms_,
+                                     fuse_fast_steady_);
+
+  const float diff = v - slow->state;
+  const bool learn = fuse_fast_steady_ && fuse_slow_steady_ &&
+                     (fuse_target_ == FuseTarget::OUTLET || pump_running_);
+  if (learn) {
+    const bool diverged = std::fabs(diff) > FUSE_MAX_OFFSET;
+    if (diverged != fuse_diverged_) {
+      if (diverged) {
+        ESP_LOGW(TAG, "%sFast temperature input differs by %.1f°C - ignored", log_prefix_.c_str(), diff);
+      } else {
+        ESP_LOGI(TAG, "%sFast temperature input back in range (%.1f°C)", log_prefix_.c_str(), diff);
+      }
+      fuse_diverged_ = diverged;
+    }
+    if (!diverged) {
+      if (std::isnan(fuse_offset_)) {
+        fuse_offset_ = diff;
+        ESP_LOGI(TAG, "%sFast temperature input offset learned: %+.2f°C", log_prefix_.c_str(), diff);
+      } else {
+        fuse_offset_ += (diff - fuse_offset_) * std::min(1.0f, dt / fuse_tau_s_);
+      }
+    }
   }
+  if (!std::isnan(fuse_offset_))
+    fuse_value_ = v - fuse_offset_;
+}
+
+void HotWaterController::on_fuse_slow_sample_(float v) {
+  if (std::isnan(v)) {
+    fuse_slow_steady_ = false;
+    fuse_slow_anchor_ = NAN;
+    return;
+  }
+  fuse_slow_steady_ = steady_window_(v, millis(), fuse_slow_anchor_, fuse_slow_anchor_ms_, fuse_slow_steady_);
+}
+
+// Steady: no excursion beyond FUSE_STEADY_RATE x window from the anchor for a
+// full window. Unsteady at once on an excursion, steady again one clean
+// window later.
+bool HotWaterController::steady_window_(float v, uint32_t now_ms, float &anchor, uint32_t &anchor_ms, bool steady) {
+  const float limit = FUSE_STEADY_RATE * (FUSE_STEADY_WINDOW_MS / 1000.0f);
+  if (std::isnan(anchor) || std::fabs(v - anchor) > limit || now_ms - anchor_ms > 2 * FUSE_STEADY_WINDOW_MS) {
+    anchor = v;
+    anchor_ms = now_ms;
+    return false;
+  }
+  if (now_ms - anchor_ms >= FUSE_STEADY_WINDOW_MS) {
+    anchor = v;
+    anchor_ms = now_ms;
+    return true;
+  }
+  return steady;
+}
+
+bool HotWaterController::fuse_active_(uint32_t now_ms) const {
+  return fast_ != nullptr && !fuse_diverged_ && !std::isnan(fuse_offset_) && !std::isnan(fuse_value_) &&
+         now_ms - fuse_fast_ms_ < FUSE_STALE_MS;
+}
+
+float HotWaterController::get_fused_temperature() const { return fuse_active_(millis()) ? fuse_value_ : NAN; }
+
+// Stop threshold input: the fused return value leads the DS18B20 by its lag.
+// It is clamped to [reading, reading + return_rise], so a wrong offset can
+// neither delay a stop nor end a run before the water has started to warm.
+float HotWaterController::stop_return_value_() const {
+  const float slow = ret_->state;
+  if (fuse_target_ != FuseTarget::RETURN || std::isnan(slow) || !fuse_active_(millis())) return slow;
+  return std::max(slow, std::min(fuse_value_, slow + return_rise_threshold_));
+}
+
+const UiStatus &HotWaterController::get_ui_status() {
+  HOTCIRC_CORE_LOCK();
+  auto temp_dc = [](const sensor::Sensor *s) -> int16_t {
+    if (s == nullptr || std::isnan(s->state)) return UI_NO_TEMP;
+    return (int16_t) std::max(-32767.0f, std::min(32767.0f, std::round(s->state * 10.0f)));
+  };
+  UiStatus s{};
+  s.outlet_dc = temp_dc(outlet_);
+  s.return_dc = temp_dc(ret_);
+  s.trigger = (uint8_t) (pump_running_ ? pump_trigger_ : PumpTrigger::NONE);
+  s.eco_threshold = SCHEDULE_THRESHOLD;
+  s.flags = (pump_running_ ? UI_PUMP_RUNNING : 0) | (draw_pending_ ? UI_DRAW_PENDING : 0) |
+            (vacation_mode_ ? UI_VACATION : 0) | (learning_enabled_ ? UI_LEARNING_ENABLED : 0) |
+            (pump_enabled_ ? UI_PUMP_ENABLED : 0);
+  const UiStatus &o = ui_status_;
+  if (o.version == 0 || s.outlet_dc != o.outlet_dc || s.return_dc != o.return_dc || s.trigger != o.trigger ||
+      s.eco_threshold != o.eco_threshold || s.flags != o.flags) {
+    s.version = o.version + 1;
+    ui_status_ = s;
+  }
+  return ui_status_;
+}
+
+// Draws are stamped with millis() while no time is known; once it is, each
+// one is learned at now - its age. Vacation / last-draw tracking follow
+// from learn_now(), the schedule hit scoring does not apply retroactively.
+void HotWaterController::learn_early_draws_(const TickContext &t, uint32_t now_ms) {
+  for (uint8_t i = 0; i < early_draw_count_; i++) {
+    const uint32_t age_s = (now_ms - early_draw_ms_[i]) / 1000;
+    const TickContext d = tick_from_time_(ESPTime::from_epoch_local(t.epoch - (time_t) age_s));
+    learn_now(d);
+  }
+  ESP_LOGI(TAG, "%sLearned %u draw(s) from before the first valid time", log_prefix_.c_str(), early_draw_count_);
+  early_draw_count_ = 0;
 }
 
 void HotWaterController::log_learning_matrix_() {
   ESP_LOGD("learning", "Learning matrix (D0=Mon, D1=Tue, D2=Wed, D3=Thu, D4=Fri, D5=Sat, D6=Sun)");
-  ESP_LOGD("learning", "30-min slots: AM (0-23 = 00:00-11:59), PM (24-47 = 12:00-23:59)");
+  ESP_LOGD("learning", "%d-min slots, 24 per line, labelled with the line's start time", SLOT_MINUTES);
   char line[250];
   const char* day_names[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
 
   for (int d = 0; d < 7; d++) {
-    // AM slots (0-23 = 00:00-11:59)
-    int pos = snprintf(line, sizeof(line), "%s-AM:", day_names[d]);
-    for (int slot = 0; slot < 24; slot++) {
-      pos += snprintf(line + pos, sizeof(line) - pos, " %3d", learn_[d][slot]);
-    }
-    ESP_LOGD("learning", "%s", line);
-
-    // PM slots (24-47 = 12:00-23:59)
-    pos = snprintf(line, sizeof(line), "%s-PM:", day_names[d]);
-    for (int slot = 24; slot < 48; slot++) {
-      pos += snprintf(line + pos, sizeof(line) - pos, " %3d", learn_[d][slot]);
+    for (int first = 0; first < SLOTS_PER_DAY; first += 24) {
+      int start_min = first * SLOT_MINUTES;
+      int pos = snprintf(line, sizeof(line), "%s-%02d:%02d:", day_names[d], start_min / 60, start_min % 60);
+      for (int slot = first; slot < first + 24; slot++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %3d", cell_(d, slot));
+      }
+      ESP_LOGD("learning", "%s", line);
     }
-    ESP_LOGD("learning", "%s", line);
   }
+  logged_generation_ = matrix_generation_;
+  last_matrix_log_s_ = millis() / 1000;
 }
 
 /**
@@ -164,15 +879,22 @@ void HotWaterController::log_learning_matrix_() {
  */
 void HotWaterController::on_outlet_sample_(float t_now) {
   if (!outlet_) return;
+  HOTCIRC_PROFILE_SCOPE(ProfileChannel::OUTLET_SAMPLE);
+#ifdef HOTCIRC_TRACE
+  trace_event_(TraceEvent::OUTLET, 0, trace_temp_(t_now));
+#endif
 
   // Don't detect draws while the pump is running (pump itself raises outlet temp)
-  if (pump_running_) { reset_water_draw_detection_(); return; }
+  if (pump_running_) { reset_water_draw_detection_(); draw_slope_.reset(); return; }
+
+  // One time snapshot for this callback (lockout check and learning)
+  const TickContext t = make_tick_();
 
   // Anti-stagnation lockout: suppress detection for 30 min after a stagnation run
-  if (last_anti_stagnation_run_ != 0 && clock_ && clock_->now().is_valid()) {
-    time_t now = clock_->now().timestamp;
-    if (now - last_anti_stagnation_run_ < 1800) {
+  if (last_anti_stagnation_run_ != 0 && t.valid) {
+    if (t.epoch - last_anti_stagnation_run_ < 1800) {
       reset_water_draw_detection_();
+      draw_slope_.reset();
       return;
     }
   }
@@ -184,6 +906,21 @@ void HotWaterController::on_outlet_sample_(float t_now) {
   // reading simply spans a longer (correctly normalized) interval.
   if (std::isnan(t_now)) return;
 
+  // Adaptive sampling: any rise switches to the fast rate before the
+  // detectors even see a candidate (the loop pass woken by this sample
+  // applies it)
+  if (sample_idle_ms_ > 0) {
+    const float wake_rise = draw_detector_ == DrawDetector::SLOPE ? SAMPLING_WAKE_RISE_RAW : SAMPLING_WAKE_RISE;
+    if (!std::isnan(sample_last_outlet_) && t_now - sample_last_outlet_ >= wake_rise)
+      sample_fast_until_ms_ = now_ms + sample_hold_ms_;
+    sample_last_outlet_ = t_now;
+  }
+
+  if (draw_detector_ == DrawDetector::SLOPE) {
+    detect_draw_slope_(t, t_now, now_ms);
+    return;
+  }
+
   // First valid reading: arm the reference
   if (std::isnan(this->last_outlet_value_)) {
     this->last_outlet_value_ = t_now;
@@ -200,15 +937,16 @@ void HotWaterController::on_outlet_sample_(float t_now) {
   float delta = t_now - this->last_outlet_value_;
   float rate  = delta / (elapsed_ms / 1000.0f);  // °C/s
 
-  ESP_LOGV(TAG, "Outlet: %.2f°C, delta=%.3f°C, elapsed=%.1fs, rate=%.3f°C/s",
-           t_now, delta, elapsed_ms / 1000.0f, rate);
-
   if (rate >= 0.010f && delta > 0.03f) {
     if (this->draw_detection_started_ == 0) {
-      this->draw_detection_started_ = now_ms;
+      // The rise began somewhere since the previous reading: after a slow
+      // idle interval (adaptive sampling) count it from there, or the
+      // 15 s window would start up to one idle interval late
+      this->draw_detection_started_ = elapsed_ms > 2000 ? this->last_outlet_check_ : now_ms;
+      record_event_(TraceEvent::DRAW_START, 0, trace_temp_(t_now));
       this->initial_draw_temp_      = t_now;
       this->draw_pending_           = true;
-      ESP_LOGI(TAG, "Potential water draw started (T=%.2f°C, delta=%.3f°C, rate=%.3f°C/s)",
+      ESP_LOGD(TAG, "Potential water draw started (T=%.2f°C, delta=%.3f°C, rate=%.3f°C/s)",
                t_now, delta, rate);
     }
 
@@ -222,14 +960,12 @@ void HotWaterController::on_outlet_sample_(float t_now) {
                  "[WATER DRAW] Water draw CONFIRMED! Duration=%.1fs, Total rise=%.2f°C, avg rate=%.3f°C/s",
                  draw_duration_ms / 1000.0f, total_rise, avg_rate);
         this->draw_detected_ = true;
-        this->handle_user_request();
+        record_event_(TraceEvent::DRAW_CONFIRMED, 0, trace_temp_(total_rise));
+        this->handle_user_request(t);
       } else {
         ESP_LOGD(TAG, "Duration OK (%.1fs) but total rise insufficient (%.2f°C < %.2f°C threshold)",
                  draw_duration_ms / 1000.0f, total_rise, temp_rise_threshold_);
       }
-    } else if (draw_duration_ms < MINIMUM_DRAW_DURATION) {
-      ESP_LOGV(TAG, "Draw in progress... %.1fs elapsed, rise so far: %.2f°C",
-               draw_duration_ms / 1000.0f, total_rise);
     }
   } else {
     // Rise paused or reversed.
@@ -254,7 +990,524 @@ void HotWaterController::on_outlet_sample_(float t_now) {
   this->last_outlet_check_ = now_ms;
 }
 
+/**
+ * SLOPE detector (draw_detector: slope), called from on_outlet_sample_() with
+ * every raw outlet reading.
+ *
+ * A least-squares line over the last `draw_slope_window` samples gives the
+ * rise rate b and its t-statistic b / se(b). A tap shows up as a steep,
+ * steady rise (0.1-0.5 °C/s right after opening, vs 0.01 °C/s for boiler
+ * reheat conduction), so "b >= min_rate and t >= min_t over a full window"
+ * confirms within one window (~6 s) instead of the classic 15 s, without
+ * reacting to single quantization steps: one 0.0625 °C step in a 6 s window
+ * is only ~0.01 °C/s.
+ *
+ *  - candidate (draw_pending_, DRAW_START): b >= min_rate / 2 on a full window
+ *  - confirmed: b >= min_rate and t >= min_t -> handle_user_request()
+ *  - reset: candidate whose slope fell back below min_rate / 4, or a
+ *    confirmed draw whose slope turned negative (tap closed)
+ * A gap of > 5 s between readings restarts the window.
+ */
+void HotWaterController::detect_draw_slope_(const TickContext &t, float t_now, uint32_t now_ms) {
+  if (draw_slope_.n > 0 && now_ms - last_outlet_check_ > 5000) draw_slope_.reset();
+  draw_slope_.add(now_ms, t_now);
+  this->last_outlet_value_ = t_now;
+  this->last_outlet_check_ = now_ms;
+  if (!draw_slope_.full()) return;
+
+  const float b = draw_slope_.slope();
+  const float tstat = draw_slope_.t_stat(DRAW_SLOPE_NOISE_VAR);
+
+  if (this->draw_detected_) {
+    if (b < 0.0f) {
+      ESP_LOGD(TAG, "Water draw ended (slope=%.3f°C/s)", b);
+      reset_water_draw_detection_();
+    }
+    return;
+  }
+
+  if (this->draw_detection_started_ == 0) {
+    if (b < draw_slope_min_rate_ * 0.5f) return;
+    this->draw_detection_started_ = now_ms;
+    this->initial_draw_temp_ = t_now;
+    this->draw_pending_ = true;
+    record_event_(TraceEvent::DRAW_START, 0, trace_temp_(t_now));
+    ESP_LOGD(TAG, "Potential water draw started (T=%.2f°C, slope=%.3f°C/s, t=%.1f)", t_now, b, tstat);
+  }
+
+  if (b >= draw_slope_min_rate_ && tstat >= draw_slope_min_t_) {
+    const float window_rise = b * draw_slope_.span_s();
+    ESP_LOGI(TAG, "[WATER DRAW] Water draw CONFIRMED (slope)! slope=%.3f°C/s, t=%.1f, rise over %.0fs window=%.2f°C",
+             b, tstat, draw_slope_.span_s(), window_rise);
+    this->draw_detected_ = true;
+    record_event_(TraceEvent::DRAW_CONFIRMED, 0, trace_temp_(window_rise));
+    this->handle_user_request(t);
+  } else if (b < draw_slope_min_rate_ * 0.25f) {
+    ESP_LOGD(TAG, "Draw detection reset (slope=%.3f°C/s, t=%.1f)", b, tstat);
+    reset_water_draw_detection_();
+  }
+}
+
+// Return readings of the current run, for the predictive stop in
+// pump_control(). Like on_outlet_sample_() this runs in the publish callback,
+// so the slope is sampled at the sensor's own clock, not at loop() passes.
+void HotWaterController::on_return_sample_(float v) {
+  if (!pump_running_ || std::isnan(v)) return;
+  const uint32_t now_ms = millis();
+  if (pump_trigger_ == PumpTrigger::CALIBRATION) {
+    const float rise = (v - baseline_return_) * 100.0f;
+    calibration_curve_.push_back(CalibrationSample{(uint16_t) ((now_ms - pump_start_ms_) / 100),
+                                                   (int16_t) std::max(-32767.0f, std::min(32767.0f, rise))});
+    return;
+  }
+  if (stop_mode_ != StopMode::PREDICTIVE && !pulse_active_) return;
+  if (return_slope_.n > 0 && now_ms - return_slope_.last_ms > 5000) return_slope_.reset();
+  return_slope_.add(now_ms, v);
+}
+
+void HotWaterController::start_calibration() {
+  HOTCIRC_CORE_LOCK();
+  if (pump_running_) {
+    ESP_LOGW(TAG, "Calibration not started: pump is running");
+    return;
+  }
+  if (!outlet_ || !ret_ || std::isnan(outlet_->state) || std::isnan(ret_->state)) {
+    ESP_LOGW(TAG, "Calibration not started: outlet/return sensor invalid");
+    return;
+  }
+  const float delta = outlet_->state - ret_->state;
+  if (delta < CALIBRATION_MIN_DELTA) {
+    ESP_LOGW(TAG, "Calibration not started: loop not cold (outlet-return %.1f°C < %.1f°C)", delta,
+             CALIBRATION_MIN_DELTA);
+    return;
+  }
+  calibration_curve_.clear();
+  calibration_curve_.reserve(MAX_RUN_TIME + 16);
+  ESP_LOGI(TAG, "Calibration started (outlet %.2f°C, return %.2f°C)", outlet_->state, ret_->state);
+  run_pump(PumpTrigger::CALIBRATION);
+  if (!pump_running_) {
+    calibration_curve_.clear();
+    calibration_curve_.shrink_to_fit();
+  }
+}
+
+// Levelled off: the reading rose by at least CALIBRATION_MIN_RISE and by
+// less than 0.15 °C over the last 20 s.
+bool HotWaterController::calibration_plateau_() const {
+  if (calibration_curve_.size() < 2) return false;
+  const CalibrationSample &last = calibration_curve_.back();
+  if (last.rise_cc < (int16_t) (CALIBRATION_MIN_RISE * 100.0f)) return false;
+  for (size_t i = calibration_curve_.size() - 1; i-- > 0;) {
+    if (last.t_ds - calibration_curve_[i].t_ds >= 200)
+      return last.rise_cc - calibration_curve_[i].rise_cc < 15;
+  }
+  return false;
+}
+
+// Evaluates the rise curve when the calibration run ends for any reason
+// (plateau, safety timeout, manual stop). A run that never reached
+// CALIBRATION_MIN_RISE keeps the previous calibration.
+void HotWaterController::finish_calibration_(const TickContext &t, uint32_t elapsed_s) {
+  std::vector<CalibrationSample> curve;
+  curve.swap(calibration_curve_);  // Frees the buffer on return
+  int16_t total = 0;
+  for (const auto &c : curve)
+    total = std::max(total, c.rise_cc);
+  if (curve.empty() || total < (int16_t) (CALIBRATION_MIN_RISE * 100.0f)) {
+    ESP_LOGW(TAG, "%sCalibration failed after %us: return rose only %.2f°C", log_prefix_.c_str(), elapsed_s,
+             total / 100.0f);
+    return;
+  }
+
+  // First crossing of a rise level, linearly interpolated between readings
+  auto crossing_s = [&curve](int16_t level) -> float {
+    for (size_t i = 1; i < curve.size(); i++) {
+      if (curve[i].rise_cc >= level) {
+        const CalibrationSample &a = curve[i - 1], &b = curve[i];
+        const float f = b.rise_cc > a.rise_cc ? (float) (level - a.rise_cc) / (b.rise_cc - a.rise_cc) : 1.0f;
+        return (a.t_ds + f * (b.t_ds - a.t_ds)) / 10.0f;
+      }
+    }
+    return NAN;
+  };
+  // Dead time: first 0.5 °C of rise (8 DS18B20 steps, clear of noise), or
+  // 10 % of the total on a small rise
+  const float dead = crossing_s(std::min<int16_t>(50, total / 10));
+  const float t63 = crossing_s((int16_t) (total * 0.632f));
+  const float heatup = crossing_s((int16_t) ((return_rise_threshold_ - 0.2f) * 100.0f));
+
+  CalibrationData c{};
+  c.magic = CALIBRATION_MAGIC;
+  c.version = CALIBRATION_VERSION;
+  c.epoch = t.valid ? (uint32_t) t.epoch : 0;
+  c.dead_time_s = dead;
+  c.rise_tau_s = t63 - dead;
+  c.heatup_s = heatup;
+  c.total_rise = total / 100.0f;
+  c.flow_lpm = (loop_volume_l_ > 0.0f && dead > 0.0f) ? loop_volume_l_ / (dead / 60.0f) : NAN;
+  c.checksum = prefs_checksum_(&c, offsetof(CalibrationData, checksum));
+
+  calibration_ = c;
+  calibration_valid_ = true;
+  char flow[16] = "n/a";  // No loop_volume, no flow
+  if (!std::isnan(c.flow_lpm)) snprintf(flow, sizeof(flow), "%.2f L/min", c.flow_lpm);
+  ESP_LOGI(TAG, "%sCalibration: dead time %.1fs, rise tau %.1fs, heat-up %.1fs, total rise %.2f°C, flow %s",
+           log_prefix_.c_str(), c.dead_time_s, c.rise_tau_s, c.heatup_s, c.total_rise, flow);
+  save_calibration_();
+  apply_calibration_();
+}
+
+void HotWaterController::save_calibration_() {
+  if (defer_to_main_(MAIN_SAVE_CALIBRATION)) return;
+  const bool ok = calibration_pref_.save(&calibration_);
+  record_save_(SaveTarget::CALIBRATION, ok);
+  if (!ok)
+    ESP_LOGW(TAG, "Failed to save calibration to flash!");
+}
+
+void HotWaterController::load_calibration_() {
+  CalibrationData c{};
+  if (!calibration_pref_.load(&c) || c.magic != CALIBRATION_MAGIC || c.version != CALIBRATION_VERSION ||
+      c.checksum != prefs_checksum_(&c, offsetof(CalibrationData, checksum))) {
+    ESP_LOGI(TAG, "%sNo loop calibration stored - using YAML flow rate / sensor lag", log_prefix_.c_str());
+    return;
+  }
+  calibration_ = c;
+  calibration_valid_ = true;
+  char flow[16] = "n/a";
+  if (!std::isnan(c.flow_lpm)) snprintf(flow, sizeof(flow), "%.2f L/min", c.flow_lpm);
+  ESP_LOGI(TAG, "%sLoop calibration loaded: dead time %.1fs, rise tau %.1fs, heat-up %.1fs, flow %s",
+           log_prefix_.c_str(), c.dead_time_s, c.rise_tau_s, c.heatup_s, flow);
+  apply_calibration_();
+}
+
+// Measured values replace the static guesses:
+//  - flow rate (energy integration), when loop_volume gave one
+//  - return_sensor_lag, unless set in YAML: a first-order reading trails a
+//    ramp by exactly its time constant
+//  - the preheat lead, until SCHEDULED runs have taught a better one
+void HotWaterController::apply_calibration_() {
+  const CalibrationData &c = calibration_;
+  if (!std::isnan(c.flow_lpm) && c.flow_lpm > 0.0f)
+    pump_flow_rate_ = c.flow_lpm;
+  if (return_lag_auto_ && !std::isnan(c.rise_tau_s) && c.rise_tau_s > 0.0f)
+    return_lag_s_ = std::min(c.rise_tau_s, 60.0f);
+  if (preheat_lead_auto_ && std::isnan(learned_lead_s_) && !std::isnan(c.heatup_s))
+    learned_lead_s_ = c.heatup_s + 30.0f;  // Same margin as learn_preheat_lead_()
+}
+
+void HotWaterController::load_runtime_state_() {
+  RuntimeStateData r{};
+  if (!runtime_pref_.load(&r) || r.magic != RUNTIME_STATE_MAGIC || r.version != RUNTIME_STATE_VERSION ||
+      r.checksum != prefs_checksum_(&r, offsetof(RuntimeStateData, checksum))) {
+    ESP_LOGI(TAG, "No runtime state stored - cold start");
+    return;
+  }
+  runtime_saved_ = r;
+  baseline_outlet_ = r.baseline_outlet;
+  learned_lead_s_ = r.learned_lead_s;
+  last_water_draw_time_ = (time_t) r.last_water_draw;
+  last_run_epoch_ = (time_t) r.last_run;
+  last_anti_stagnation_run_ = (time_t) r.last_anti_stagnation_run;
+  last_disinfection_start_ = (time_t) r.last_disinfection_start;
+  last_thermal_stagnation_run_ = (time_t) r.last_thermal_stagnation_run;
+  vacation_mode_ = (r.flags & RUNTIME_VACATION) != 0;
+  learning_enabled_ = (r.flags & RUNTIME_LEARNING_ENABLED) != 0;
+  pump_enabled_ = (r.flags & RUNTIME_PUMP_ENABLED) != 0;
+  ESP_LOGI(TAG, "Runtime state restored: baseline outlet %.1f°C, last draw %u, vacation %s, learning %s, pump %s",
+           baseline_outlet_, r.last_water_draw, vacation_mode_ ? "yes" : "no", learning_enabled_ ? "on" : "off",
+           pump_enabled_ ? "on" : "off");
+}
+
+// Called at the end of every full loop() pass. Builds the record and hands
+// it to the preference only when it differs from the last one - i.e. after
+// a pump run, a draw (in RUNTIME_DRAW_RESOLUTION_S steps), a mode or flag
+// change; the preferences flash_write_interval then batches the NVS write
+// like the energy totals.
+void HotWaterController::save_runtime_state_() {
+  RuntimeStateData r{};
+  r.magic = RUNTIME_STATE_MAGIC;
+  r.version = RUNTIME_STATE_VERSION;
+  r.flags = (vacation_mode_ ? RUNTIME_VACATION : 0) | (learning_enabled_ ? RUNTIME_LEARNING_ENABLED : 0) |
+            (pump_enabled_ ? RUNTIME_PUMP_ENABLED : 0);
+  r.baseline_outlet = baseline_outlet_;
+  r.learned_lead_s = learned_lead_s_;
+  r.last_water_draw = (uint32_t) last_water_draw_time_;
+  if (r.last_water_draw >= runtime_saved_.last_water_draw &&
+      r.last_water_draw - runtime_saved_.last_water_draw < RUNTIME_DRAW_RESOLUTION_S)
+    r.last_water_draw = runtime_saved_.last_water_draw;
+  r.last_run = (uint32_t) last_run_epoch_;
+  r.last_anti_stagnation_run = (uint32_t) last_anti_stagnation_run_;
+  r.last_disinfection_start = (uint32_t) last_disinfection_start_;
+  r.last_thermal_stagnation_run = (uint32_t) last_thermal_stagnation_run_;
+  r.checksum = prefs_checksum_(&r, offsetof(RuntimeStateData, checksum));
+  // NAN != NAN: compare the bytes, not the fields
+  if (std::memcmp(&r, &runtime_saved_, sizeof(r)) == 0) return;
+  const bool ok = runtime_pref_.save(&r);
+  record_save_(SaveTarget::RUNTIME, ok);
+  if (ok) {
+    runtime_saved_ = r;
+  } else {
+    ESP_LOGW(TAG, "Failed to save runtime state to flash!");
+  }
+}
+
+// Calibration, energy totals, schedule statistics and runtime state: the
+// same CRC-32 as the matrix snapshot and journal (a byte-wise sum * 31 hash
+// before, which collides just like the old matrix checksum did). A record
+// written with that hash fails the check once and starts from defaults.
+uint32_t HotWaterController::prefs_checksum_(const void *data, size_t len) {
+  return LearnMatrix::crc32(data, len);
+}
+
+/**
+ * Energy accounting.
+ *
+ * Loop power P = flow (L/s) x (outlet - return) x 4186 J/(L*K) is evaluated
+ * whenever either sensor publishes, and integrated with trapezoids between
+ * consecutive evaluations. The old loop()-driven rectangles both depended on
+ * how often loop() happened to run and held the stale power over a whole
+ * step; the sensor clock is the only place where a new power actually exists.
+ * A NAN reading skips its step, the next valid one bridges the gap.
+ */
+void HotWaterController::integrate_energy_(uint32_t now_ms) {
+  if (!pump_running_ || pulse_soaking_ || !outlet_ || !ret_) return;
+  if (std::isnan(outlet_->state) || std::isnan(ret_->state)) return;
+
+  // Only count positive temperature difference (outlet hotter than return)
+  const float delta_t = std::max(0.0f, outlet_->state - ret_->state);
+  const float power_w = pump_flow_rate_ / 60.0f * delta_t * 4186.0f;
+  if (!std::isnan(last_power_w_)) {
+    const float dt_hours = (now_ms - last_energy_calc_time_) / 3600000.0f;
+    energy_sum_ += 0.5f * (last_power_w_ + power_w) * dt_hours;
+    energy_samples_++;
+  }
+  last_power_w_ = power_w;
+  last_energy_calc_time_ = now_ms;
+}
+
+void HotWaterController::account_energy_(const TickContext &t, PumpTrigger trigger, uint32_t runtime_s, float wh) {
+  roll_energy_periods_(t);
+  const uint8_t tr = (uint8_t) trigger;
+  for (uint8_t p = 0; p < ENERGY_PERIODS; p++) {
+    energy_totals_.wh[p][tr] += wh;
+    energy_totals_.runtime_s[p][tr] += runtime_s;
+  }
+  save_energy_totals_();
+  publish_energy_();
+}
+
+bool HotWaterController::roll_energy_periods_(const TickContext &t) {
+  if (!t.valid) return false;
+  const int32_t day = t.day;
+  const int32_t week = day - t.wd;  // wd 0 = Monday
+  bool changed = false;
+  if (energy_totals_.day != day) {
+    if (energy_totals_.day >= 0)
+      ESP_LOGI(TAG, "Energy: new day, yesterday %.3f kWh / %us pump runtime",
+               get_energy_kwh(EnergyPeriod::DAILY), get_runtime_s(EnergyPeriod::DAILY));
+    for (uint8_t i = 0; i < ENERGY_TRIGGERS; i++) {
+      energy_totals_.wh[(uint8_t) EnergyPeriod::DAILY][i] = 0.0f;
+      energy_totals_.runtime_s[(uint8_t) EnergyPeriod::DAILY][i] = 0;
+    }
+    energy_totals_.day = day;
+    changed = true;
+  }
+  if (energy_totals_.week != week) {
+    for (uint8_t i = 0; i < ENERGY_TRIGGERS; i++) {
+      energy_totals_.wh[(uint8_t) EnergyPeriod::WEEKLY][i] = 0.0f;
+      energy_totals_.runtime_s[(uint8_t) EnergyPeriod::WEEKLY][i] = 0;
+    }
+    energy_totals_.week = week;
+    changed = true;
+  }
+  return changed;
+}
+
+void HotWaterController::load_energy_totals_() {
+  EnergyTotalsData e{};
+  if (!energy_pref_.load(&e) || e.magic != ENERGY_MAGIC || e.version != ENERGY_VERSION ||
+      e.checksum != prefs_checksum_(&e, offsetof(EnergyTotalsData, checksum))) {
+    e = EnergyTotalsData{};
+    e.magic = ENERGY_MAGIC;
+    e.version = ENERGY_VERSION;
+    e.day = -1;
+    e.week = -1;
+    energy_totals_ = e;
+    ESP_LOGI(TAG, "No energy totals stored - starting from zero");
+  } else {
+    energy_totals_ = e;
+    ESP_LOGI(TAG, "Energy totals loaded: lifetime %.3f kWh / %us pump runtime",
+             get_energy_kwh(EnergyPeriod::LIFETIME), get_runtime_s(EnergyPeriod::LIFETIME));
+  }
+  publish_energy_();
+}
+
+// Called after every pump run and period rollover. Only the RAM copy of the
+// preference changes here; the preferences flash_write_interval batches the
+// actual NVS writes, so a burst of short runs costs one flash write.
+void HotWaterController::save_energy_totals_() {
+  if (defer_to_main_(MAIN_SAVE_ENERGY)) return;
+  energy_totals_.checksum = prefs_checksum_(&energy_totals_, offsetof(EnergyTotalsData, checksum));
+  const bool ok = energy_pref_.save(&energy_totals_);
+  record_save_(SaveTarget::ENERGY, ok);
+  if (!ok)
+    ESP_LOGW(TAG, "Failed to save energy totals to flash!");
+}
+
+float HotWaterController::get_energy_kwh(EnergyPeriod period, int8_t trigger) const {
+  const float *row = energy_totals_.wh[(uint8_t) period];
+  if (trigger >= 0) return row[trigger] / 1000.0f;
+  float sum = 0.0f;
+  for (uint8_t i = 0; i < ENERGY_TRIGGERS; i++) sum += row[i];
+  return sum / 1000.0f;
+}
+
+uint32_t HotWaterController::get_runtime_s(EnergyPeriod period, int8_t trigger) const {
+  const uint32_t *row = energy_totals_.runtime_s[(uint8_t) period];
+  if (trigger >= 0) return row[trigger];
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < ENERGY_TRIGGERS; i++) sum += row[i];
+  return sum;
+}
+
+void HotWaterController::publish_energy_() {
+  if (defer_to_main_(MAIN_PUBLISH_ENERGY)) return;
+  for (const EnergySensor &e : energy_sensors_) {
+    if (e.stat == EnergyStat::ENERGY)
+      e.sensor->publish_state(get_energy_kwh(e.period, e.trigger));
+    else
+      e.sensor->publish_state(get_runtime_s(e.period, e.trigger) / 3600.0f);  // hours
+  }
+}
+
+/**
+ * Scheduled-run analytics.
+ *
+ * try_schedule_slot_() opens an outcome for every SCHEDULED run it actually
+ * starts; the first confirmed draw within sched_hit_window_s_ closes it as a
+ * hit, check_schedule_outcome_() closes it as a miss once the window is
+ * over. Only one run is pending at a time - a new SCHEDULED start closes the
+ * previous one as a miss.
+ */
+void HotWaterController::note_schedule_hit_(const TickContext &t) {
+  if (sched_pending_cell_ < 0) return;
+  if (t.epoch - sched_pending_epoch_ > (time_t) sched_hit_window_s_) return;  // miss, closed by the loop
+  record_schedule_outcome_(true);
+}
+
+void HotWaterController::check_schedule_outcome_(const TickContext &t) {
+  if (sched_pending_cell_ < 0) return;
+  if (t.epoch - sched_pending_epoch_ < (time_t) sched_hit_window_s_) return;
+  record_schedule_outcome_(false);
+}
+
+void HotWaterController::record_schedule_outcome_(bool hit) {
+  const int cell = sched_pending_cell_;
+  sched_pending_cell_ = -1;
+  ScheduleStatsData &st = sched_stats_;
+  uint8_t &count = hit ? st.hits[cell] : st.misses[cell];
+  if (count == 255) {
+    st.hits[cell] /= 2;
+    st.misses[cell] /= 2;
+  }
+  count++;
+  if (!hit) {
+    // Still running (window shorter than the run): count what it used so far
+    const float wh = (pump_running_ && pump_trigger_ == PumpTrigger::SCHEDULED) ? energy_sum_ : sched_pending_wh_;
+    st.wasted_wh += wh;
+  }
+  st.hit_rate = std::isnan(st.hit_rate) ? (hit ? 1.0f : 0.0f)
+                                        : st.hit_rate + SCHED_HIT_RATE_ALPHA * ((hit ? 1.0f : 0.0f) - st.hit_rate);
+  ESP_LOGI(TAG, "Scheduled run d=%d slot=%d: %s (slot %u/%u, recent hit rate %.0f%%, wasted %.3f kWh total)",
+           cell / SLOTS_PER_DAY, cell % SLOTS_PER_DAY, hit ? "HIT" : "MISS", st.hits[cell],
+           st.hits[cell] + st.misses[cell], st.hit_rate * 100.0f, st.wasted_wh / 1000.0f);
+
+  if (sched_tune_) tune_schedule_threshold_();
+
+  st.checksum = prefs_checksum_(&st, offsetof(ScheduleStatsData, checksum));
+  const bool ok = sched_stats_pref_.save(&st);
+  record_save_(SaveTarget::SCHEDULE_STATS, ok);
+  if (!ok)
+    ESP_LOGW(TAG, "Failed to save schedule statistics to flash!");
+  publish_schedule_stats_();
+}
+
+// Higher threshold = fewer, surer scheduled runs = higher hit rate. The
+// deadband and the minimum number of outcomes between two steps keep the
+// tuner from chasing single outcomes.
+void HotWaterController::tune_schedule_threshold_() {
+  if (++sched_tune_outcomes_ < SCHED_TUNE_MIN_OUTCOMES) return;
+  const float rate = sched_stats_.hit_rate;
+  const int base = SCHEDULE_THRESHOLD;
+  int eff = get_schedule_threshold();
+  if (rate < sched_tune_target_ - 0.1f)
+    eff += sched_tune_step_;
+  else if (rate > sched_tune_target_ + 0.1f)
+    eff -= sched_tune_step_;
+  else
+    return;
+  eff = std::max<int>(sched_tune_min_, std::min<int>(sched_tune_max_, eff));
+  const int bias = std::max(-128, std::min(127, eff - base));
+  sched_tune_outcomes_ = 0;
+  if (bias == sched_stats_.eco_bias) return;  // at a limit
+  sched_stats_.eco_bias = (int8_t) bias;
+  ESP_LOGI(TAG, "ECO auto-tune: hit rate %.0f%% (target %.0f%%) -> threshold %u (ECO %d %+d)", rate * 100.0f,
+           sched_tune_target_ * 100.0f, get_schedule_threshold(), base, bias);
+  wake();  // re-evaluate the current slot with the new threshold
+}
+
+uint8_t HotWaterController::get_schedule_threshold() const {
+  if (!sched_tune_) return SCHEDULE_THRESHOLD;
+  const int eff = (int) SCHEDULE_THRESHOLD + sched_stats_.eco_bias;
+  return (uint8_t) std::max(0, std::min(255, eff));
+}
+
+float HotWaterController::get_schedule_hit_rate() const {
+  uint32_t hits = 0, total = 0;
+  for (int i = 0; i < MATRIX_CELLS; i++) {
+    hits += sched_stats_.hits[i];
+    total += sched_stats_.hits[i] + sched_stats_.misses[i];
+  }
+  return total ? (float) hits / total : NAN;
+}
+
+float HotWaterController::get_schedule_slot_hit_rate(int wd, int slot) const {
+  const int cell = wd * SLOTS_PER_DAY + slot;
+  const int total = sched_stats_.hits[cell] + sched_stats_.misses[cell];
+  return total ? (float) sched_stats_.hits[cell] / total : NAN;
+}
+
+void HotWaterController::load_schedule_stats_() {
+  ScheduleStatsData st{};
+  if (!sched_stats_pref_.load(&st) || st.magic != SCHEDULE_STATS_MAGIC || st.version != SCHEDULE_STATS_VERSION ||
+      st.slots_per_day != SLOTS_PER_DAY || st.checksum != prefs_checksum_(&st, offsetof(ScheduleStatsData, checksum))) {
+    st = ScheduleStatsData{};
+    st.magic = SCHEDULE_STATS_MAGIC;
+    st.version = SCHEDULE_STATS_VERSION;
+    st.slots_per_day = SLOTS_PER_DAY;
+    st.hit_rate = NAN;
+    ESP_LOGI(TAG, "No schedule statistics stored - starting from zero");
+  } else {
+    ESP_LOGI(TAG, "Schedule statistics loaded: hit rate %.0f%%, wasted %.3f kWh, ECO bias %+d",
+             st.hit_rate * 100.0f, st.wasted_wh / 1000.0f, st.eco_bias);
+  }
+  sched_stats_ = st;
+  publish_schedule_stats_();
+}
+
+void HotWaterController::publish_schedule_stats_() {
+  if (sched_hit_rate_sensor_) {
+    const float rate = get_schedule_hit_rate();
+    if (!std::isnan(rate)) sched_hit_rate_sensor_->publish_state(rate * 100.0f);
+  }
+  if (sched_wasted_sensor_) sched_wasted_sensor_->publish_state(get_schedule_wasted_kwh());
+  if (sched_threshold_sensor_) sched_threshold_sensor_->publish_state(get_schedule_threshold());
+}
+
 void HotWaterController::reset_water_draw_detection_() {
+  if (this->draw_detection_started_ != 0)
+    record_event_(TraceEvent::DRAW_RESET, this->draw_detected_ ? 1 : 0, 0);
   this->draw_detection_started_ = 0;
   this->draw_detected_ = false;
   this->initial_draw_temp_ = NAN;
@@ -270,10 +1523,10 @@ void HotWaterController::reset_water_draw_detection_() {
  * - No disinfection detection
  * Returns to normal mode on first water draw detection
  */
-void HotWaterController::check_vacation_mode_() {
-  if (!clock_ || !clock_->now().is_valid()) return;
+void HotWaterController::check_vacation_mode_(const TickContext &t) {
+  if (!t.valid) return;
 
-  time_t now = clock_->now().timestamp;
+  time_t now = t.epoch;
 
   // If we've never detected a water draw, initialize timestamp to now
   if (last_water_draw_time_ == 0) {
@@ -287,20 +1540,15 @@ void HotWaterController::check_vacation_mode_() {
   // Enter vacation mode if no water draw for 24 hours (86400 seconds)
   if (!vacation_mode_ && time_since_draw >= 86400) {
     vacation_mode_ = true;
-    ESP_LOGW(TAG, "===========================================");
-    ESP_LOGW(TAG, "ENTERING VACATION MODE");
-    ESP_LOGW(TAG, "No water draw detected for 24 hours");
-    ESP_LOGW(TAG, "All learning, decay, and automatic pump operations suspended");
-    ESP_LOGW(TAG, "Will resume on first water draw");
-    ESP_LOGW(TAG, "===========================================");
+    record_mode_(ModeChange::VACATION_ON);
+    ESP_LOGW(TAG, "Vacation mode ON: no water draw for 24 h - learning, decay and automatic runs suspended");
   }
 
   // Log periodic status when in vacation mode
-  static time_t last_vacation_log = 0;
-  if (vacation_mode_ && (now - last_vacation_log >= 3600)) {  // Log every hour
+  if (vacation_mode_ && (now - last_vacation_log_ >= 3600)) {  // Log every hour
     int hours_since_draw = time_since_draw / 3600;
     ESP_LOGI(TAG, "[VACATION MODE] %d hours since last water draw", hours_since_draw);
-    last_vacation_log = now;
+    last_vacation_log_ = now;
   }
 }
 
@@ -317,12 +1565,12 @@ void HotWaterController::check_vacation_mode_() {
  *
  * This maintenance cycle runs REGARDLESS of pump enabled state to protect hardware
  */
-void HotWaterController::check_anti_stagnation_() {
-  if (!clock_ || !clock_->now().is_valid()) return;
+void HotWaterController::check_anti_stagnation_(const TickContext &t) {
+  if (!t.valid) return;
   if (pump_running_) return;  // Don't interrupt an already running pump
 
-  time_t now = clock_->now().timestamp;
-  auto n = clock_->now();
+  time_t now = t.epoch;
+  const int wd = t.wd;
 
   // Anti-stagnation configuration (can be made configurable via YAML)
   const int ANTI_STAG_DAY_OF_WEEK = 6;  // 6 = Sunday (0=Mon, 1=Tue, ..., 6=Sun)
@@ -330,19 +1578,14 @@ void HotWaterController::check_anti_stagnation_() {
   const int ANTI_STAG_MINUTE_START = 0;  // Start at exactly 3:00 AM
   const int ANTI_STAG_MINUTE_END = 5;    // Stop checking after 3:05 AM (5-minute window)
 
-  // Convert day of week to our internal representation
-  int raw_dow = n.day_of_week;  // 1=Sunday, 2=Monday, ..., 7=Saturday
-  int wd = (raw_dow == 1) ? 6 : (raw_dow - 2);  // Convert to 0=Mon...6=Sun
-  if (wd < 0 || wd > 6) wd = 0;
-
   // Check if anti-stagnation is needed (pump disabled OR vacation mode)
   bool needs_anti_stagnation = !pump_enabled_ || vacation_mode_;
 
   // Check if we're in the anti-stagnation time window
   bool in_time_window = (wd == ANTI_STAG_DAY_OF_WEEK &&
-                         n.hour == ANTI_STAG_HOUR &&
-                         n.minute >= ANTI_STAG_MINUTE_START &&
-                         n.minute < ANTI_STAG_MINUTE_END);
+                         t.hour == ANTI_STAG_HOUR &&
+                         t.minute >= ANTI_STAG_MINUTE_START &&
+                         t.minute < ANTI_STAG_MINUTE_END);
 
   // Initialize tracking on first run
   if (last_anti_stagnation_run_ == 0) {
@@ -358,9 +1601,8 @@ void HotWaterController::check_anti_stagnation_() {
 
   // Reset tracking flag if it's NOT the scheduled day/time
   // This allows anti-stagnation to run again next week
-  static bool anti_stag_ran_this_week = false;
-  if (wd != ANTI_STAG_DAY_OF_WEEK || n.hour != ANTI_STAG_HOUR) {
-    anti_stag_ran_this_week = false;
+  if (wd != ANTI_STAG_DAY_OF_WEEK || t.hour != ANTI_STAG_HOUR) {
+    anti_stag_ran_this_week_ = false;
   }
 
   // If system doesn't need anti-stagnation, do nothing
@@ -369,7 +1611,7 @@ void HotWaterController::check_anti_stagnation_() {
   }
 
   // Check if we should run anti-stagnation
-  if (in_time_window && !anti_stag_ran_this_week) {
+  if (in_time_window && !anti_stag_ran_this_week_) {
     ESP_LOGW(TAG, "===========================================");
     ESP_LOGW(TAG, "[ANTI-STAGNATION] Running weekly maintenance");
     ESP_LOGW(TAG, "Scheduled: Sunday 03:00 AM");
@@ -379,14 +1621,12 @@ void HotWaterController::check_anti_stagnation_() {
     ESP_LOGW(TAG, "===========================================");
 
     // Mark as completed for this week
-    anti_stag_ran_this_week = true;
+    anti_stag_ran_this_week_ = true;
     last_anti_stagnation_run_ = now;
 
     // Mark the current time slot so check_schedule() cannot fire in the same
     // slot right after the 30-minute lockout expires.
-    int slot = n.hour * 2 + (n.minute >= 30 ? 1 : 0);
-    if (slot < 0) slot = 0;
-    if (slot > 47) slot = 47;
+    int slot = t.slot;
     last_scheduled_day_ = wd;
     last_scheduled_slot_ = slot;
 
@@ -394,23 +1634,22 @@ void HotWaterController::check_anti_stagnation_() {
     // by checking (now - last_anti_stagnation_run_ < 1800)
 
     ESP_LOGI(TAG, "[ANTI-STAGNATION] Slot d=%d s=%d marked, lockout until %02d:%02d",
-             wd, slot, (n.hour + (n.minute + 30) / 60) % 24, (n.minute + 30) % 60);
+             wd, slot, (t.hour + (t.minute + 30) / 60) % 24, (t.minute + 30) % 60);
 
     // Start pump in anti-stagnation mode (bypasses pump_enabled_ check)
     run_pump(PumpTrigger::ANTI_STAGNATION);
   } else if (needs_anti_stagnation && wd == ANTI_STAG_DAY_OF_WEEK) {
     // Log status on the scheduled day
-    static int last_log_hour = -1;
-    if (n.hour != last_log_hour && n.hour >= 0 && n.hour <= 6) {
-      if (anti_stag_ran_this_week) {
+    if (t.hour != anti_stag_last_log_hour_ && t.hour <= 6) {
+      if (anti_stag_ran_this_week_) {
         ESP_LOGI(TAG, "[ANTI-STAGNATION] Already completed this week");
       } else {
-        int hours_until = ANTI_STAG_HOUR - n.hour;
+        int hours_until = ANTI_STAG_HOUR - t.hour;
         if (hours_until < 0) hours_until += 24;
         ESP_LOGI(TAG, "[ANTI-STAGNATION] Scheduled in %d hours (%s)",
                  hours_until, !pump_enabled_ ? "pump disabled" : "vacation mode");
       }
-      last_log_hour = n.hour;
+      anti_stag_last_log_hour_ = t.hour;
     }
   }
 }
@@ -433,18 +1672,17 @@ void HotWaterController::check_anti_stagnation_() {
  *  - 30-minute cooldown after each flush run
  *  - Condition must persist for 10 s to ignore transient sensor noise
  */
-void HotWaterController::check_thermal_stagnation_() {
+void HotWaterController::check_thermal_stagnation_(const TickContext &t) {
   if (pump_running_) {
     thermal_stagnation_started_ = 0;  // Reset pending state if pump starts for other reason
     return;
   }
 
-  if (!clock_ || !clock_->now().is_valid()) return;
+  if (!t.valid) return;
 
   // Cooldown: don't re-trigger within THERMAL_STAGNATION_COOLDOWN seconds
   if (last_thermal_stagnation_run_ != 0) {
-    time_t now_epoch = clock_->now().timestamp;
-    if ((now_epoch - last_thermal_stagnation_run_) < (time_t)THERMAL_STAGNATION_COOLDOWN)
+    if ((t.epoch - last_thermal_stagnation_run_) < (time_t)THERMAL_STAGNATION_COOLDOWN)
       return;
   }
 
@@ -483,7 +1721,7 @@ void HotWaterController::check_thermal_stagnation_() {
       ESP_LOGW(TAG, "  Running pump for %u s to flush stagnant return water", THERMAL_STAGNATION_RUNTIME);
       ESP_LOGW(TAG, "===========================================");
       thermal_stagnation_started_ = 0;
-      last_thermal_stagnation_run_ = clock_->now().timestamp;
+      last_thermal_stagnation_run_ = t.epoch;
       run_pump(PumpTrigger::THERMAL_STAGNATION);
     }
   } else {
@@ -505,8 +1743,8 @@ void HotWaterController::check_thermal_stagnation_() {
  * - During idle, 40cm pipe cools down, giving falsely low readings
  * - This ensures accurate baseline for disinfection detection
  */
-void HotWaterController::detect_disinfection_cycle_() {
-  if (!outlet_ || !clock_) return;
+void HotWaterController::detect_disinfection_cycle_(const TickContext &t) {
+  if (!outlet_ || !t.valid) return;
 
   float t_now = outlet_->state;
   if (std::isnan(t_now)) return;
@@ -518,7 +1756,7 @@ void HotWaterController::detect_disinfection_cycle_() {
 
     if (temp_elevation >= disinfection_temp_threshold_) {
       // Check cooldown period to prevent re-triggering same disinfection cycle
-      time_t now_epoch = clock_->now().timestamp;
+      time_t now_epoch = t.epoch;
       time_t time_since_last_disinfection = now_epoch - last_disinfection_start_;
 
       if (last_disinfection_start_ == 0 || time_since_last_disinfection >= DISINFECTION_COOLDOWN) {
@@ -530,6 +1768,7 @@ void HotWaterController::detect_disinfection_cycle_() {
 
         // Start pump in disinfection mode
         disinfection_mode_ = true;
+        record_mode_(ModeChange::DISINFECTION);
         run_pump(PumpTrigger::DISINFECTION);
       } else {
         // Still in cooldown period, skip this detection
@@ -540,17 +1779,31 @@ void HotWaterController::detect_disinfection_cycle_() {
   }
 }
 
-void HotWaterController::handle_user_request() {
+void HotWaterController::handle_user_request(const TickContext &t) {
   // FIX #2: this runs in the outlet sensor's publish-callback path
   // (on_outlet_sample_), which fires even before SNTP has synced - unlike
-  // loop(), which guards on clock validity. Never dereference clock_ here
-  // without checking it, and never trust an invalid timestamp.
-  const bool clock_valid = clock_ && clock_->now().is_valid();
-
-  if (learning_enabled_ && clock_valid)
-    learn_now();  // needs a valid time to pick the correct slot
+  // loop(), which guards on clock validity. Never trust an invalid
+  // timestamp; t.valid carries that check from the caller's snapshot.
+  const bool clock_valid = t.valid;
+
+  if (clock_valid) {
+    // On the control task the flash journal, the schedule statistics and
+    // the matrix callbacks wait for loop(); the pump starts right away
+    if (defer_to_main_(MAIN_LEARN_DRAW))
+      pending_draw_tick_ = t;
+    else
+      learn_draw_(t);
+  } else {
+    // No time at all yet: keep the millis() stamp for learn_early_draws_()
+    if (early_draw_count_ == EARLY_DRAWS) {
+      std::memmove(early_draw_ms_, early_draw_ms_ + 1, sizeof(early_draw_ms_) - sizeof(early_draw_ms_[0]));
+      early_draw_count_--;
+    }
+    early_draw_ms_[early_draw_count_++] = millis();
+  }
 
   yellow_led_on_until_ = millis() + 5000;
+  defer_to_main_(MAIN_LEDS);  // On the control task: loop() lights it now, not at its next pass
 
   if (pump_running_) {
     ESP_LOGD(TAG, "Pump already running, request acknowledged");
@@ -561,7 +1814,7 @@ void HotWaterController::handle_user_request() {
   // water draw still deserves a pump run, so default to running.
   bool recent_run = false;
   if (clock_valid && last_run_epoch_ != 0) {
-    time_t now_epoch = clock_->now().timestamp;
+    time_t now_epoch = t.epoch;
     recent_run = (now_epoch - last_run_epoch_) <= (time_t)USER_REQUEST_MAX_AGE;
     if (recent_run) {
       ESP_LOGD(TAG, "Recent pump run detected, skipping (age=%lds)",
@@ -574,25 +1827,28 @@ void HotWaterController::handle_user_request() {
   }
 }
 
-void HotWaterController::learn_now() {
+void HotWaterController::learn_draw_(const TickContext &t) {
+  note_schedule_hit_(t);
+  if (learning_enabled_)
+    learn_now(t);  // needs a valid time to pick the correct slot
+}
+
+void HotWaterController::learn_now(const TickContext &t) {
   // FIX #2: defensive guard - callers must ensure clock validity, but a
   // learning event into a wrong slot is worse than a skipped one.
-  if (!clock_ || !clock_->now().is_valid()) {
+  if (!t.valid) {
     ESP_LOGW(TAG, "learn_now() skipped - clock not valid");
     return;
   }
-  auto n = clock_->now();
 
   // Update last water draw timestamp
-  last_water_draw_time_ = n.timestamp;
+  last_water_draw_time_ = t.epoch;
 
   // Exit vacation mode if we were in it
   if (vacation_mode_) {
     vacation_mode_ = false;
-    ESP_LOGW(TAG, "===========================================");
-    ESP_LOGW(TAG, "EXITING VACATION MODE");
-    ESP_LOGW(TAG, "Water draw detected - resuming normal operation");
-    ESP_LOGW(TAG, "===========================================");
+    record_mode_(ModeChange::VACATION_OFF);
+    ESP_LOGW(TAG, "Vacation mode OFF: water draw detected - resuming normal operation");
   }
 
   // Skip learning if disabled
@@ -600,130 +1856,214 @@ void HotWaterController::learn_now() {
     return;
   }
 
-  int raw_dow = n.day_of_week;  // 1=Sunday, 2=Monday, ..., 7=Saturday (standard C library)
-
-  // Convert to array index: 0=Mon, 1=Tue, ..., 5=Sat, 6=Sun
-  int wd;
-  if (raw_dow == 1) {
-    wd = 6;  // Sunday -> index 6
-  } else {
-    wd = raw_dow - 2;  // Monday(2)->0, Tuesday(3)->1, ..., Saturday(7)->5
-  }
-
-  // Safety bounds check
-  if (wd < 0 || wd > 6) wd = 0;
-
-  // Calculate 30-minute slot
-  int hr = n.hour;
-  int min = n.minute;
-  int slot = hr * 2 + (min >= 30 ? 1 : 0);  // 0-47
-
-  if (slot < 0) slot = 0;
-  if (slot > 47) slot = 47;
+  const int wd = t.wd;
+  const int slot = t.slot;
 
+  advance_decay_day_(t);  // callback path: the loop may not have seen midnight yet
+  age_row_(wd);
   uint16_t val = (uint16_t) learn_[wd][slot] + (uint16_t) LEARN_INC;
   if (val > 255) val = 255;
   learn_[wd][slot] = (uint8_t) val;
+  mark_slot_dirty_(wd, slot);
+  // This draw already got its run (or found the loop hot): mark the slot as
+  // served so the raised cell cannot start a scheduled run after the fact.
+  // The generation bump below still makes check_schedule() re-evaluate.
+  last_scheduled_day_ = wd;
+  last_scheduled_slot_ = slot;
+  notify_matrix_change_();
+
+  // Persist just this increment (small journal record, no full-blob write)
+  journal_append_(wd, slot, LEARN_INC);
 
   const char* day_names[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
-  ESP_LOGI(TAG, "Learned: %s (raw_dow=%d, idx=%d) slot=%d (time %02d:%02d) -> val=%u",
-           day_names[wd], raw_dow, wd, slot, hr, min, learn_[wd][slot]);
+  ESP_LOGI(TAG, "Learned: %s (idx=%d) slot=%d (time %02d:%02d) -> val=%u",
+           day_names[wd], wd, slot, t.hour, t.minute, learn_[wd][slot]);
+}
+
+// Called on every valid pass and before learning. Only on a new local day
+// does it do anything: recompute the seven row factors and mark the cells
+// whose visible value changed. Rows stamped 0 (snapshot from before this
+// scheme, or saved without a valid clock) start aging today - like the old
+// daily pass, which never caught up either. The flash snapshot keeps its
+// stamp, so nothing needs writing here.
+void HotWaterController::advance_decay_day_(const TickContext &t) {
+  if (!t.valid || t.day == decay_today_) return;
+  const int32_t prev = decay_today_;
+  decay_today_ = t.day;
+
+  bool changed = false;
+  for (int d = 0; d < 7; d++) {
+    // Unstamped, or the clock stepped back: start aging from today
+    if (decay_day_[d] == 0 || decay_day_[d] > decay_today_) decay_day_[d] = decay_today_;
+    const uint16_t f = decay_q8_(decay_today_ - decay_day_[d]);
+    if (f == decay_factor_[d]) continue;
+    // Four cells per word: bytes that differ between old and new scaling
+    const uint32_t *w = learn_.row_words(d);
+    for (int i = 0; i < LearnMatrix::ROW_WORDS; i++) {
+      const uint32_t diff = LearnMatrix::scale_word(w[i], decay_factor_[d]) ^ LearnMatrix::scale_word(w[i], f);
+      if (diff == 0) continue;
+      for (int b = 0; b < 4; b++) {
+        if (diff & (0xFFu << (8 * b))) mark_slot_dirty_(d, 4 * i + b);
+      }
+    }
+    decay_factor_[d] = f;
+    changed = true;
+  }
+
+  if (changed) {
+    notify_matrix_change_();
+    const int32_t days = prev != 0 ? std::min<int32_t>(decay_today_ - prev, 32767) : 0;  // 0 = catch-up
+    record_event_(TraceEvent::DECAY, 0, (int16_t) days);
+    if (prev != 0)
+      ESP_LOGD(TAG, "Learning matrix aged to day %d (%d day(s) since the last pass)", decay_today_,
+               decay_today_ - prev);
+    else
+      ESP_LOGD(TAG, "Learning matrix aged to day %d (catching up since the snapshot)", decay_today_);
+  }
 }
 
-void HotWaterController::decay_table() {
-  auto n = clock_->now();
-  if (n.day_of_year == last_decay_day_) return;
+void HotWaterController::age_row_(int day) {
+  if (decay_factor_[day] != 256) {
+    learn_.scale_row(day, decay_factor_[day]);
+    decay_factor_[day] = 256;
+  }
+  if (decay_today_ != 0) decay_day_[day] = decay_today_;
+}
 
-  last_decay_day_ = n.day_of_year;
+// DECAY^days in Q16 from the squarings in decay_pow_q16_. Every factor for
+// days >= 1 is below 65536, so a nonzero value keeps shrinking to 0 (the
+// floor() guarantee of FIX #16).
+uint32_t HotWaterController::decay_q16_(int32_t days) const {
+  if (days <= 0) return 65536;
+  if (days > DECAY_MAX_DAYS) return 0;
+  uint32_t f = 65536;
+  for (int k = 0; k < 9; k++)
+    if (days & (1 << k)) f = (uint32_t) (((uint64_t) f * decay_pow_q16_[k] + 32768) >> 16);
+  return std::min<uint32_t>(f, 65535);
+}
 
-  // FIX #16: floor() instead of round(). With round(), values <= 25 (at
-  // DECAY=0.98) never reach 0 because round(x*0.98)==x for small x - once
-  // learned slots would leave ghost entries forever. floor() guarantees
-  // strict monotonic convergence to 0 for every value.
-  for (int d = 0; d < 7; d++)
-    for (int slot = 0; slot < 48; slot++)
-      learn_[d][slot] = (uint8_t) std::floor(learn_[d][slot] * DECAY);
+uint32_t HotWaterController::get_preheat_lead_seconds() const {
+  uint32_t lead = preheat_lead_s_;
+  if (preheat_lead_auto_ && !std::isnan(learned_lead_s_) && learned_lead_s_ > lead)
+    lead = (uint32_t) learned_lead_s_;
+  return lead > PREHEAT_LEAD_MAX_S ? PREHEAT_LEAD_MAX_S : lead;
+}
 
-  ESP_LOGI(TAG, "Learning matrix decayed");
+// Feed the measured heat-up time of a SCHEDULED run that ended on "Target
+// reached" (the only case where the duration equals the time until the loop
+// was hot). Plus one 30 s poll period, since a trigger can fire up to that
+// late. EWMA weight 0.3: follows seasonal change within a few days, but a
+// single outlier run does not move the lead by more than a third.
+void HotWaterController::learn_preheat_lead_(uint32_t heatup_s) {
+  if (!preheat_lead_auto_) return;
+  float sample = (float) heatup_s + 30.0f;
+  if (std::isnan(learned_lead_s_))
+    learned_lead_s_ = sample;
+  else
+    learned_lead_s_ = learned_lead_s_ * 0.7f + sample * 0.3f;
+  ESP_LOGI(TAG, "Preheat lead learned: heat-up %us -> lead %us", heatup_s, get_preheat_lead_seconds());
+}
 
-  // Save updated matrix to flash at end of each day
-  ESP_LOGI(TAG, "Learning matrix save by daily trigger.");
-  save_learning_matrix_();
+// Fires a SCHEDULED run for (wd, slot) unless that slot already fired.
+// Returns true if the slot met the threshold (fired or already handled).
+// t is the pass's tick; it stamps the pending hit/miss window.
+bool HotWaterController::try_schedule_slot_(const TickContext &t, int wd, int slot, const char *kind, int hr,
+                                            int min) {
+  const uint8_t val = cell_(wd, slot);
+  if (val < get_schedule_threshold()) return false;
+
+  // Prevent re-triggering during the same slot
+  // Only trigger if this is a different day/slot combination than last time
+  if (last_scheduled_day_ == wd && last_scheduled_slot_ == slot) {
+    ESP_LOGD(TAG, "Schedule threshold met for d=%d slot=%d (%s, time %02d:%02d, val=%u) but already triggered this slot",
+             wd, slot, kind, hr, min, val);
+    return true;
+  }
+
+  ESP_LOGI(TAG, "Scheduled preheat triggered for d=%d slot=%d (%s, time %02d:%02d, val=%u)",
+           wd, slot, kind, hr, min, val);
+
+  // Record this day/slot to prevent re-trigger (do this BEFORE checking pump state)
+  last_scheduled_day_ = wd;
+  last_scheduled_slot_ = slot;
+
+  if (!pump_running_) {
+    run_pump(PumpTrigger::SCHEDULED);
+    if (pump_running_ && pump_trigger_ == PumpTrigger::SCHEDULED) {
+      // Hit/miss bookkeeping; a previous run still waiting had no draw
+      if (sched_pending_cell_ >= 0) record_schedule_outcome_(false);
+      sched_pending_cell_ = wd * SLOTS_PER_DAY + slot;
+      sched_pending_epoch_ = t.epoch;
+      sched_pending_wh_ = 0.0f;
+    }
+  } else {
+    ESP_LOGD(TAG, "Pump already running, scheduled trigger recorded but not started");
+  }
+  return true;
 }
 
-void HotWaterController::check_schedule() {
+void HotWaterController::check_schedule(const TickContext &t) {
+  if (!t.valid) return;
+  HOTCIRC_PROFILE_SCOPE(ProfileChannel::CHECK_SCHEDULE);
+
   // ANTI-STAGNATION LOCKOUT: Don't run scheduled operations for 30 minutes after anti-stagnation
   // This ensures clean separation between maintenance and normal operation
-  if (last_anti_stagnation_run_ != 0 && clock_ && clock_->now().is_valid()) {
-    time_t now_epoch = clock_->now().timestamp;
-    time_t time_since_anti_stag = now_epoch - last_anti_stagnation_run_;
+  if (last_anti_stagnation_run_ != 0) {
+    time_t time_since_anti_stag = t.epoch - last_anti_stagnation_run_;
     if (time_since_anti_stag < 1800) {  // 30 minutes = 1800 seconds
       // Still in lockout period - no scheduled runs
       return;
     }
   }
 
-  static uint32_t last_check_ms = 0;
-  uint32_t now_ms = millis();
-  if (now_ms - last_check_ms < 30000)  // Check every 30 seconds
+  // Lookahead: start for the slot beginning within the lead time, so the
+  // loop is hot when the slot starts instead of heating up inside it.
+  const uint32_t lead_s = get_preheat_lead_seconds();
+  TickContext ahead;
+  if (lead_s > 0) ahead = tick_from_time_(ESPTime::from_epoch_local(t.epoch + (time_t) lead_s));
+
+  // Re-evaluate only when an input changed: current or lookahead slot, the
+  // ECO level, or the matrix (learning, load, reset). This replaces the
+  // former 30 s poll; the deadline scheduler wakes loop() exactly at those
+  // slot boundaries, notify_matrix_change_() on a matrix change.
+  const int cell = t.wd * SLOTS_PER_DAY + t.slot;
+  const int ahead_cell = ahead.valid ? ahead.wd * SLOTS_PER_DAY + ahead.slot : -1;
+  const int threshold = get_schedule_threshold();
+  if (cell == sched_cell_ && ahead_cell == sched_ahead_cell_ && threshold == sched_threshold_ &&
+      matrix_generation_ == sched_generation_)
     return;
-  last_check_ms = now_ms;
-
-  auto n = clock_->now();
-  int raw_dow = n.day_of_week;  // 1=Sunday, 2=Monday, ..., 7=Saturday
-
-  // Convert to array index: 0=Mon, 1=Tue, ..., 5=Sat, 6=Sun
-  int wd;
-  if (raw_dow == 1) {
-    wd = 6;  // Sunday -> index 6
-  } else {
-    wd = raw_dow - 2;  // Monday(2)->0, Tuesday(3)->1, ..., Saturday(7)->5
-  }
-
-  if (wd < 0 || wd > 6) wd = 0;
-
-  // Calculate 30-minute slot
-  int hr = n.hour;
-  int min = n.minute;
-  int slot = hr * 2 + (min >= 30 ? 1 : 0);  // 0-47
-
-  if (slot < 0) slot = 0;
-  if (slot > 47) slot = 47;
-
-  if (learn_[wd][slot] >= SCHEDULE_THRESHOLD) {
-    // Prevent re-triggering during the same 30-min slot
-    // Only trigger if this is a different day/slot combination than last time
-    if (last_scheduled_day_ != wd || last_scheduled_slot_ != slot) {
-      ESP_LOGI(TAG, "Scheduled preheat triggered for d=%d slot=%d (time %02d:%02d, val=%u)",
-               wd, slot, hr, min, learn_[wd][slot]);
-
-      // Record this day/slot to prevent re-trigger (do this BEFORE checking pump state)
-      last_scheduled_day_ = wd;
-      last_scheduled_slot_ = slot;
-
-      if (!pump_running_) {
-        run_pump(PumpTrigger::SCHEDULED);
-      } else {
-        ESP_LOGD(TAG, "Pump already running, scheduled trigger recorded but not started");
-      }
-    } else {
-      ESP_LOGD(TAG, "Schedule threshold met for d=%d slot=%d (time %02d:%02d, val=%u) but already triggered this slot",
-               wd, slot, hr, min, learn_[wd][slot]);
-    }
-  }
+  sched_cell_ = cell;
+  sched_generation_ = matrix_generation_;
+  sched_ahead_cell_ = ahead_cell;
+  if (threshold != sched_threshold_ && sched_threshold_sensor_)
+    sched_threshold_sensor_->publish_state(threshold);  // ECO slider or tuner moved it
+  sched_threshold_ = threshold;
+
+  // Current slot first: covers boot or an ECO change in the middle of a slot.
+  if (try_schedule_slot_(t, t.wd, t.slot, "current", t.hour, t.minute)) return;
+
+  if (ahead.valid && ahead_cell != cell)
+    try_schedule_slot_(t, ahead.wd, ahead.slot, "lookahead", ahead.hour, ahead.minute);
 }
 
 void HotWaterController::enable_pump() {
+  HOTCIRC_CORE_LOCK();
   pump_enabled_ = true;
+  record_mode_(ModeChange::PUMP_ENABLED);
+  sched_cell_ = -1;  // evaluate the current slot again right away
+  wake();
   ESP_LOGI(TAG, "Pump ENABLED - automatic operation resumed");
 }
 
 void HotWaterController::disable_pump() {
+  HOTCIRC_CORE_LOCK();
   pump_enabled_ = false;
+  record_mode_(ModeChange::PUMP_DISABLED);
+  wake();
   ESP_LOGI(TAG, "Pump DISABLED - all automatic operation suspended (learning preserved)");
   // If pump is currently running, stop it
   if (pump_running_) {
-    stop_pump("Pump disabled");
+    stop_pump(StopReason::PUMP_DISABLED);
   }
 }
 
@@ -743,13 +2083,32 @@ const char *HotWaterController::trigger_to_str_(PumpTrigger t) {
     case PumpTrigger::DISINFECTION:       return "Disinfection";
     case PumpTrigger::ANTI_STAGNATION:    return "Anti-Stagnation";
     case PumpTrigger::THERMAL_STAGNATION: return "Thermal-Stagnation Flush";
+    case PumpTrigger::CALIBRATION:        return "Calibration";
     case PumpTrigger::NONE:               return "None";
     default:                              return "Unknown";
   }
 }
 
+const char *HotWaterController::stop_reason_to_str_(StopReason r) {
+  switch (r) {
+    case StopReason::MANUAL_BUTTON:           return "Manual stop";
+    case StopReason::MANUAL_WEBUI:            return "Manual stop (Web UI)";
+    case StopReason::PUMP_DISABLED:           return "Pump disabled";
+    case StopReason::SAFETY_TIMEOUT:          return "Safety timeout";
+    case StopReason::ANTI_STAGNATION_DONE:    return "Anti-stagnation complete";
+    case StopReason::THERMAL_STAGNATION_DONE: return "Thermal-stagnation flush complete";
+    case StopReason::CALIBRATION_DONE:        return "Calibration complete";
+    case StopReason::TARGET:                  return "Target reached";
+    case StopReason::TARGET_FUSED:            return "Target reached (fused)";
+    case StopReason::TARGET_PREDICTED:        return "Target reached (predicted)";
+    case StopReason::ARRIVED_PULSED:          return "Hot water arrived (pulsed)";
+    default:                                  return "Unknown";
+  }
+}
+
 void HotWaterController::run_pump(PumpTrigger trigger) {
   if (!pump_) return;
+  HOTCIRC_CORE_LOCK();
 
   // Check if pump is globally disabled (except for anti-stagnation which bypasses this)
   if (!pump_enabled_ && trigger != PumpTrigger::ANTI_STAGNATION) {
@@ -767,6 +2126,7 @@ void HotWaterController::run_pump(PumpTrigger trigger) {
   // (thermal stagnation is triggered precisely BECAUSE return is too warm)
   if (trigger != PumpTrigger::ANTI_STAGNATION &&
       trigger != PumpTrigger::THERMAL_STAGNATION &&
+      trigger != PumpTrigger::CALIBRATION &&  // start_calibration() checked the loop is cold
       !disinfection_mode_ &&
       ret_->state >= min_return_temp_) {
     ESP_LOGI(TAG, "Pump start skipped: return temperature already hot enough (%.1f°C >= %.1f°C threshold)",
@@ -774,38 +2134,74 @@ void HotWaterController::run_pump(PumpTrigger trigger) {
     return;
   }
 
+  // Multi-circuit: keep automatic starts start_stagger apart from the other
+  // circuits' starts; loop() retries a deferred one when it is due
+  if (coordinator_ != nullptr) {
+    const bool demand = trigger == PumpTrigger::MANUAL_BUTTON || trigger == PumpTrigger::MANUAL_WEBUI ||
+                        trigger == PumpTrigger::WATER_DRAW || trigger == PumpTrigger::CALIBRATION;
+    uint32_t now_ms = millis();
+    uint32_t wait_ms = coordinator_->claim_start(this, now_ms, start_stagger_ms_, demand);
+    if (wait_ms > 0) {
+      if (deferred_trigger_ != trigger)
+        ESP_LOGI(TAG, "%sPump start deferred %.1f s (trigger: %s, staggered behind another circuit)",
+                 log_prefix_.c_str(), wait_ms / 1000.0f, trigger_to_str_(trigger));
+      deferred_trigger_ = trigger;
+      deferred_until_ms_ = now_ms + wait_ms;
+      wake();
+      return;
+    }
+  }
+  deferred_trigger_ = PumpTrigger::NONE;
+
   // Store trigger reason
   pump_trigger_ = trigger;
 
   baseline_return_ = ret_->state;
-  pump_->turn_on();
-  pump_running_ = true;
+  return_slope_.capacity = RETURN_SLOPE_WINDOW;
+  return_slope_.reset();
+  pump_running_ = true;  // Before turn_on(): the state callback compares against it
+  set_pump_output_(true);
   // FIX (millis-Rollover): keep a millisecond reference whose unsigned
   // difference is wrap-safe; pump_start_ (seconds) stays populated for the
   // GUI package.
   pump_start_ms_ = millis();
   pump_start_ = pump_start_ms_ / 1000;
-
-  // Initialize energy tracking
+  // Pulsed circulation: only for the runs that preheat the loop, and only
+  // with a measured transit time to size the bursts on
+  const bool pulse_trigger = trigger == PumpTrigger::SCHEDULED || trigger == PumpTrigger::WATER_DRAW;
+  pulse_active_ = pulse_enabled_ && pulse_trigger && calibration_valid_ && !disinfection_mode_;
+  pulse_soaking_ = false;
+  pulse_paused_ms_ = 0;
+  pulse_count_ = pulse_active_ ? 1 : 0;
+  if (pulse_active_) {
+    const float transit_ms = calibration_.dead_time_s * 1000.0f;
+    pulse_burst_ms_ = std::max<uint32_t>(PULSE_MIN_BURST_MS, (uint32_t) (transit_ms * PULSE_NEXT_BURST));
+    pulse_phase_end_ms_ =
+        pump_start_ms_ + std::max<uint32_t>(PULSE_MIN_BURST_MS, (uint32_t) (transit_ms * PULSE_FIRST_BURST));
+  } else if (pulse_enabled_ && pulse_trigger && !calibration_valid_) {
+    ESP_LOGD(TAG, "Pulsed circulation needs a loop calibration (transit time) - running continuously");
+  }
+  wake();  // runtime deadlines of this run must enter the schedule
+  record_event_(TraceEvent::PUMP_ON, (uint8_t) trigger, trace_temp_(baseline_return_));
+
+  // Initialize energy tracking; the first integration step only records
+  // the starting power
   energy_sum_ = 0.0f;
   energy_samples_ = 0;
-  last_energy_calc_time_ = millis();  // Initialize to current time
+  last_power_w_ = NAN;
+  integrate_energy_(millis());
 
-  if (led_green_) {
-    ESP_LOGI(TAG, "Setting Green LED to ON");
-    led_green_->set_state(true);
-  } else {
-    ESP_LOGW(TAG, "led_green_ is NULL - cannot control LED!");
-  }
+  set_green_led_(true);
 
   // Log pump start with trigger reason (FIX #7: shared mapping)
   const char *trigger_str = trigger_to_str_(trigger);
 
   if (disinfection_mode_) {
-    ESP_LOGI(TAG, "Pump ON - DISINFECTION MODE (trigger: %s, baseline return=%.2f°C, will run max time)",
-             trigger_str, baseline_return_);
+    ESP_LOGI(TAG, "%sPump ON - DISINFECTION MODE (trigger: %s, baseline return=%.2f°C, will run max time)",
+             log_prefix_.c_str(), trigger_str, baseline_return_);
   } else {
-    ESP_LOGI(TAG, "Pump ON (trigger: %s, baseline return=%.2f°C)", trigger_str, baseline_return_);
+    ESP_LOGI(TAG, "%sPump ON (trigger: %s, baseline return=%.2f°C)", log_prefix_.c_str(), trigger_str,
+             baseline_return_);
   }
 
   // Reset draw detection when pump starts to avoid false triggers
@@ -814,52 +2210,21 @@ void HotWaterController::run_pump(PumpTrigger trigger) {
 
 void HotWaterController::pump_control() {
   if (!pump_running_) return;
+  HOTCIRC_PROFILE_SCOPE(ProfileChannel::PUMP_CONTROL);
 
   // Wrap-safe elapsed seconds (unsigned ms difference survives millis rollover)
   uint32_t elapsed = (millis() - pump_start_ms_) / 1000;
 
-  // Calculate energy transferred using actual time deltas
-  if (outlet_ && ret_ && !std::isnan(outlet_->state) && !std::isnan(ret_->state)) {
-    uint32_t now_ms = millis();
-    uint32_t dt_ms = now_ms - last_energy_calc_time_;
-
-    // Only calculate if at least 50ms has passed (avoid division by very small numbers)
-    if (dt_ms >= 50) {
-      // Temperature difference (outlet should be hotter than return)
-      float delta_t = outlet_->state - ret_->state;
-
-      if (delta_t > 0) {  // Only count positive temperature difference
-        // Energy calculation:
-        // Power (W) = Flow rate (L/s) × ΔT (°C) × Specific heat capacity (J/(L·°C))
-        // Energy (Wh) = Power (W) × time (h)
-        //
-        // Flow rate in L/s = pump_flow_rate_ / 60
-        // Specific heat of water = 4186 J/(L·°C)
-        // Time in hours = dt_ms / 3600000
-
-        float flow_rate_ls = pump_flow_rate_ / 60.0f;  // Convert L/min to L/s
-        float power_w = flow_rate_ls * delta_t * 4186.0f;  // Power in Watts
-        float dt_hours = dt_ms / 3600000.0f;  // Time interval in hours
-        float energy_wh = power_w * dt_hours;  // Energy in Wh for this time interval
-
-        energy_sum_ += energy_wh;
-        energy_samples_++;
-      }
-
-      last_energy_calc_time_ = now_ms;  // Update last calculation time
-    }
-  }
-
   // CRITICAL SAFETY: Always enforce maximum runtime regardless of sensor state
   if (elapsed >= MAX_RUN_TIME) {
-    stop_pump("Safety timeout");
+    stop_pump(StopReason::SAFETY_TIMEOUT);
     return;
   }
 
   // Anti-stagnation mode: run for fixed short duration (15 seconds)
   if (pump_trigger_ == PumpTrigger::ANTI_STAGNATION) {
     if (elapsed >= ANTI_STAGNATION_RUNTIME) {
-      stop_pump("Anti-stagnation complete");
+      stop_pump(StopReason::ANTI_STAGNATION_DONE);
     }
     return;  // Skip temperature checks for anti-stagnation
   }
@@ -867,14 +2232,27 @@ void HotWaterController::pump_control() {
   // Thermal stagnation flush: run for fixed short duration, then let temperatures settle
   if (pump_trigger_ == PumpTrigger::THERMAL_STAGNATION) {
     if (elapsed >= THERMAL_STAGNATION_RUNTIME) {
-      stop_pump("Thermal-stagnation flush complete");
+      stop_pump(StopReason::THERMAL_STAGNATION_DONE);
     }
     return;  // Skip temperature checks – return pipe IS hot, normal logic would stop immediately
   }
 
+  // Calibration: the whole rise curve is the measurement, so no target or
+  // predictive stop - run until the return reading levels off.
+  if (pump_trigger_ == PumpTrigger::CALIBRATION) {
+    if (calibration_plateau_())
+      stop_pump(StopReason::CALIBRATION_DONE);
+    return;
+  }
+
   // In disinfection mode, always run for maximum time to ensure full system disinfection
   if (disinfection_mode_) {
-    // Just wait for MAX_RUN_TIME, skip temperature checks
+    // Just wait for MAX_RUN_TIME, skip temperature checks; a pulsed run
+    // turns continuous
+    if (pulse_active_) {
+      resume_burst_(millis());
+      pulse_active_ = false;
+    }
     return;
   }
 
@@ -883,25 +2261,136 @@ void HotWaterController::pump_control() {
   float now_ret = ret_->state;
   if (std::isnan(now_ret)) return;
 
-  // Check if target temperature reached (with 0.2°C tolerance)
-  if (elapsed >= MIN_RUN_TIME &&
-      now_ret >= baseline_return_ + return_rise_threshold_ - 0.2f) {
-    stop_pump("Target reached");
+  // Check if target temperature reached (with 0.2°C tolerance); with a fast
+  // return input on the fused value, which does not trail the water
+  const float target = baseline_return_ + return_rise_threshold_ - 0.2f;
+  const float stop_ret = stop_return_value_();
+  if (elapsed >= MIN_RUN_TIME && stop_ret >= target) {
+    if (pump_trigger_ == PumpTrigger::SCHEDULED)
+      learn_preheat_lead_(elapsed);
+    stop_pump(now_ret >= target ? StopReason::TARGET : StopReason::TARGET_FUSED);
     return;
   }
+
+  // Predictive stop: the published reading trails the water by
+  // return_lag_s_, so the water is already at roughly
+  // now_ret + slope * lag. Only a rising, full window counts, and the
+  // projection is capped at the full rise so one noisy step cannot stop
+  // a run that has barely started warming.
+  if (stop_mode_ == StopMode::PREDICTIVE && elapsed >= MIN_RUN_TIME && return_slope_.full()) {
+    const float slope = return_slope_.slope();
+    if (slope > 0.0f) {
+      const float ahead = std::min(slope * return_lag_s_, return_rise_threshold_);
+      if (now_ret + ahead >= target) {
+        ESP_LOGD(TAG, "Return %.2f°C + %.3f°C/s x %.0fs -> %.2f°C >= target %.2f°C", now_ret, slope,
+                 return_lag_s_, now_ret + ahead, target);
+        if (pump_trigger_ == PumpTrigger::SCHEDULED)
+          learn_preheat_lead_(elapsed + (uint32_t) return_lag_s_);
+        stop_pump(StopReason::TARGET_PREDICTED);
+        return;
+      }
+    }
+  }
+
+  if (pulse_active_)
+    pulse_control_(elapsed);
 }
 
-void HotWaterController::stop_pump(const char *reason) {
+/**
+ * Pulsed circulation, from pump_control() while a pulsed run is active.
+ *
+ * A continuous run pumps until the return sensor reaches the target, but
+ * every tap on the loop has hot water as soon as the front passes the return
+ * line - the sensor sees it only after its lag plus the rise to
+ * return_rise. The first burst moves the front to PULSE_FIRST_BURST of the
+ * calibrated transit time; after that bursts of PULSE_NEXT_BURST alternate
+ * with soaks, during which the sensor catches up with the water in front of
+ * it without the pump pushing more heat into the pipes. A rising
+ * return reading (slope >= arrival_rate over RETURN_SLOPE_WINDOW samples,
+ * and a quarter of return_rise above the start value) in either phase
+ * means the front has arrived and ends the run. The normal target and
+ * MAX_RUN_TIME (wall time) still apply.
+ */
+bool HotWaterController::pulse_control_(uint32_t elapsed_s) {
+  const uint32_t now_ms = millis();
+  if (elapsed_s >= MIN_RUN_TIME && return_slope_.full() && !std::isnan(ret_->state)) {
+    const float slope = return_slope_.slope();
+    const float rise = ret_->state - baseline_return_;
+    if (slope >= pulse_arrival_rate_ && rise >= return_rise_threshold_ * PULSE_ARRIVAL_MIN_RISE) {
+      ESP_LOGD(TAG, "%sReturn rising %.3f°C/s (+%.2f°C) after %u burst(s) - hot water arrived", log_prefix_.c_str(),
+               slope, rise, pulse_count_);
+      if (pump_trigger_ == PumpTrigger::SCHEDULED)
+        learn_preheat_lead_(elapsed_s);
+      stop_pump(StopReason::ARRIVED_PULSED);
+      return true;
+    }
+  }
+  if ((int32_t) (now_ms - pulse_phase_end_ms_) < 0) return false;
+
+  if (!pulse_soaking_) {
+    integrate_energy_(now_ms);  // Close the burst's last trapezoid
+    pulse_soaking_ = true;  // Before turn_off(): the state callback compares against it
+    pulse_soak_start_ms_ = now_ms;
+    pulse_phase_end_ms_ = now_ms + pulse_soak_ms_;
+    set_pump_output_(false);
+    ESP_LOGD(TAG, "%sPulsed run: burst %u done (%.0f s on), soaking %.0f s", log_prefix_.c_str(), pulse_count_,
+             pump_on_ms_(now_ms) / 1000.0f, pulse_soak_ms_ / 1000.0f);
+  } else {
+    resume_burst_(now_ms);
+    pulse_count_++;
+    pulse_phase_end_ms_ = now_ms + pulse_burst_ms_;
+    ESP_LOGD(TAG, "%sPulsed run: burst %u (%.0f s)", log_prefix_.c_str(), pulse_count_, pulse_burst_ms_ / 1000.0f);
+  }
+  wake();
+  return false;
+}
+
+void HotWaterController::resume_burst_(uint32_t now_ms) {
+  if (!pulse_soaking_) return;
+  pulse_paused_ms_ += now_ms - pulse_soak_start_ms_;
+  pulse_soaking_ = false;
+  last_power_w_ = NAN;  // The soak moved no heat: start a new trapezoid series
+  set_pump_output_(true);
+  integrate_energy_(now_ms);
+}
+
+// Wall time of the run minus the soaks of a pulsed run
+uint32_t HotWaterController::pump_on_ms_(uint32_t now_ms) const {
+  return now_ms - pump_start_ms_ - pulse_paused_ms_ - (pulse_soaking_ ? now_ms - pulse_soak_start_ms_ : 0);
+}
+
+// The controller is master: a relay that diverges from pump_running_ is
+// switched back. The smart plug switch re-sends on its own as well; both end
+// up as one command for the same state.
+void HotWaterController::on_pump_feedback_(bool on) {
+  HOTCIRC_CORE_LOCK();
+  const bool commanded = pump_running_ && !pulse_soaking_;  // Off during a pulsed run's soak
+  if (on == commanded) return;
+  pump_divergences_++;
+  ESP_LOGW(TAG, "Pump switch reports %s while the pump is %s - re-asserting (divergence #%u)", on ? "ON" : "OFF",
+           commanded ? "running" : "stopped", pump_divergences_);
+  set_pump_output_(commanded);
+}
+
+void HotWaterController::stop_pump(StopReason reason) {
   if (!pump_) return;
+  HOTCIRC_CORE_LOCK();
+  deferred_trigger_ = PumpTrigger::NONE;  // A stop also cancels a start waiting for the stagger
+  const TickContext t = make_tick_();     // One tick for the whole stop, handed down
 
-  // Calculate and store energy for this cycle (wrap-safe ms difference)
+  // Calculate and store energy for this cycle (wrap-safe ms difference):
+  // close the last trapezoid at the stop time, then book it in the totals
+  integrate_energy_(millis());
   uint32_t elapsed = (millis() - pump_start_ms_) / 1000;
+  const uint32_t on_s = pump_on_ms_(millis()) / 1000;  // < elapsed for a pulsed run
   last_cycle_duration_ = elapsed;
   last_cycle_energy_ = energy_sum_ / 1000.0f;  // Convert Wh to kWh
+  if (pump_running_)
+    account_energy_(t, pump_trigger_, on_s, energy_sum_);
+  if (pump_trigger_ == PumpTrigger::SCHEDULED && sched_pending_cell_ >= 0)
+    sched_pending_wh_ = energy_sum_;  // wasted if the hit window ends without a draw
 
-  ESP_LOGI(TAG, "Pump cycle complete: duration=%us, energy=%.4f kWh (%u samples)",
-           last_cycle_duration_, last_cycle_energy_, energy_samples_);
-
+  const uint8_t bursts = pulse_count_;  // reset below
   // CRITICAL: Update baseline outlet temperature using slow-moving average
   // Captured NOW while fresh hot water from tank is at sensor (before 40cm pipe cools)
   // This represents actual tank temperature and adapts gradually to boiler setpoint changes
@@ -921,12 +2410,12 @@ void HotWaterController::stop_pump(const char *reason) {
     if (std::isnan(baseline_outlet_)) {
       // First time initialization
       baseline_outlet_ = current_outlet;
-      ESP_LOGI(TAG, "Baseline outlet temperature initialized: %.1f°C", baseline_outlet_);
+      ESP_LOGD(TAG, "Baseline outlet temperature initialized: %.1f°C", baseline_outlet_);
     } else {
       // Slow-moving average: 90% old baseline + 10% new reading
       float old_baseline = baseline_outlet_;
       baseline_outlet_ = baseline_outlet_ * 0.9f + current_outlet * 0.1f;
-      ESP_LOGI(TAG, "Baseline outlet temperature updated: %.1f°C -> %.1f°C (reading: %.1f°C)",
+      ESP_LOGD(TAG, "Baseline outlet temperature updated: %.1f°C -> %.1f°C (reading: %.1f°C)",
                old_baseline, baseline_outlet_, current_outlet);
     }
   } else {
@@ -935,26 +2424,29 @@ void HotWaterController::stop_pump(const char *reason) {
              (outlet_ && !std::isnan(outlet_->state)) ? "valid" : "invalid");
   }
 
-  pump_->turn_off();
   pump_running_ = false;
+  pulse_soaking_ = false;
+  pulse_active_ = false;
+  pulse_count_ = 0;
+  set_pump_output_(false);
+  wake();
+  record_event_(TraceEvent::PUMP_OFF, (uint8_t) pump_trigger_, (int16_t) (elapsed > 32767 ? 32767 : elapsed));
+  record_event_(TraceEvent::PUMP_STOP, (uint8_t) reason, (int16_t) std::min(energy_sum_ + 0.5f, 32767.0f));
+  if (pump_trigger_ == PumpTrigger::CALIBRATION)
+    finish_calibration_(t, elapsed);
   pump_trigger_ = PumpTrigger::NONE;  // Reset trigger
   // 0 = "unknown"; handle_user_request() then treats it as "no recent run"
   // and allows an immediate start, which is the safe direction.
-  last_run_epoch_ = (clock_ && clock_->now().is_valid()) ? clock_->now().timestamp : 0;
+  last_run_epoch_ = t.valid ? t.epoch : 0;
 
-  if (led_green_) {
-    ESP_LOGI(TAG, "Setting Green LED to OFF");
-    led_green_->set_state(false);
-  } else {
-    ESP_LOGW(TAG, "led_green_ is NULL - cannot control LED!");
-  }
+  set_green_led_(false);
 
-  if (disinfection_mode_) {
-    ESP_LOGI(TAG, "Pump OFF - Disinfection cycle complete (%s)", reason);
-    disinfection_mode_ = false;  // Clear disinfection mode
-  } else {
-    ESP_LOGI(TAG, "Pump OFF (%s)", reason);
-  }
+  // One line per run; the details are in the event log
+  char pulsed[40] = "";
+  if (bursts > 0) snprintf(pulsed, sizeof(pulsed), ", %u burst(s), on %us", bursts, on_s);
+  ESP_LOGI(TAG, "%sPump OFF (%s%s): %us, %.4f kWh%s", log_prefix_.c_str(), stop_reason_to_str_(reason),
+           disinfection_mode_ ? ", disinfection complete" : "", elapsed, last_cycle_energy_, pulsed);
+  disinfection_mode_ = false;
 
   // Reset draw detection after pump stops
   reset_water_draw_detection_();
@@ -988,7 +2480,7 @@ void HotWaterController::handle_button() {
       // SHORT PRESS - Toggle pump
       if (pump_) {
         if (pump_running_)
-          stop_pump("Manual stop");
+          stop_pump(StopReason::MANUAL_BUTTON);
         else
           run_pump(PumpTrigger::MANUAL_BUTTON);
       }
@@ -1000,6 +2492,7 @@ void HotWaterController::handle_button() {
 
 void HotWaterController::toggle_learning() {
   learning_enabled_ = !learning_enabled_;
+  record_mode_(learning_enabled_ ? ModeChange::LEARNING_ON : ModeChange::LEARNING_OFF);
   if (learning_enabled_) {
     ESP_LOGI(TAG, "Learning ENABLED");
     yellow_led_on_until_ = millis() + 2000;
@@ -1015,18 +2508,43 @@ void HotWaterController::save_learning_matrix_() {
 
   data.magic = MATRIX_MAGIC;
   data.version = MATRIX_VERSION;
+  // New epoch: the journal of the previous snapshot is folded into this one.
+  // A power cut between the two writes below leaves the old journal with a
+  // stale epoch, which load_learning_matrix_() then correctly ignores.
+  data.journal_epoch = (uint8_t) (snapshot_epoch_ + 1);
+  data.slots_per_day = (uint8_t) SLOTS_PER_DAY;
+  data.packing = MATRIX_PACKING;
+
+  // The snapshot holds plain values as of today; journal_reset_() below
+  // records that day for the next boot.
+  for (int d = 0; d < 7; d++) age_row_(d);
 
   // Copy learning matrix
   for (int d = 0; d < 7; d++) {
-    for (int slot = 0; slot < 48; slot++) {
-      data.learn[d][slot] = learn_[d][slot];
+#ifdef HOTCIRC_MATRIX_PACK4
+    // Nearest of 16 levels 0, 17, ..., 255; even slot in the low nibble
+    for (int b = 0; b < MATRIX_ROW_BYTES; b++) {
+      uint8_t lo = (uint8_t) ((learn_[d][2 * b] + 8) / 17);
+      uint8_t hi = (uint8_t) ((learn_[d][2 * b + 1] + 8) / 17);
+      data.learn[d][b] = (uint8_t) (lo | (hi << 4));
     }
-  }
-
-  data.checksum = calculate_checksum_();
-
-  if (pref_.save(&data)) {
-    ESP_LOGI(TAG, "Learning matrix saved to flash (checksum: 0x%08X)", data.checksum);
+#endif
+  }
+#ifndef HOTCIRC_MATRIX_PACK4
+  learn_.copy_to(&data.learn[0][0]);
+#endif
+
+  data.checksum = calculate_checksum_(data.learn);
+
+  const bool ok = pref_.save(&data);
+  record_save_(SaveTarget::SNAPSHOT, ok);
+  if (ok) {
+    saved_generation_ = matrix_generation_;
+    snapshot_epoch_ = data.journal_epoch;
+    ESP_LOGI(TAG, "Learning matrix saved to flash (checksum: 0x%08X, epoch %u)", data.checksum,
+             snapshot_epoch_);
+    journal_reset_();
+    journal_save_();
   } else {
     ESP_LOGW(TAG, "Failed to save learning matrix to flash!");
   }
@@ -1038,121 +2556,277 @@ void HotWaterController::load_learning_matrix_() {
   if (!pref_.load(&data)) {
     ESP_LOGI(TAG, "No saved learning matrix found - initializing with typical daily pattern");
     init_default_pattern_();
+    // Write the base snapshot right away: journal records need one to apply to.
+    save_learning_matrix_();
     return;
   }
 
   // FIX #11: deterministic format detection via magic/version instead of
   // hoping an old layout produces a different additive checksum.
-  if (data.magic != MATRIX_MAGIC || data.version != MATRIX_VERSION) {
-    ESP_LOGW(TAG, "Learning matrix format mismatch (magic=0x%08X, version=%u) - resetting to typical pattern",
-             data.magic, data.version);
+  // Version 3 snapshots also record their slot layout: a 96-slot packed
+  // matrix has the same blob size as a 48-slot plain one, so the size check
+  // of the preferences backend alone cannot tell them apart.
+  if (data.magic != MATRIX_MAGIC || data.version != MATRIX_VERSION ||
+      (MATRIX_VERSION >= 3 && (data.slots_per_day != SLOTS_PER_DAY || data.packing != MATRIX_PACKING))) {
+    ESP_LOGW(TAG, "Learning matrix format mismatch (magic=0x%08X, version=%u, slots=%u, packing=%u) - "
+             "resetting to typical pattern", data.magic, data.version, data.slots_per_day, data.packing);
     init_default_pattern_();
+    save_learning_matrix_();
     return;
   }
 
-  // Validate checksum (guards against flash corruption)
+  // Validate checksum (guards against flash corruption). Snapshots written
+  // before the CRC carry the additive sum; accept it, the next save upgrades.
   uint32_t expected_checksum = calculate_checksum_(data.learn);
-  if (data.checksum != expected_checksum) {
+  if (data.checksum != expected_checksum && data.checksum != calculate_checksum_legacy_(data.learn)) {
     ESP_LOGW(TAG, "Learning matrix checksum mismatch (expected 0x%08X, got 0x%08X) - resetting to typical pattern",
              expected_checksum, data.checksum);
     init_default_pattern_();
+    save_learning_matrix_();
     return;
   }
 
   // Restore learning matrix
+#ifdef HOTCIRC_MATRIX_PACK4
   for (int d = 0; d < 7; d++) {
-    for (int slot = 0; slot < 48; slot++) {
-      learn_[d][slot] = data.learn[d][slot];
+    for (int b = 0; b < MATRIX_ROW_BYTES; b++) {
+      learn_[d][2 * b] = (uint8_t) ((data.learn[d][b] & 0x0F) * 17);
+      learn_[d][2 * b + 1] = (uint8_t) ((data.learn[d][b] >> 4) * 17);
+    }
+  }
+#else
+  learn_.copy_from(&data.learn[0][0]);
+#endif
+  snapshot_epoch_ = data.journal_epoch;
+
+  // Replay the learn increments recorded since this snapshot was written
+  uint8_t replayed = 0;
+  LearnJournalData j;
+  if (journal_pref_.load(&j) && j.magic == JOURNAL_MAGIC &&
+      (j.checksum == journal_checksum_(j) || j.checksum == journal_checksum_legacy_(j)) &&
+      j.epoch == snapshot_epoch_ && j.count <= JOURNAL_CAPACITY) {
+    // Collect the increments first (a cell can repeat), then merge them
+    // into the snapshot in one saturating word pass.
+    LearnMatrix delta;
+    for (uint8_t i = 0; i < j.count; i++) {
+      if (j.cell[i] >= MATRIX_CELLS) continue;
+      uint8_t &cell = delta[j.cell[i] / SLOTS_PER_DAY][j.cell[i] % SLOTS_PER_DAY];
+      uint16_t val = (uint16_t) cell + j.inc[i];
+      cell = (uint8_t) (val > 255 ? 255 : val);
     }
+    learn_.add_saturating(delta);
+    replayed = j.count;
+    journal_ = j;
+  } else {
+    journal_reset_();
+    journal_.decay_day = 0;  // unknown: start aging at the first valid pass
+  }
+  for (int d = 0; d < 7; d++) {
+    decay_day_[d] = journal_.decay_day;
+    decay_factor_[d] = 256;
   }
 
-  ESP_LOGI(TAG, "Learning matrix loaded from flash (checksum: 0x%08X)", data.checksum);
+  mark_matrix_dirty_();
+  notify_matrix_change_();
+  saved_generation_ = matrix_generation_;  // flash (snapshot + journal) holds exactly this
+
+  ESP_LOGI(TAG, "Learning matrix loaded from flash (checksum: 0x%08X, epoch %u, %u journal entries replayed)",
+           data.checksum, snapshot_epoch_, replayed);
   log_learning_matrix_();
 }
 
-uint32_t HotWaterController::calculate_checksum_() const {
-  return calculate_checksum_(learn_);
+void HotWaterController::journal_reset_() {
+  journal_ = LearnJournalData{};
+  journal_.magic = JOURNAL_MAGIC;
+  journal_.epoch = snapshot_epoch_;
+  // Without a valid clock yet the rows still carry the loaded snapshot's stamp
+  journal_.decay_day = (uint16_t) (decay_today_ != 0 ? decay_today_ : decay_day_[0]);
+}
+
+uint32_t HotWaterController::journal_checksum_(const LearnJournalData &j) {
+  return LearnMatrix::crc32(&j, offsetof(LearnJournalData, checksum));
+}
+
+uint32_t HotWaterController::journal_checksum_legacy_(const LearnJournalData &j) {
+  uint32_t sum = j.magic + j.epoch + j.count + j.decay_day;  // decay_day 0: same sum as before
+  for (uint8_t i = 0; i < JOURNAL_CAPACITY; i++)
+    sum += (uint32_t) j.cell[i] * 31u + j.inc[i];
+  return sum;
+}
+
+bool HotWaterController::journal_save_() {
+  journal_.checksum = journal_checksum_(journal_);
+  const bool ok = journal_pref_.save(&journal_);
+  record_save_(SaveTarget::JOURNAL, ok);
+  if (!ok) {
+    ESP_LOGW(TAG, "Failed to save learning journal to flash!");
+    return false;
+  }
+  return true;
+}
+
+void HotWaterController::journal_append_(int day, int slot, uint8_t inc) {
+  if (journal_.count >= JOURNAL_CAPACITY) {
+    // Journal full: compact into a fresh snapshot (learn_ already contains
+    // the new increment, so nothing else needs recording).
+    ESP_LOGI(TAG, "Learning journal full (%u entries) - compacting into snapshot", JOURNAL_CAPACITY);
+    save_learning_matrix_();
+    if (journal_sync_) global_preferences->sync();
+    return;
+  }
+
+  // The snapshot row is replayed as of journal_.decay_day and then ages to
+  // today, so scale the increment back by the days it must not have aged.
+  uint32_t stored = inc;
+  if (journal_.decay_day != 0 && decay_today_ > journal_.decay_day) {
+    const uint32_t f = decay_q16_(decay_today_ - journal_.decay_day);
+    stored = f ? ((uint32_t) inc * 65536 + f / 2) / f : 255;
+  }
+  journal_.cell[journal_.count] = (uint16_t) (day * SLOTS_PER_DAY + slot);
+  journal_.inc[journal_.count] = (uint8_t) std::min<uint32_t>(stored, 255);
+  journal_.count++;
+
+  if (journal_save_()) {
+    saved_generation_ = matrix_generation_;
+    if (journal_sync_) global_preferences->sync();
+    ESP_LOGD(TAG, "Learning journal: entry %u/%u (d=%d s=%d +%u)", journal_.count, JOURNAL_CAPACITY, day, slot, inc);
+  }
+}
+
+// Word-wise LearnMatrix kernels: four cells per uint32_t for the
+// whole-row and whole-matrix passes.
+void LearnMatrix::scale_row(int day, uint32_t f_q8) {
+  uint32_t *w = row_words(day);
+  for (int i = 0; i < ROW_WORDS; i++) w[i] = scale_word(w[i], f_q8);
+}
+
+void LearnMatrix::add_saturating(const LearnMatrix &o) {
+  for (int i = 0; i < WORDS; i++) w_[i] = add_sat_word(w_[i], o.w_[i]);
+}
+
+uint32_t LearnMatrix::crc32(const void *data, size_t len, uint32_t crc) {
+#ifdef USE_ESP32
+  return esp_rom_crc32_le(crc, static_cast<const uint8_t *>(data), len);
+#else
+  // Same polynomial and conditioning as esp_rom_crc32_le()
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+#endif
 }
 
-uint32_t HotWaterController::calculate_checksum_(const uint8_t (&m)[7][48]) {
+uint32_t HotWaterController::calculate_checksum_(const uint8_t (&m)[7][MATRIX_ROW_BYTES]) {
+  return LearnMatrix::crc32(m, sizeof(m));
+}
+
+uint32_t HotWaterController::calculate_checksum_legacy_(const uint8_t (&m)[7][MATRIX_ROW_BYTES]) {
   uint32_t checksum = 0;
   for (int d = 0; d < 7; d++) {
-    for (int slot = 0; slot < 48; slot++) {
-      checksum += m[d][slot];
+    for (int b = 0; b < MATRIX_ROW_BYTES; b++) {
+      checksum += m[d][b];
     }
   }
   return checksum;
 }
 
+void HotWaterController::mark_matrix_dirty_() {
+  // All cell bits set, padding bits of a partial last word kept clear
+  for (int i = 0; i < (int) (sizeof(matrix_dirty_) / sizeof(matrix_dirty_[0])); i++) {
+    const int bits = MATRIX_CELLS - i * 32;
+    matrix_dirty_[i] = bits >= 32 ? ~0u : (1u << bits) - 1u;
+  }
+}
+
+void HotWaterController::clear_matrix_dirty() {
+  for (auto &w : matrix_dirty_) w = 0;
+}
+
+void HotWaterController::notify_matrix_change_() {
+  matrix_generation_++;
+  matrix_change_callback_.call(matrix_generation_);
+  wake();  // check_schedule() re-reads the cells on the next pass
+}
+
 // FIX #11: the typical daily pattern used to be written out three times
 // (load failure, checksum mismatch, manual reset) with subtle differences -
 // the mismatch path did not clear the matrix first. This helper is now the
 // single source: it always clears, then seeds the pattern.
 void HotWaterController::init_default_pattern_() {
-  // Clear the entire learning matrix first
+  // Clear the entire learning matrix first; the pattern is "as of today"
+  learn_.clear();
   for (int d = 0; d < 7; d++) {
-    for (int slot = 0; slot < 48; slot++) {
-      learn_[d][slot] = 0;
-    }
+    decay_day_[d] = decay_today_;
+    decay_factor_[d] = 256;
   }
 
+  // The pattern is written in half-hour units (0 = 00:00-00:29, ..., 47);
+  // each one covers SLOTS_PER_HALF_HOUR matrix slots.
+  auto seed = [this](int d, int half_hour, uint8_t v) {
+    for (int k = 0; k < SLOTS_PER_HALF_HOUR; k++)
+      learn_[d][half_hour * SLOTS_PER_HALF_HOUR + k] = v;
+  };
+
   // Weekday pattern (Mon-Fri)
   for (int d = 0; d < 5; d++) {
-    // Morning shower: 6:00-8:00 AM (slots 12-16)
-    learn_[d][12] = 80;  // 06:00-06:29
-    learn_[d][13] = 120; // 06:30-06:59
-    learn_[d][14] = 120; // 07:00-07:29
-    learn_[d][15] = 100; // 07:30-07:59
-    learn_[d][16] = 80;  // 08:00-08:29
+    // Morning shower: 6:00-8:00 AM (half-hours 12-16)
+    seed(d, 12, 80);  // 06:00-06:29
+    seed(d, 13, 120); // 06:30-06:59
+    seed(d, 14, 120); // 07:00-07:29
+    seed(d, 15, 100); // 07:30-07:59
+    seed(d, 16, 80);  // 08:00-08:29
 
-    // Lunch cooking: 11:30-13:00 (slots 23-25)
-    learn_[d][23] = 80;  // 11:30-11:59
-    learn_[d][24] = 100; // 12:00-12:29
-    learn_[d][25] = 80;  // 12:30-12:59
+    // Lunch cooking: 11:30-13:00 (half-hours 23-25)
+    seed(d, 23, 80);  // 11:30-11:59
+    seed(d, 24, 100); // 12:00-12:29
+    seed(d, 25, 80);  // 12:30-12:59
 
-    // Coming home/dinner: 18:00-19:00 (slots 36-37)
-    learn_[d][36] = 100; // 18:00-18:29
-    learn_[d][37] = 100; // 18:30-18:59
+    // Coming home/dinner: 18:00-19:00 (half-hours 36-37)
+    seed(d, 36, 100); // 18:00-18:29
+    seed(d, 37, 100); // 18:30-18:59
 
-    // Evening bath/shower: 21:00-22:00 (slots 42-43)
-    learn_[d][42] = 100; // 21:00-21:29
-    learn_[d][43] = 80;  // 21:30-21:59
+    // Evening bath/shower: 21:00-22:00 (half-hours 42-43)
+    seed(d, 42, 100); // 21:00-21:29
+    seed(d, 43, 80);  // 21:30-21:59
   }
 
   // Weekend pattern (Sat-Sun) - slightly different timing
   for (int d = 5; d < 7; d++) {
-    // Later morning: 8:00-10:00 AM (slots 16-19)
-    learn_[d][16] = 80;  // 08:00-08:29
-    learn_[d][17] = 100; // 08:30-08:59
-    learn_[d][18] = 100; // 09:00-09:29
-    learn_[d][19] = 80;  // 09:30-09:59
+    // Later morning: 8:00-10:00 AM (half-hours 16-19)
+    seed(d, 16, 80);  // 08:00-08:29
+    seed(d, 17, 100); // 08:30-08:59
+    seed(d, 18, 100); // 09:00-09:29
+    seed(d, 19, 80);  // 09:30-09:59
 
-    // Lunch: 12:00-13:00 (slots 24-25)
-    learn_[d][24] = 100; // 12:00-12:29
-    learn_[d][25] = 80;  // 12:30-12:59
+    // Lunch: 12:00-13:00 (half-hours 24-25)
+    seed(d, 24, 100); // 12:00-12:29
+    seed(d, 25, 80);  // 12:30-12:59
 
-    // Dinner: 18:30-19:30 (slots 37-38)
-    learn_[d][37] = 100; // 18:30-18:59
-    learn_[d][38] = 80;  // 19:00-19:29
+    // Dinner: 18:30-19:30 (half-hours 37-38)
+    seed(d, 37, 100); // 18:30-18:59
+    seed(d, 38, 80);  // 19:00-19:29
 
-    // Evening: 21:00-22:00 (slots 42-43)
-    learn_[d][42] = 100; // 21:00-21:29
-    learn_[d][43] = 80;  // 21:30-21:59
+    // Evening: 21:00-22:00 (half-hours 42-43)
+    seed(d, 42, 100); // 21:00-21:29
+    seed(d, 43, 80);  // 21:30-21:59
   }
 
+  mark_matrix_dirty_();
+  notify_matrix_change_();
+
   ESP_LOGI(TAG, "Initialized learning matrix with typical daily pattern");
   log_learning_matrix_();
 }
 
 void HotWaterController::reset_learning_matrix_() {
-  ESP_LOGW(TAG, "===========================================");
-  ESP_LOGW(TAG, "RESETTING LEARNING MATRIX");
-  ESP_LOGW(TAG, "===========================================");
+  ESP_LOGW(TAG, "Resetting the learning matrix");
+  record_mode_(ModeChange::MATRIX_RESET);
 
   init_default_pattern_();
 
-  last_decay_day_ = 0;
-
   // Save the reinitialized matrix to flash
   save_learning_matrix_();
 
@@ -1188,5 +2862,524 @@ void HotWaterController::update_leds() {
   }
 }
 
+/**
+ * Heap-free learning-matrix export (see MatrixExportFormat in the header).
+ *
+ * The previous YAML lambda built ~1.3 KB of JSON with hundreds of
+ * std::string += / std::to_string calls on every update, fragmenting the
+ * heap on the display node. This writer appends into a fixed buffer with a
+ * bounds-checked cursor; the caller makes exactly one std::string from it
+ * (the text sensor API needs one). COMPACT is ~1/3 the size and needs no
+ * number formatting at all.
+ */
+namespace {
+
+struct BufWriter {
+  char *buf;
+  size_t len;
+  size_t pos{0};
+  bool overflow{false};
+
+  void put(char c) {
+    if (pos + 1 >= len) {
+      overflow = true;
+      return;
+    }
+    buf[pos++] = c;
+  }
+  void put(const char *str) {
+    while (*str) put(*str++);
+  }
+  void put_u8(uint8_t v) {
+    if (v >= 100) put((char) ('0' + v / 100));
+    if (v >= 10) put((char) ('0' + (v / 10) % 10));
+    put((char) ('0' + v % 10));
+  }
+};
+
+const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+}  // namespace
+
+size_t HotWaterController::export_learning_matrix(char *buf, size_t len, MatrixExportFormat format) const {
+  if (buf == nullptr || len == 0) return 0;
+  BufWriter w{buf, len};
+
+  w.put("{\"eco_level\":");
+  w.put_u8(get_schedule_threshold());
+
+  if (format == MatrixExportFormat::COMPACT) {
+    w.put(",\"slots\":");
+    w.put_u8(SLOTS_PER_DAY);
+    w.put(",\"matrix\":\"");
+    auto m = [this](size_t i) { return (uint32_t) cell_(i / SLOTS_PER_DAY, i % SLOTS_PER_DAY); };
+    const size_t n = MATRIX_CELLS;  // multiple of 3 for every layout -> no '=' padding
+    static_assert(MATRIX_CELLS % 3 == 0, "base64 encoder assumes no padding");
+    for (size_t i = 0; i + 2 < n; i += 3) {
+      uint32_t triple = (m(i) << 16) | (m(i + 1) << 8) | m(i + 2);
+      w.put(BASE64_CHARS[(triple >> 18) & 0x3F]);
+      w.put(BASE64_CHARS[(triple >> 12) & 0x3F]);
+      w.put(BASE64_CHARS[(triple >> 6) & 0x3F]);
+      w.put(BASE64_CHARS[triple & 0x3F]);
+    }
+    w.put("\"}");
+  } else {
+    static const char *const DAY_NAMES[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+    w.put(",\"days\":[");
+    for (int day = 0; day < 7; day++) {
+      if (day > 0) w.put(',');
+      w.put("{\"name\":\"");
+      w.put(DAY_NAMES[day]);
+      w.put("\",\"values\":[");
+      for (int slot = 0; slot < SLOTS_PER_DAY; slot++) {
+        if (slot > 0) w.put(',');
+        w.put_u8(cell_(day, slot));
+      }
+      w.put("]}");
+    }
+    w.put("]}");
+  }
+
+  if (w.overflow) {
+    buf[0] = '\0';
+    return 0;
+  }
+  buf[w.pos] = '\0';
+  return w.pos;
+}
+
+/**
+ * Heatmap renderer for the GUI package (page_heatmap canvas).
+ *
+ * The former YAML lambda painted every one of the 336 cells pixel by pixel
+ * (~94000 lv_canvas_set_px() calls, ~400 ms loop() stall) whenever anything
+ * changed. Here each cell is one colour from a precomputed LUT, so a cell is
+ * painted by filling its first 7-pixel row and memcpy()ing that row into the
+ * other 39. Only cells whose colour can have changed are repainted: slots
+ * flagged in the matrix dirty mask, or cells that crossed the ECO threshold.
+ * A single learned draw therefore repaints one 7x40 cell, and an unchanged
+ * matrix (same generation, same ECO) returns without touching any cell.
+ * The renderer is the consumer of the dirty mask and clears it.
+ *
+ * Colours (RGB888, identical to the previous lambda):
+ *   0 -> 0x1A1A1A, <50 -> blue, <120 -> green, <190 -> orange, else red,
+ *   val >= ECO threshold (and > 0) -> yellow 0xF9A825.
+ */
+uint8_t HotWaterController::heatmap_bucket_(uint8_t val) {
+  if (val == 0) return 0;
+  if (val < 50) return 1;
+  if (val < 120) return 2;
+  if (val < 190) return 3;
+  return 4;
+}
+
+void HotWaterController::build_heatmap_lut_(bool swap_bytes) {
+  static const uint32_t BUCKET_RGB[5] = {0x1A1A1A, 0x1565C0, 0x2E7D32, 0xE65100, 0xB71C1C};
+  static const uint32_t ECO_RGB = 0xF9A825;
+
+  auto to_565 = [swap_bytes](uint32_t rgb) -> uint16_t {
+    uint16_t c = ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+    return swap_bytes ? (uint16_t) ((c >> 8) | (c << 8)) : c;
+  };
+
+  for (int b = 0; b < 5; b++) {
+    heatmap_lut_[b][0] = to_565(BUCKET_RGB[b]);
+    // Bucket 0 (val == 0) never counts as "above ECO"
+    heatmap_lut_[b][1] = (b == 0) ? heatmap_lut_[b][0] : to_565(ECO_RGB);
+  }
+  heatmap_lut_swapped_ = swap_bytes;
+}
+
+bool HotWaterController::render_heatmap(uint16_t *buf, uint16_t stride_px, uint8_t eco_threshold,
+                                        bool swap_bytes, HeatmapArea *area) {
+  if (buf == nullptr || stride_px < HEATMAP_WIDTH) return false;
+  HOTCIRC_PROFILE_SCOPE(ProfileChannel::HEATMAP);
+
+  if (!heatmap_valid_ || swap_bytes != heatmap_lut_swapped_) {
+    build_heatmap_lut_(swap_bytes);
+    heatmap_valid_ = false;  // byte order changed -> every cell is stale
+  }
+
+  const bool full = !heatmap_valid_;
+  const bool eco_changed = eco_threshold != heatmap_eco_;
+  if (!full && !eco_changed && matrix_generation_ == heatmap_generation_) return false;
+
+  int16_t x1 = HEATMAP_WIDTH, y1 = HEATMAP_HEIGHT, x2 = -1, y2 = -1;
+
+  for (int day = 0; day < 7; day++) {
+    for (int slot = 0; slot < SLOTS_PER_DAY; slot++) {
+      uint8_t val = cell_(day, slot);
+      bool above = val > 0 && val >= eco_threshold;
+
+      if (!full && !is_slot_dirty(day, slot)) {
+        // Unchanged value: only an ECO threshold crossing changes its colour
+        if (!eco_changed) continue;
+        bool old_above = val > 0 && val >= heatmap_eco_;
+        if (old_above == above) continue;
+      }
+
+      const uint16_t color = heatmap_lut_[heatmap_bucket_(val)][above ? 1 : 0];
+      // Column edges at slot * 336 / SLOTS_PER_DAY: 7 px at 48 slots,
+      // alternating 3/4 px at 96 and 2/3 px at 144.
+      const int x0 = slot * HEATMAP_WIDTH / SLOTS_PER_DAY;
+      const int cw = (slot + 1) * HEATMAP_WIDTH / SLOTS_PER_DAY - x0;
+      const int y0 = day * HEATMAP_CELL_H;
+
+      uint16_t *row = buf + (size_t) y0 * stride_px + x0;
+      for (int px = 0; px < cw; px++)
+        row[px] = color;
+      for (int py = 1; py < HEATMAP_CELL_H; py++)
+        std::memcpy(row + (size_t) py * stride_px, row, cw * sizeof(uint16_t));
+
+      if (x0 < x1) x1 = x0;
+      if (y0 < y1) y1 = y0;
+      if (x0 + cw - 1 > x2) x2 = x0 + cw - 1;
+      if (y0 + HEATMAP_CELL_H - 1 > y2) y2 = y0 + HEATMAP_CELL_H - 1;
+    }
+  }
+
+  heatmap_eco_ = eco_threshold;
+  heatmap_generation_ = matrix_generation_;
+  heatmap_valid_ = true;
+  clear_matrix_dirty();
+
+  if (x2 < 0) return false;  // nothing painted
+  if (area != nullptr) *area = HeatmapArea{x1, y1, x2, y2};
+  return true;
+}
+
+/**
+ * Profiler histograms (see LatencyHistogram in the header).
+ *
+ * Bucket layout: 0-3 us have one bucket each; above that, value
+ * 2^e * (1 + sub/4) with e = floor(log2(us)) lands in bucket 4 * (e - 1) + sub.
+ * Recording is a CLZ and two shifts, so it is cheap enough for every loop()
+ * call.
+ */
+uint8_t LatencyHistogram::bucket_of(uint32_t us) {
+  if (us < 4) return (uint8_t) us;
+  const int e = 31 - __builtin_clz(us);
+  const int b = 4 * (e - 1) + (int) ((us >> (e - 2)) & 3u);
+  return (uint8_t) (b >= BUCKETS ? BUCKETS - 1 : b);
+}
+
+uint32_t LatencyHistogram::bucket_floor_us(uint8_t bucket) {
+  if (bucket < 4) return bucket;
+  const int e = bucket / 4 + 1;
+  return (uint32_t) (4 + bucket % 4) << (e - 2);
+}
+
+void SlopeWindow::add(uint32_t now_ms, float value) {
+  if (n == 0) {
+    origin_ms = now_ms;
+    origin_y = value;
+    st = sy = stt = sty = syy = 0.0f;
+  }
+  const float ti = (now_ms - origin_ms) / 1000.0f;
+  const float yi = value - origin_y;
+  if (n == capacity) {  // Drop the oldest sample
+    const float to = t[head], yo = y[head];
+    st -= to; sy -= yo; stt -= to * to; sty -= to * yo; syy -= yo * yo;
+  } else {
+    n++;
+  }
+  last_ms = now_ms;
+  t[head] = ti;
+  y[head] = yi;
+  st += ti; sy += yi; stt += ti * ti; sty += ti * yi; syy += yi * yi;
+  head = (head + 1) % capacity;
+  if (++since_rebuild >= capacity) rebuild_();
+}
+
+// Move the origin to the oldest sample and recompute the sums exactly.
+void SlopeWindow::rebuild_() {
+  since_rebuild = 0;
+  const uint8_t oldest = (head + capacity - n) % capacity;
+  const float dt = t[oldest], dy = y[oldest];
+  origin_ms += (uint32_t) (dt * 1000.0f + 0.5f);
+  origin_y += dy;
+  st = sy = stt = sty = syy = 0.0f;
+  for (uint8_t k = 0; k < n; k++) {
+    const uint8_t i = (oldest + k) % capacity;
+    t[i] -= dt;
+    y[i] -= dy;
+    st += t[i]; sy += y[i]; stt += t[i] * t[i]; sty += t[i] * y[i]; syy += y[i] * y[i];
+  }
+}
+
+float SlopeWindow::span_s() const {
+  if (n < 2) return 0.0f;
+  const uint8_t oldest = (head + capacity - n) % capacity;
+  const uint8_t newest = (head + capacity - 1) % capacity;
+  return t[newest] - t[oldest];
+}
+
+float SlopeWindow::slope() const {
+  if (n < 3) return NAN;
+  const float sxx = stt - st * st / n;
+  if (sxx <= 0.0f) return NAN;
+  return (sty - st * sy / n) / sxx;
+}
+
+float SlopeWindow::t_stat(float noise_var) const {
+  if (n < 3) return 0.0f;
+  const float sxx = stt - st * st / n;
+  if (sxx <= 0.0f) return 0.0f;
+  const float sxy = sty - st * sy / n;
+  const float syy_c = syy - sy * sy / n;
+  const float b = sxy / sxx;
+  float var = (syy_c - b * sxy) / (n - 2);  // Residual variance
+  if (var < noise_var) var = noise_var;
+  return b / std::sqrt(var / sxx);
+}
+
+void LatencyHistogram::record(uint32_t us) {
+  uint16_t &c = count[bucket_of(us)];
+  if (c != UINT16_MAX) c++;
+  samples++;
+  if (us > max_us) max_us = us;
+}
+
+uint32_t LatencyHistogram::percentile_us(uint8_t pct) const {
+  if (samples == 0) return 0;
+  const uint32_t rank = (uint32_t) (((uint64_t) samples * pct + 99) / 100);  // 1-based, ceil
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < BUCKETS; b++) {
+    seen += count[b];
+    if (seen >= rank) {
+      const uint32_t lo = bucket_floor_us(b);
+      const uint32_t hi = (b + 1 < BUCKETS) ? bucket_floor_us(b + 1) : lo * 2;
+      const uint32_t mid = lo + (hi - lo) / 2;
+      return mid < max_us ? mid : max_us;
+    }
+  }
+  return max_us;  // only reachable if counts saturated
+}
+
+void HotWaterController::publish_profile_() {
+#ifdef HOTCIRC_PROFILER
+  static const char *const CHANNEL_NAMES[PROFILE_CHANNELS] = {"loop_gap", "pump_control", "check_schedule",
+                                                              "outlet_sample", "heatmap", "http"};
+  for (uint8_t ch = 0; ch < PROFILE_CHANNELS; ch++) {
+    LatencyHistogram &h = profile_[ch];
+    if (h.samples == 0) continue;  // keep the last published value
+    const float p50 = h.percentile_us(50) / 1000.0f;
+    const float p99 = h.percentile_us(99) / 1000.0f;
+    const float max = h.max_us / 1000.0f;
+    ESP_LOGD(TAG, "profile %-14s n=%u p50=%.2fms p99=%.2fms max=%.2fms", CHANNEL_NAMES[ch], h.samples, p50, p99,
+             max);
+    sensor::Sensor **s = profile_sensor_[ch];
+    if (s[(uint8_t) ProfileStat::P50]) s[(uint8_t) ProfileStat::P50]->publish_state(p50);
+    if (s[(uint8_t) ProfileStat::P99]) s[(uint8_t) ProfileStat::P99]->publish_state(p99);
+    if (s[(uint8_t) ProfileStat::MAX]) s[(uint8_t) ProfileStat::MAX]->publish_state(max);
+    h = LatencyHistogram{};
+  }
+#endif
+}
+
+/**
+ * Trace recorder.
+ *
+ * Download format (all little endian): a 24-byte header
+ *   uint32 magic "HCT1" (0x31544348), uint16 version (1), uint16 record size (8),
+ *   uint32 record count, uint32 capacity, uint32 t_ds at download,
+ *   uint32 epoch at download (0 = clock not valid)
+ * followed by `count` TraceRecords, oldest first. Wall time of a record is
+ * epoch - (header t_ds - record t_ds) / 10.
+ */
+int16_t HotWaterController::trace_temp_(float t) {
+  if (std::isnan(t)) return INT16_MIN;
+  float c = std::round(t * 100.0f);
+  if (c > 32767.0f) c = 32767.0f;
+  if (c < -32767.0f) c = -32767.0f;
+  return (int16_t) c;
+}
+
+void HotWaterController::trace_event_([[maybe_unused]] TraceEvent type, [[maybe_unused]] uint8_t arg,
+                                      [[maybe_unused]] int16_t value) {
+#ifdef HOTCIRC_TRACE
+  if (trace_ == nullptr) return;
+  // seq_cst pair with stream_trace(): either it sees this write in progress
+  // and waits, or this write sees the pause
+  trace_writing_.store(true);
+  if (trace_paused_.load()) {
+    if (trace_dropped_ != UINT16_MAX) trace_dropped_++;
+    trace_writing_.store(false, std::memory_order_release);
+    return;
+  }
+  const uint32_t t_ds = millis() / 100;
+  uint32_t head = trace_head_.load(std::memory_order_relaxed);
+  uint32_t count = trace_count_.load(std::memory_order_relaxed);
+  if (trace_dropped_ != 0) {
+    // First record after a download: mark the hole
+    trace_[head] = TraceRecord{t_ds, (uint8_t) TraceEvent::GAP, 0,
+                               (int16_t) (trace_dropped_ > 32767 ? 32767 : trace_dropped_)};
+    head = (head + 1) % trace_capacity_;
+    if (count < trace_capacity_) count++;
+    trace_dropped_ = 0;
+  }
+  trace_[head] = TraceRecord{t_ds, (uint8_t) type, arg, value};
+  head = (head + 1) % trace_capacity_;
+  if (count < trace_capacity_) count++;
+  trace_head_.store(head, std::memory_order_relaxed);
+  trace_count_.store(count, std::memory_order_relaxed);
+  trace_writing_.store(false, std::memory_order_release);
+#endif
+}
+
+/**
+ * Event log.
+ *
+ * The controller events that used to be log lines on the hot path go into a
+ * fixed ring of 8-byte records (same layout and type codes as the trace) and
+ * are only turned into text when somebody reads them. Writers are the main
+ * loop or the control task under the core lock; readers copy the ring
+ * lock-free against event_total_.
+ */
+void HotWaterController::record_event_(TraceEvent type, uint8_t arg, int16_t value) {
+  const uint32_t n = event_total_.load(std::memory_order_relaxed);
+  event_log_[n % EVENT_LOG_SIZE] = TraceRecord{millis() / 100, (uint8_t) type, arg, value};
+  event_total_.store(n + 1, std::memory_order_release);
+  trace_event_(type, arg, value);
+}
+
+void HotWaterController::format_event_(const TraceRecord &r, char *buf, size_t len) {
+  static const char *const SAVE_NAMES[] = {"snapshot", "journal", "energy totals", "calibration",
+                                           "schedule statistics", "runtime state"};
+  static const char *const MODE_NAMES[] = {"Vacation mode ON",   "Vacation mode OFF", "Pump enabled",
+                                           "Pump disabled",      "Learning enabled",  "Learning disabled",
+                                           "Disinfection cycle", "Clock holdover",    "Clock valid again",
+                                           "Clock lost",         "Learning matrix reset"};
+  const float temp = r.value / 100.0f;
+  switch ((TraceEvent) r.type) {
+    case TraceEvent::DRAW_START:
+      snprintf(buf, len, "Draw candidate, outlet %.2f°C", temp);
+      break;
+    case TraceEvent::DRAW_CONFIRMED:
+      snprintf(buf, len, "Draw confirmed, rise %.2f°C", temp);
+      break;
+    case TraceEvent::DRAW_RESET:
+      snprintf(buf, len, "%s", r.arg ? "Draw ended" : "Draw candidate dropped");
+      break;
+    case TraceEvent::PUMP_ON:
+      if (r.value == INT16_MIN)
+        snprintf(buf, len, "Pump ON (%s)", trigger_to_str_((PumpTrigger) r.arg));
+      else
+        snprintf(buf, len, "Pump ON (%s), return %.2f°C", trigger_to_str_((PumpTrigger) r.arg), temp);
+      break;
+    case TraceEvent::PUMP_OFF:
+      snprintf(buf, len, "Pump OFF (%s) after %d s", trigger_to_str_((PumpTrigger) r.arg), r.value);
+      break;
+    case TraceEvent::PUMP_STOP:
+      snprintf(buf, len, "  stop: %s, %d Wh", stop_reason_to_str_((StopReason) r.arg), r.value);
+      break;
+    case TraceEvent::DECAY:
+      snprintf(buf, len, "Learning matrix aged %d day(s)", r.value);
+      break;
+    case TraceEvent::SAVE:
+      snprintf(buf, len, "Saved %s%s", r.arg < sizeof(SAVE_NAMES) / sizeof(SAVE_NAMES[0]) ? SAVE_NAMES[r.arg] : "?",
+               r.value ? "" : " - FAILED");
+      break;
+    case TraceEvent::MODE:
+      snprintf(buf, len, "%s", r.arg < sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]) ? MODE_NAMES[r.arg] : "Mode ?");
+      break;
+    default:
+      snprintf(buf, len, "Event %u (arg %u, value %d)", r.type, r.arg, r.value);
+      break;
+  }
+}
+
+uint32_t HotWaterController::stream_event_log(const std::function<bool(const char *)> &line) {
+  // Copy the ring first: the sink may block (HTTP) while the controller keeps
+  // writing. `end` is taken before the copy, so every record below it was
+  // complete; records the writer reached during the copy (up to `total`,
+  // the last one possibly half written) overwrote the slots of
+  // `total - EVENT_LOG_SIZE` and older, which are dropped.
+  const uint32_t end = event_total_.load(std::memory_order_acquire);
+  std::vector<TraceRecord> copy(event_log_, event_log_ + EVENT_LOG_SIZE);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint32_t total = event_total_.load(std::memory_order_relaxed);
+  const uint32_t now_ds = millis() / 100;
+  uint32_t first = end > EVENT_LOG_SIZE ? end - EVENT_LOG_SIZE : 0;
+  if (total >= EVENT_LOG_SIZE && total - EVENT_LOG_SIZE + 1 > first) first = total - EVENT_LOG_SIZE + 1;
+
+  // Wall time from the clock as is (make_tick_() would run the holdover
+  // logic from this task); without one, the age of the record
+  time_t now_epoch = 0;
+  if (clock_ != nullptr) {
+    const ESPTime n = clock_->now();
+    if (n.is_valid()) now_epoch = n.timestamp;
+  }
+
+  char text[80];
+  char buf[112];
+  uint32_t sent = 0;
+  for (uint32_t i = first; i < end; i++) {
+    const TraceRecord &r = copy[i % EVENT_LOG_SIZE];
+    const uint32_t age_ds = now_ds - r.t_ds;
+    format_event_(r, text, sizeof(text));
+    if (now_epoch != 0) {
+      const ESPTime at = ESPTime::from_epoch_local(now_epoch - (time_t) (age_ds / 10));
+      snprintf(buf, sizeof(buf), "%02u:%02u:%02u %s", at.hour, at.minute, at.second, text);
+    } else {
+      snprintf(buf, sizeof(buf), "-%u.%us %s", age_ds / 10, age_ds % 10, text);
+    }
+    if (!line(buf)) break;
+    sent++;
+  }
+  return sent;
+}
+
+void HotWaterController::dump_event_log() {
+  ESP_LOGI(TAG, "%sEvent log (%u events recorded since boot):", log_prefix_.c_str(),
+           event_total_.load(std::memory_order_relaxed));
+  stream_event_log([this](const char *line) {
+    ESP_LOGI(TAG, "%s  %s", log_prefix_.c_str(), line);
+    return true;
+  });
+}
+
+#ifdef HOTCIRC_TRACE
+uint32_t HotWaterController::stream_trace(const std::function<bool(const uint8_t *, size_t)> &sink) {
+  if (trace_ == nullptr) return 0;
+  trace_paused_.store(true);
+  while (trace_writing_.load(std::memory_order_acquire)) delay(1);  // A write that missed the pause
+  const uint32_t count = trace_count_.load(std::memory_order_relaxed);
+  const uint32_t first = (trace_head_.load(std::memory_order_relaxed) + trace_capacity_ - count) % trace_capacity_;
+
+  // Wall time from the clock as is: make_tick_() runs the holdover logic and
+  // must stay on the controller's task
+  uint32_t epoch = 0;
+  if (clock_ != nullptr) {
+    const ESPTime n = clock_->now();
+    if (n.is_valid()) epoch = (uint32_t) n.timestamp;
+  }
+  const uint32_t header[6] = {0x31544348u, 1u | ((uint32_t) sizeof(TraceRecord) << 16), count, trace_capacity_,
+                              millis() / 100, epoch};
+  bool ok = sink((const uint8_t *) header, sizeof(header));
+
+  // Straight from the ring (at most two contiguous segments) in 4 KB pieces,
+  // so nothing has to buffer the whole PSRAM ring.
+  const uint32_t CHUNK = 512;  // records
+  uint32_t sent = 0;
+  while (ok && sent < count) {
+    const uint32_t idx = (first + sent) % trace_capacity_;
+    uint32_t n = count - sent;
+    if (n > trace_capacity_ - idx) n = trace_capacity_ - idx;  // up to the ring end
+    if (n > CHUNK) n = CHUNK;
+    ok = sink((const uint8_t *) &trace_[idx], n * sizeof(TraceRecord));
+    if (ok) sent += n;
+  }
+  trace_paused_.store(false, std::memory_order_release);
+
+  if (ok) {
+    ESP_LOGI(TAG, "Trace download: %u records sent", count);
+  } else {
+    ESP_LOGW(TAG, "Trace download aborted after %u of %u records", sent, count);
+  }
+  return sent;
+}
+#endif
+
 }  // namespace esphome_hotcirc
 }  // namespace esphome
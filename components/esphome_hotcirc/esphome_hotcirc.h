@@ -1,15 +1,261 @@
 #pragma once
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/preferences.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/switch/switch.h"
 #include "esphome/components/time/real_time_clock.h"
 #include "esphome/components/output/binary_output.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
+#include <atomic>
+#include <cstring>
+#include <functional>
+#ifdef HOTCIRC_CONTROL_TASK
+#include <mutex>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
 
 namespace esphome {
 namespace esphome_hotcirc {
 
+// Slot resolution of the learning matrix, fixed at compile time by the
+// `slots_per_day` option (48 = 30 min, 96 = 15 min, 144 = 10 min). Finer
+// slots let a short preheat lead start much closer to the actual draw.
+#ifndef HOTCIRC_SLOTS_PER_DAY
+#define HOTCIRC_SLOTS_PER_DAY 48
+#endif
+static constexpr int SLOTS_PER_DAY = HOTCIRC_SLOTS_PER_DAY;
+static constexpr int SLOT_MINUTES = 1440 / SLOTS_PER_DAY;
+static constexpr int SLOTS_PER_HALF_HOUR = SLOTS_PER_DAY / 48;
+static constexpr int MATRIX_CELLS = 7 * SLOTS_PER_DAY;
+static_assert(SLOTS_PER_DAY == 48 || SLOTS_PER_DAY == 96 || SLOTS_PER_DAY == 144,
+              "slots_per_day must be 48, 96 or 144");
+
+// Time of day -> matrix slot (0 .. SLOTS_PER_DAY - 1). The only place the
+// slot arithmetic lives; learn_now(), check_schedule() and
+// check_anti_stagnation_() used to carry their own `hr * 2 + (min >= 30)`.
+inline int time_to_slot(int hour, int minute) {
+  int slot = (hour * 60 + minute) / SLOT_MINUTES;
+  if (slot < 0) slot = 0;
+  if (slot > SLOTS_PER_DAY - 1) slot = SLOTS_PER_DAY - 1;
+  return slot;
+}
+
+// Time snapshot for one loop() pass or one sensor callback. clock_->now()
+// does a full localtime breakdown per call, and the subsystems used to call
+// it 10+ times per pass - results could even disagree across a minute or
+// slot boundary. Now it is read once (make_tick_()) and handed down.
+struct TickContext {
+  bool valid{false};        // false until SNTP/RTC has a valid time
+  bool estimated{false};    // Clock invalid: extrapolated from the last valid reading (holdover)
+  time_t epoch{0};
+  uint8_t wd{0};            // Weekday index 0=Mon ... 6=Sun (learn_ row)
+  uint8_t hour{0};
+  uint8_t minute{0};
+  uint8_t second{0};
+  uint16_t slot{0};         // time_to_slot(hour, minute)
+  uint16_t day_of_year{0};
+  int32_t day{0};           // Local day number (local date as days since 1970-01-01)
+};
+
+// Built-in profiler (`profiler:` in YAML, compiled in via HOTCIRC_PROFILER).
+// Channels are timed by the component itself, except HTTP, which the YAML
+// smart plug switch feeds via profile_record() from its request callback.
+enum class ProfileChannel : uint8_t {
+  LOOP_GAP,        // Time between two loop() calls (LVGL / WiFi / other components)
+  PUMP_CONTROL,    // pump_control() while the pump runs
+  CHECK_SCHEDULE,  // check_schedule()
+  OUTLET_SAMPLE,   // on_outlet_sample_() (draw detection callback)
+  HEATMAP,         // render_heatmap()
+  HTTP,            // Smart plug HTTP round trip
+};
+static constexpr uint8_t PROFILE_CHANNELS = 6;
+enum class ProfileStat : uint8_t { P50, P99, MAX };
+
+// Latency histogram, 1 us .. ~30 s: four sub-buckets per power of two, so a
+// reported percentile is within +-12.5 % of the true value. 16-bit counts
+// (saturating) are plenty for one publish window; 200 bytes per channel.
+struct LatencyHistogram {
+  static constexpr uint8_t BUCKETS = 96;
+  uint16_t count[BUCKETS];
+  uint32_t samples;
+  uint32_t max_us;
+
+  void record(uint32_t us);
+  uint32_t percentile_us(uint8_t pct) const;  // Bucket midpoint, capped at max_us
+  static uint8_t bucket_of(uint32_t us);
+  static uint32_t bucket_floor_us(uint8_t bucket);
+};
+
+// Water-draw detector (`draw_detector:` in YAML).
+//   CLASSIC: filtered outlet must rise for MINIMUM_DRAW_DURATION (15 s) and by
+//            temp_rise_threshold_ - conservative, the default.
+//   SLOPE:   least-squares line over the last N raw samples; confirms as soon
+//            as the slope is steep AND statistically significant (~5-8 s).
+enum class DrawDetector : uint8_t { CLASSIC, SLOPE };
+
+// Pump stop rule (`stop_mode:` in YAML).
+//   THRESHOLD:  stop once the (filtered, lagging) return reading reaches
+//               baseline + return_rise - 0.2 °C - the default.
+//   PREDICTIVE: additionally stop as soon as the reading projected
+//               return_sensor_lag seconds ahead along its current slope
+//               reaches that target, cutting the overshoot of the lag.
+enum class StopMode : uint8_t { THRESHOLD, PREDICTIVE };
+
+// Signal a fast secondary temperature input (`fast_temperature_sensor:`) is
+// fused with.
+//   RETURN: a probe in the return line (the Red board's pump NTC) - the
+//           pump stop threshold uses the fused value while the pump runs.
+//   OUTLET: a probe at the outlet - the draw detector runs on the fused value.
+enum class FuseTarget : uint8_t { OUTLET, RETURN };
+
+// Sliding least-squares fit y = a + b*t over the last `capacity` samples.
+// add() is O(1) (running sums); times and values are stored relative to an
+// origin that moves with the window, and the sums are rebuilt from the
+// buffer once per window turn so float round-off cannot accumulate.
+struct SlopeWindow {
+  static constexpr uint8_t MAX_SAMPLES = 32;
+  float t[MAX_SAMPLES];  // s since origin_ms
+  float y[MAX_SAMPLES];  // value - origin_y
+  uint8_t capacity{6};
+  uint8_t head{0};       // Next write index
+  uint8_t n{0};
+  uint8_t since_rebuild{0};
+  uint32_t origin_ms{0};
+  uint32_t last_ms{0};   // millis() of the newest sample
+  float origin_y{0.0f};
+  float st{0}, sy{0}, stt{0}, sty{0}, syy{0};
+
+  void reset() { n = 0; head = 0; since_rebuild = 0; }
+  void add(uint32_t now_ms, float value);
+  bool full() const { return n == capacity; }
+  float span_s() const;                        // Newest minus oldest sample time
+  float slope() const;                          // °C/s, NAN below 3 samples
+  float t_stat(float noise_var) const;          // slope / standard error
+ protected:
+  void rebuild_();
+};
+
+// Trace recorder (`trace:` in YAML, compiled in via HOTCIRC_TRACE): a ring
+// of fixed-point records of every outlet/return sample and controller event,
+// for tuning the draw detector against real captures instead of DEBUG logs.
+enum class TraceEvent : uint8_t {
+  OUTLET = 1,      // value: outlet temperature, 0.01 °C (INT16_MIN = NaN)
+  RETURN = 2,      // value: return temperature, 0.01 °C
+  PUMP_ON = 3,     // arg: PumpTrigger, value: baseline return 0.01 °C
+  PUMP_OFF = 4,    // arg: PumpTrigger that ran, value: run time (s)
+  DRAW_START = 5,  // value: outlet temperature at start of the rise
+  DRAW_CONFIRMED = 6,  // value: total rise, 0.01 °C
+  DRAW_RESET = 7,  // arg: 1 = confirmed draw ended, 0 = candidate dropped
+  GAP = 8,         // value: records dropped while a download paused the ring
+  DECAY = 9,       // value: days the learning matrix aged
+  SAVE = 10,       // arg: SaveTarget, value: 1 = written, 0 = failed
+  MODE = 11,       // arg: ModeChange
+  PUMP_STOP = 12,  // arg: StopReason, value: heat of the run (Wh), follows PUMP_OFF
+};
+// Why stop_pump() ended a run (PUMP_STOP arg, stop_reason_to_str_())
+enum class StopReason : uint8_t {
+  MANUAL_BUTTON,
+  MANUAL_WEBUI,
+  PUMP_DISABLED,
+  SAFETY_TIMEOUT,
+  ANTI_STAGNATION_DONE,
+  THERMAL_STAGNATION_DONE,
+  CALIBRATION_DONE,
+  TARGET,
+  TARGET_FUSED,            // On the fused (fast) return value
+  TARGET_PREDICTED,        // StopMode::PREDICTIVE
+  ARRIVED_PULSED,          // Return slope during a pulsed run
+};
+// Flash record written (SAVE arg)
+enum class SaveTarget : uint8_t { SNAPSHOT, JOURNAL, ENERGY, CALIBRATION, SCHEDULE_STATS, RUNTIME };
+// Mode transitions (MODE arg)
+enum class ModeChange : uint8_t {
+  VACATION_ON,
+  VACATION_OFF,
+  PUMP_ENABLED,
+  PUMP_DISABLED,
+  LEARNING_ON,
+  LEARNING_OFF,
+  DISINFECTION,            // Boiler disinfection detected, run until MAX_RUN_TIME
+  CLOCK_HOLDOVER,          // Clock invalid, running on the estimate
+  CLOCK_VALID,             // Valid again after a holdover
+  CLOCK_LOST,              // Holdover expired
+  MATRIX_RESET,
+};
+// 8 bytes, little endian on the wire (see README "Trace recorder").
+struct TraceRecord {
+  uint32_t t_ds;   // millis() / 100
+  uint8_t type;    // TraceEvent
+  uint8_t arg;
+  int16_t value;
+};
+static_assert(sizeof(TraceRecord) == 8, "TraceRecord must stay 8 bytes");
+
+// Optional 4-bit quantized flash snapshot (`compact_storage: true`): two
+// slots per byte, value stored as round(v / 17) and restored as q * 17, so
+// a 7x96 matrix needs the same 336 bytes as the plain 7x48 one. RAM keeps
+// full 8-bit precision; only a reboot rounds each cell by up to +-8.
+#ifdef HOTCIRC_MATRIX_PACK4
+static constexpr uint8_t MATRIX_PACKING = 1;
+#else
+static constexpr uint8_t MATRIX_PACKING = 0;
+#endif
+static constexpr int MATRIX_ROW_BYTES = MATRIX_PACKING ? SLOTS_PER_DAY / 2 : SLOTS_PER_DAY;
+
+// RAM learning matrix: 7 rows of SLOTS_PER_DAY cells in 32-bit words, cell
+// 4 * i + k in byte k of word i (little endian). Whole-row and whole-matrix
+// operations run word-wise, four cells per operation (SWAR), instead of
+// per-cell loops; learn_[d][s] still indexes a single cell.
+class LearnMatrix {
+ public:
+  static constexpr int ROW_WORDS = SLOTS_PER_DAY / 4;
+  static constexpr int WORDS = 7 * ROW_WORDS;
+  static constexpr size_t BYTES = WORDS * sizeof(uint32_t);
+
+  uint8_t *operator[](int day) { return bytes_() + day * SLOTS_PER_DAY; }
+  const uint8_t *operator[](int day) const { return bytes_() + day * SLOTS_PER_DAY; }
+  uint32_t *row_words(int day) { return &w_[day * ROW_WORDS]; }
+  const uint32_t *row_words(int day) const { return &w_[day * ROW_WORDS]; }
+
+  void clear() { std::memset(w_, 0, BYTES); }
+  void copy_from(const uint8_t *src) { std::memcpy(w_, src, BYTES); }
+  void copy_to(uint8_t *dst) const { std::memcpy(dst, w_, BYTES); }
+  bool operator==(const LearnMatrix &o) const { return std::memcmp(w_, o.w_, BYTES) == 0; }
+
+  void scale_row(int day, uint32_t f_q8);    // v = floor(v * f / 256), f <= 256
+  void add_saturating(const LearnMatrix &o); // v = min(255, v + o.v)
+  uint32_t crc32() const { return crc32(w_, BYTES); }
+
+  // floor(v * f / 256) for the four cells of x: even and odd bytes in two
+  // 16-bit-lane multiplies (v * f <= 255 * 256 fits a lane).
+  static uint32_t scale_word(uint32_t x, uint32_t f_q8) {
+    const uint32_t even = (((x & 0x00FF00FFu) * f_q8) >> 8) & 0x00FF00FFu;
+    const uint32_t odd = (((x >> 8) & 0x00FF00FFu) * f_q8) & 0xFF00FF00u;
+    return even | odd;
+  }
+  // Per-byte min(255, a + b): add the low 7 bits, rebuild bit 7, then set
+  // every byte that carried out to 0xFF.
+  static uint32_t add_sat_word(uint32_t a, uint32_t b) {
+    const uint32_t low = (a & 0x7F7F7F7Fu) + (b & 0x7F7F7F7Fu);
+    const uint32_t sum = low ^ ((a ^ b) & 0x80808080u);
+    const uint32_t carry = ((a & b) | ((a ^ b) & low)) & 0x80808080u;
+    return sum | ((carry >> 7) * 0xFFu);
+  }
+  // CRC-32 (reflected, 0xEDB88320); the ESP32 ROM routine on the device.
+  static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+ protected:
+  uint8_t *bytes_() { return reinterpret_cast<uint8_t *>(w_); }
+  const uint8_t *bytes_() const { return reinterpret_cast<const uint8_t *>(w_); }
+  uint32_t w_[WORDS]{};
+};
+static_assert(SLOTS_PER_DAY % 4 == 0, "LearnMatrix rows must be whole words");
+static_assert(LearnMatrix::BYTES == MATRIX_CELLS, "LearnMatrix must not pad");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "LearnMatrix cell order assumes little endian");
+
 // Structure for storing learning matrix in flash.
 // FIX #11: magic + version field added. Detecting an old 24-slot layout via a
 // plain additive checksum was unreliable (sums can collide); an explicit magic
@@ -19,15 +265,206 @@ namespace esphome_hotcirc {
 struct LearnMatrixData {
   uint32_t magic;        // Must equal MATRIX_MAGIC
   uint8_t version;       // Layout version, currently MATRIX_VERSION
-  uint8_t reserved[3];   // Padding/alignment, keep zeroed
-  uint8_t learn[7][48];  // 48 half-hourly slots
-  uint32_t checksum;     // Additive checksum over learn[][]
+  uint8_t journal_epoch; // Snapshot epoch; a LearnJournalData only applies on top
+                         // of the snapshot with the same epoch (was reserved[0],
+                         // so older snapshots load as epoch 0 unchanged)
+  uint8_t slots_per_day; // Layout of learn[][] (was reserved[1]; 0 in version 2)
+  uint8_t packing;       // 0 = one byte per slot, 1 = 4-bit quantized (was reserved[2])
+  uint8_t learn[7][MATRIX_ROW_BYTES];  // SLOTS_PER_DAY slots per day, see MATRIX_PACKING
+  uint32_t checksum;     // CRC-32 over the stored learn[][] bytes (an additive
+                         // sum in older snapshots, still accepted on load)
+};
+
+// Write-coalescing delta journal for learning events. Each confirmed draw
+// appends one (cell, increment) record here instead of rewriting the full
+// 348-byte LearnMatrixData blob; load_learning_matrix_() replays the journal
+// on top of the snapshot with the same epoch. The journal is compacted into a
+// new snapshot (epoch + 1, journal emptied) when it is full and whenever a
+// full save happens anyway (reset, manual save). NVS itself is
+// log-structured, so the small journal rewrites are wear-leveled across its
+// pages.
+static constexpr uint8_t JOURNAL_CAPACITY = 32;
+struct LearnJournalData {
+  uint32_t magic;                       // Must equal JOURNAL_MAGIC
+  uint8_t epoch;                        // Snapshot epoch these deltas apply to
+  uint8_t count;                        // Valid entries in cell[]/inc[]
+  uint16_t decay_day;                   // Local day number the snapshot is decayed to
+                                        // (was reserved[2]; 0 = unknown)
+  uint16_t cell[JOURNAL_CAPACITY];      // day * SLOTS_PER_DAY + slot
+  uint8_t inc[JOURNAL_CAPACITY];        // Increment, rescaled to the snapshot's decay_day
+  uint32_t checksum;                    // CRC-32 over header + entries (older: weighted sum)
+};
+
+// Loop calibration result (start_calibration()), stored next to the
+// learning matrix under its own key. Times are as seen by the return sensor,
+// counted from pump start.
+struct CalibrationData {
+  uint32_t magic;                       // Must equal CALIBRATION_MAGIC
+  uint8_t version;
+  uint8_t reserved[3];                  // Keep zeroed
+  uint32_t epoch;                       // When measured (0 = clock was invalid)
+  float dead_time_s;                    // Until the first return rise: loop transit time
+  float rise_tau_s;                     // Dead time -> 63 % of the total rise
+  float heatup_s;                       // Until baseline + return_rise (the normal stop target)
+  float total_rise;                     // Return rise at the plateau (°C)
+  float flow_lpm;                       // loop_volume / transit time, NAN without loop_volume
+  uint32_t checksum;                    // prefs_checksum_() over the fields above
+};
+
+// Cumulative energy / runtime counters (`energy:` in YAML), one value per
+// PumpTrigger for each period. DAILY restarts at local midnight, WEEKLY on
+// Monday 00:00; HA's total_increasing state class treats both resets as a
+// new meter cycle.
+enum class EnergyPeriod : uint8_t { DAILY, WEEKLY, LIFETIME };
+static constexpr uint8_t ENERGY_PERIODS = 3;
+enum class EnergyStat : uint8_t { ENERGY, RUNTIME };
+static constexpr uint8_t ENERGY_TRIGGERS = 9;  // HotWaterController::PumpTrigger values
+
+struct EnergyTotalsData {
+  uint32_t magic;                       // Must equal ENERGY_MAGIC
+  uint8_t version;
+  uint8_t reserved[3];                  // Keep zeroed
+  int32_t day;                          // Local day number of the DAILY row (-1 = none yet)
+  int32_t week;                         // Local day number of that week's Monday (-1 = none yet)
+  float wh[ENERGY_PERIODS][ENERGY_TRIGGERS];           // Heat delivered into the loop (Wh)
+  uint32_t runtime_s[ENERGY_PERIODS][ENERGY_TRIGGERS]; // Pump runtime (s)
+  uint32_t checksum;                    // prefs_checksum_() over the fields above
+};
+
+// Outcome of SCHEDULED runs (`schedule_stats:` in YAML): a run is a hit when
+// a draw is confirmed within hit_window of its start, else a miss and its
+// energy counts as wasted. Per-cell counts halve together when one
+// saturates, so the ratio follows the recent weeks.
+struct ScheduleStatsData {
+  uint32_t magic;                       // Must equal SCHEDULE_STATS_MAGIC
+  uint8_t version;
+  uint8_t slots_per_day;                // Layout the cell counts belong to
+  int8_t eco_bias;                      // Auto-tuner offset on SCHEDULE_THRESHOLD
+  uint8_t reserved;                     // Keep zeroed
+  float wasted_wh;                      // Lifetime energy of missed runs (Wh)
+  float hit_rate;                       // EWMA of recent outcomes (0..1), NAN = none
+  uint8_t hits[MATRIX_CELLS];           // [d * SLOTS_PER_DAY + s]
+  uint8_t misses[MATRIX_CELLS];
+  uint32_t checksum;                    // prefs_checksum_() over the fields above
+};
+
+// Warm-start record: the runtime state that otherwise takes hours to
+// rebuild after a reboot or OTA (disinfection baseline, vacation tracking,
+// lockout references, preheat lead, enable flags). Epochs are local-clock
+// seconds, 0 = never.
+struct RuntimeStateData {
+  uint32_t magic;                       // Must equal RUNTIME_STATE_MAGIC
+  uint8_t version;
+  uint8_t flags;                        // RUNTIME_* bits below
+  uint8_t reserved[2];                  // Keep zeroed
+  float baseline_outlet;                // NAN = not captured yet
+  float learned_lead_s;                 // NAN = nothing learned yet
+  uint32_t last_water_draw;
+  uint32_t last_run;
+  uint32_t last_anti_stagnation_run;
+  uint32_t last_disinfection_start;
+  uint32_t last_thermal_stagnation_run;
+  uint32_t checksum;                    // prefs_checksum_() over the fields above
+};
+static constexpr uint8_t RUNTIME_VACATION = 1 << 0;
+static constexpr uint8_t RUNTIME_LEARNING_ENABLED = 1 << 1;
+static constexpr uint8_t RUNTIME_PUMP_ENABLED = 1 << 2;
+
+// Display state (get_ui_status()): everything the GUI page shows from the
+// controller, quantized to what it renders. version moves only when a field
+// changes, so a repaint interval can skip all LVGL work while it stands.
+struct UiStatus {
+  uint32_t version;                     // 0 = never taken
+  int16_t outlet_dc;                    // 0.1 °C, UI_NO_TEMP = no reading
+  int16_t return_dc;
+  uint8_t trigger;                      // HotWaterController::PumpTrigger, NONE while stopped
+  uint8_t eco_threshold;                // SCHEDULE_THRESHOLD (ECO level)
+  uint8_t flags;                        // UI_* bits
+  uint8_t reserved;
+};
+static constexpr int16_t UI_NO_TEMP = INT16_MIN;
+static constexpr uint8_t UI_PUMP_RUNNING = 1 << 0;
+static constexpr uint8_t UI_DRAW_PENDING = 1 << 1;
+static constexpr uint8_t UI_VACATION = 1 << 2;
+static constexpr uint8_t UI_LEARNING_ENABLED = 1 << 3;
+static constexpr uint8_t UI_PUMP_ENABLED = 1 << 4;
+
+class HotWaterController;
+class SmartPlugSwitch;
+
+#ifdef HOTCIRC_CONTROL_TASK
+// Lock-free ring between exactly one producer task and one consumer task
+// (sensor callbacks on the main task -> control task). Holds N - 1 entries;
+// push() fails instead of overwriting when the consumer falls behind.
+template<typename T, uint8_t N> class SpscQueue {
+ public:
+  bool push(const T &v) {
+    const uint8_t head = head_.load(std::memory_order_relaxed);
+    const uint8_t next = (uint8_t) ((head + 1) % N);
+    if (next == tail_.load(std::memory_order_acquire)) return false;
+    buf_[head] = v;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+  bool pop(T &v) {
+    const uint8_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    v = buf_[tail];
+    tail_.store((uint8_t) ((tail + 1) % N), std::memory_order_release);
+    return true;
+  }
+
+ protected:
+  T buf_[N]{};
+  std::atomic<uint8_t> head_{0};
+  std::atomic<uint8_t> tail_{0};
+};
+#endif
+
+// Start arbitration between several controllers on one node - one
+// HotWaterController per riser, all fed from the same tank top (multi-
+// circuit mode, MULTI_CONF). Each controller keeps its own sensors, pump,
+// matrices and timers; this only spaces automatic pump starts of different
+// circuits at least `start_stagger` apart, so a shared schedule slot, the
+// Sunday anti-stagnation window or a boiler disinfection does not make all
+// loops pull hot water at the same moment. Demand starts (button, Web UI,
+// water draw, calibration) are never delayed but count as a start for the
+// others. One instance per node, shared by all controllers; with a single
+// circuit it never defers anything.
+class CircuitCoordinator {
+ public:
+  void add_circuit(HotWaterController *circuit) { circuits_.push_back(circuit); }
+  const std::vector<HotWaterController *> &get_circuits() const { return circuits_; }
+
+  // Milliseconds `circuit` has to wait until stagger_ms have passed since
+  // another circuit's last start; 0 = start now, the start is recorded.
+  // demand: start regardless (and record it).
+  uint32_t claim_start(HotWaterController *circuit, uint32_t now_ms, uint32_t stagger_ms, bool demand);
+
+ protected:
+  std::vector<HotWaterController *> circuits_;
+  HotWaterController *last_start_circuit_{nullptr};
+  uint32_t last_start_ms_{0};
+#ifdef HOTCIRC_CONTROL_TASK
+  std::mutex lock_;  // Circuits may start from their control tasks
+#endif
 };
 
 class HotWaterController : public Component {
  public:
   static constexpr uint32_t MATRIX_MAGIC = 0x48435231;  // "HCR1"
-  static constexpr uint8_t MATRIX_VERSION = 2;          // 2 = 48-slot layout
+  // 2 = plain 48-slot layout (kept so existing snapshots survive this
+  // update), 3 = any other layout, described by slots_per_day/packing.
+  static constexpr uint8_t MATRIX_VERSION = (SLOTS_PER_DAY == 48 && MATRIX_PACKING == 0) ? 2 : 3;
+  static constexpr uint32_t JOURNAL_MAGIC = 0x484A4E31; // "HJN1"
+  static constexpr uint32_t CALIBRATION_MAGIC = 0x48434C31;  // "HCL1"
+  static constexpr uint8_t CALIBRATION_VERSION = 1;
+  static constexpr uint32_t ENERGY_MAGIC = 0x48434531;  // "HCE1"
+  static constexpr uint8_t ENERGY_VERSION = 1;
+  static constexpr uint32_t SCHEDULE_STATS_MAGIC = 0x48435331;  // "HCS1"
+  static constexpr uint8_t SCHEDULE_STATS_VERSION = 1;
+  static constexpr uint32_t RUNTIME_STATE_MAGIC = 0x48525331;  // "HRS1"
+  static constexpr uint8_t RUNTIME_STATE_VERSION = 1;
 
   // Pump trigger types - defines what caused the pump to start
   enum class PumpTrigger {
@@ -38,8 +475,10 @@ class HotWaterController : public Component {
     SCHEDULED,         // Started by learning/schedule
     DISINFECTION,      // Started by disinfection cycle detection
     ANTI_STAGNATION,   // Started by anti-stagnation (prevents pump seizure)
-    THERMAL_STAGNATION // Started because return temp >= outlet temp (summer heat soak)
+    THERMAL_STAGNATION, // Started because return temp >= outlet temp (summer heat soak)
+    CALIBRATION        // Commissioning run from a cold loop (start_calibration())
   };
+  static_assert((uint8_t) PumpTrigger::CALIBRATION + 1 == ENERGY_TRIGGERS, "EnergyTotalsData rows per PumpTrigger");
 
   // Sensors & actuators
   sensor::Sensor *outlet_{nullptr};
@@ -59,6 +498,28 @@ class HotWaterController : public Component {
   void set_led_yellow(output::BinaryOutput *led) { led_yellow_ = led; }
   void set_button(binary_sensor::BinarySensor *btn) { button_ = btn; }
 
+  // Multi-circuit mode: `circuit` names this loop in the logs, the flash
+  // preference keys ("hwc_learn_<circuit>", ...) and the trace URL. Empty
+  // (the default, single circuit) keeps the original keys, so existing
+  // snapshots survive. stagger_ms: see CircuitCoordinator.
+  void set_circuit(const std::string &circuit) {
+    this->circuit_ = circuit;
+    this->log_prefix_ = circuit.empty() ? "" : "[" + circuit + "] ";
+  }
+  const std::string &get_circuit() const { return circuit_; }
+  void set_coordinator(CircuitCoordinator *coordinator, uint32_t stagger_ms) {
+    this->coordinator_ = coordinator;
+    this->start_stagger_ms_ = stagger_ms;
+  }
+  // Automatic start waiting for the stagger (NONE = none pending)
+  PumpTrigger get_deferred_trigger() const { return deferred_trigger_; }
+
+  // Clock holdover: when the time source turns invalid after it was valid,
+  // keep scheduling and learning on the last valid time + millis() for up to
+  // `seconds` (crystal drift ~40 ppm, i.e. ~3.5 s per day); 0 = off.
+  void set_clock_holdover(uint32_t seconds) { this->clock_holdover_s_ = seconds; }
+  bool is_clock_estimated() const { return clock_estimated_; }
+
   void set_thresholds(float outlet_rise_deg, float return_rise_deg, float disinfection_temp_rise, float min_return_temp) {
     this->temp_rise_threshold_ = outlet_rise_deg;
     this->return_rise_threshold_ = return_rise_deg;
@@ -66,6 +527,88 @@ class HotWaterController : public Component {
     this->min_return_temp_ = min_return_temp;
   }
 
+  // min_rate: steepest-accepted rise (°C/s); min_t: slope t-statistic needed
+  // to confirm (CLASSIC ignores both; window is in samples, ~1 s each).
+  void set_draw_detector(DrawDetector mode, uint8_t window, float min_rate, float min_t) {
+    this->draw_detector_ = mode;
+    this->draw_slope_.capacity = window < 4 ? 4 : (window > SlopeWindow::MAX_SAMPLES ? SlopeWindow::MAX_SAMPLES : window);
+    this->draw_slope_min_rate_ = min_rate;
+    this->draw_slope_min_t_ = min_t;
+  }
+
+  // lag_s: delay between the water and the published return value
+  // (DS18B20 thermal contact + conversion + moving-average filter).
+  // lag_s < 0: use the measured rise time constant once calibrated.
+  void set_stop_mode(StopMode mode, float lag_s) {
+    this->stop_mode_ = mode;
+    this->return_lag_auto_ = lag_s < 0.0f;
+    if (lag_s >= 0.0f)
+      this->return_lag_s_ = lag_s;
+  }
+
+  // Pulsed circulation (`pulsed_circulation:`) for SCHEDULED and WATER_DRAW
+  // runs: bursts sized from the calibrated loop transit time with soak
+  // pauses, stopped once the return slope shows the hot water arrived (see
+  // pulse_control_()).
+  void set_pulsed_circulation(uint32_t soak_ms, float arrival_rate) {
+    this->pulse_enabled_ = true;
+    this->pulse_soak_ms_ = soak_ms;
+    this->pulse_arrival_rate_ = arrival_rate;
+  }
+  bool is_pulsed_run() const { return pulse_active_; }
+  bool is_pulse_soaking() const { return pulse_soaking_; }  // Pump paused inside a pulsed run
+
+  // Control task (`control_task:`, ESP-IDF): run draw detection, the pump
+  // state machine (runtime limits, target, pulses) and energy integration on
+  // a FreeRTOS task pinned to `core`, so a stalled main loop (LVGL, WiFi)
+  // cannot delay a pump stop. Sensor callbacks only queue their readings;
+  // switch writes, LEDs, sensor publishes, flash writes and learning go back to
+  // loop() (see defer_to_main_()). plug: the pump is a SmartPlugSwitch,
+  // whose worker then gets pump commands straight from the control task.
+  void set_control_task([[maybe_unused]] uint8_t core, [[maybe_unused]] uint8_t priority,
+                        [[maybe_unused]] SmartPlugSwitch *plug) {
+#ifdef HOTCIRC_CONTROL_TASK
+    this->control_enabled_ = true;
+    this->control_core_ = core;
+    this->control_priority_ = priority;
+    this->pump_plug_ = plug;
+#endif
+  }
+
+  // Circulation loop volume (litres, pipe interior). With it, calibration
+  // derives the flow rate from the transit time; 0 = keep pump_flow_rate.
+  void set_loop_volume(float liters) { this->loop_volume_l_ = liters; }
+
+  // Learning journal flush (`journal_sync:`). true: every append is followed
+  // by global_preferences->sync(), which flushes all pending preferences, not
+  // only the journal. false: the append waits for flash_write_interval.
+  void set_journal_sync(bool sync) { this->journal_sync_ = sync; }
+
+  // Adaptive sampling (`adaptive_sampling:`): poll the outlet / return sensor
+  // components every idle_ms while nothing happens, and every active_ms
+  // while a draw is pending or confirmed, the pump runs, for hold_ms after
+  // that and after any outlet rise. Either poller may be null (not polled).
+  void set_adaptive_sampling(PollingComponent *outlet, PollingComponent *ret, uint32_t idle_ms, uint32_t active_ms,
+                             uint32_t hold_ms) {
+    this->sample_outlet_poller_ = outlet;
+    this->sample_return_poller_ = ret;
+    this->sample_idle_ms_ = idle_ms;
+    this->sample_active_ms_ = active_ms;
+    this->sample_hold_ms_ = hold_ms;
+  }
+  bool is_sampling_fast() const { return sample_fast_; }
+
+  // Fast secondary temperature input: fused with the outlet or return sensor
+  // by a complementary filter (see on_fast_sample_()). tau_s is the time
+  // constant the fast sensor's offset is corrected with.
+  void set_fast_sensor(sensor::Sensor *s, FuseTarget target, float tau_s) {
+    this->fast_ = s;
+    this->fuse_target_ = target;
+    this->fuse_tau_s_ = tau_s;
+  }
+  // Fused temperature, NAN until the fast sensor's offset has been learned
+  float get_fused_temperature() const;
+
   void set_pump_flow_rate(float flow_rate_lpm) {
     this->pump_flow_rate_ = flow_rate_lpm;
   }
@@ -98,6 +641,16 @@ class HotWaterController : public Component {
     this->thermal_stagnation_min_return_ = min_return_deg;
   }
 
+  // Lookahead preheat: check_schedule() evaluates the slot that starts
+  // `minutes` from now, so the loop is already hot when the slot begins.
+  // With auto_learn the lead follows the measured heat-up time of recent
+  // SCHEDULED runs (EWMA of last_cycle_duration_), never below `minutes`.
+  void set_preheat_lead(uint32_t minutes, bool auto_learn) {
+    this->preheat_lead_s_ = minutes * 60;
+    this->preheat_lead_auto_ = auto_learn;
+  }
+  uint32_t get_preheat_lead_seconds() const;
+
   float get_last_cycle_energy() const {
     return last_cycle_energy_;
   }
@@ -106,10 +659,41 @@ class HotWaterController : public Component {
     return last_cycle_duration_;
   }
 
+  // Energy / runtime totals (see EnergyTotalsData); `trigger` -1 = all.
+  void set_energy_sensor(EnergyPeriod period, EnergyStat stat, int8_t trigger, sensor::Sensor *s) {
+    this->energy_sensors_.push_back({period, stat, trigger, s});
+  }
+  float get_energy_kwh(EnergyPeriod period, int8_t trigger = -1) const;
+  uint32_t get_runtime_s(EnergyPeriod period, int8_t trigger = -1) const;
+
+  // Scheduled-run analytics (see ScheduleStatsData). The auto-tuner moves
+  // the effective threshold (SCHEDULE_THRESHOLD + a learned bias) by `step`
+  // whenever the recent hit rate leaves target +-10 %, within
+  // [min_threshold, max_threshold]. The ECO slider keeps setting the base.
+  void set_schedule_hit_window(uint32_t seconds) { this->sched_hit_window_s_ = seconds; }
+  void set_schedule_auto_tune(float target, uint8_t step, uint8_t min_threshold, uint8_t max_threshold) {
+    this->sched_tune_ = true;
+    this->sched_tune_target_ = target;
+    this->sched_tune_step_ = step;
+    this->sched_tune_min_ = min_threshold;
+    this->sched_tune_max_ = max_threshold;
+  }
+  void set_schedule_hit_rate_sensor(sensor::Sensor *s) { this->sched_hit_rate_sensor_ = s; }
+  void set_schedule_wasted_energy_sensor(sensor::Sensor *s) { this->sched_wasted_sensor_ = s; }
+  void set_schedule_threshold_sensor(sensor::Sensor *s) { this->sched_threshold_sensor_ = s; }
+  uint8_t get_schedule_threshold() const;  // Effective threshold (base + tuner bias)
+  float get_schedule_hit_rate() const;     // Hits / outcomes over all cells, NAN = none yet
+  float get_schedule_slot_hit_rate(int wd, int slot) const;
+  float get_schedule_wasted_kwh() const { return sched_stats_.wasted_wh / 1000.0f; }
+
   bool is_vacation_mode() const {
     return vacation_mode_;
   }
 
+  // Current display state; re-taken on every call, the version only moves
+  // when the snapshot differs from the previous one
+  const UiStatus &get_ui_status();
+
   PumpTrigger get_pump_trigger() const {
     return pump_trigger_;
   }
@@ -120,6 +704,94 @@ class HotWaterController : public Component {
   const char *get_pump_trigger_str() const { return trigger_to_str_(pump_trigger_); }
   static const char *trigger_to_str_(PumpTrigger t);
 
+  // Learning-matrix change tracking. Every mutation of learn_[][] (learn_now(),
+  // advance_decay_day_(), init_default_pattern_(), load_learning_matrix_()) bumps the
+  // generation counter, ORs the touched slots into a 1-bit-per-cell dirty mask and
+  // fires the change callbacks, so consumers no longer poll and diff learn_.
+  uint32_t get_matrix_generation() const { return matrix_generation_; }
+  bool is_slot_dirty(int day, int slot) const {
+    const int i = day * SLOTS_PER_DAY + slot;
+    return (matrix_dirty_[i >> 5] >> (i & 31)) & 1u;
+  }
+  void clear_matrix_dirty();
+  // Callback argument is the new generation. Runs synchronously in the
+  // mutating call path (possibly the outlet sensor callback) - keep it short.
+  void add_on_matrix_change_callback(std::function<void(uint32_t)> &&callback) {
+    this->matrix_change_callback_.add(std::move(callback));
+  }
+
+  // Learning-matrix export for the "Learning Matrix JSON" text sensor and the
+  // HA heatmap page. Writes into a caller-supplied buffer without any heap
+  // use and returns the length written (NUL-terminated, NUL not counted), or
+  // 0 if the buffer is too small.
+  //   JSON:    {"eco_level":120,"days":[{"name":"Mon","values":[0,...]},...]}
+  //   COMPACT: {"eco_level":120,"slots":48,"matrix":"<base64, 7 * slots bytes>"}
+  //            matrix bytes are row-major, index = day * slots + slot (0=Mon).
+  enum class MatrixExportFormat : uint8_t { JSON, COMPACT };
+  // Worst case: 27-char envelope, per day 27 chars + 4 per "255," value.
+  static constexpr size_t MATRIX_JSON_BUF_SIZE = 40 + 7 * (27 + 4 * SLOTS_PER_DAY);  // 1621 at 48 slots
+  static constexpr size_t MATRIX_COMPACT_BUF_SIZE = 64 + MATRIX_CELLS / 3 * 4;       // 512 at 48 slots
+  size_t export_learning_matrix(char *buf, size_t len, MatrixExportFormat format = MatrixExportFormat::JSON) const;
+
+  // Heatmap renderer for the GUI package's 336x280 RGB565 canvas
+  // (7 day rows x SLOTS_PER_DAY columns; at 48 slots one 7x40 px cell per
+  // slot, finer layouts use 3/4 or 2/3 px columns so the canvas width stays
+  // 336 px). Writes whole cell rows straight into the canvas buffer instead
+  // of ~94000 lv_canvas_set_px() calls and only touches cells whose colour
+  // changed since the previous call (dirty slot or ECO-threshold crossing).
+  static constexpr uint16_t HEATMAP_CELL_W = 7;
+  static constexpr uint16_t HEATMAP_CELL_H = 40;
+  static constexpr uint16_t HEATMAP_WIDTH = 48 * HEATMAP_CELL_W;  // 336 px, independent of SLOTS_PER_DAY
+  static constexpr uint16_t HEATMAP_HEIGHT = 7 * HEATMAP_CELL_H;  // 280 px
+
+  // Bounding box of the pixels written by render_heatmap(), canvas-relative
+  // and inclusive, so the caller can invalidate just that area.
+  struct HeatmapArea {
+    int16_t x1, y1, x2, y2;
+  };
+
+  // buf: canvas pixel buffer (RGB565), stride_px: buffer width in pixels,
+  // swap_bytes: pass LV_COLOR_16_SWAP. Returns false if nothing was drawn.
+  bool render_heatmap(uint16_t *buf, uint16_t stride_px, uint8_t eco_threshold, bool swap_bytes,
+                      HeatmapArea *area = nullptr);
+  // Forces a full repaint on the next render_heatmap() call.
+  void invalidate_heatmap() { heatmap_valid_ = false; }
+
+  // Profiler (see ProfileChannel). Without `profiler:` in YAML these are
+  // no-ops, so YAML lambdas may call profile_record() unconditionally.
+  void profile_record([[maybe_unused]] ProfileChannel channel, [[maybe_unused]] uint32_t us) {
+#ifdef HOTCIRC_PROFILER
+    profile_[(uint8_t) channel].record(us);
+#endif
+  }
+  void set_profile_sensor([[maybe_unused]] ProfileChannel channel, [[maybe_unused]] ProfileStat stat,
+                          [[maybe_unused]] sensor::Sensor *s) {
+#ifdef HOTCIRC_PROFILER
+    profile_sensor_[(uint8_t) channel][(uint8_t) stat] = s;
+#endif
+  }
+  void set_profile_interval([[maybe_unused]] uint32_t ms) {
+#ifdef HOTCIRC_PROFILER
+    profile_interval_ms_ = ms;
+#endif
+  }
+
+  // Trace recorder (see TraceEvent). NOTE: set_trace_capacity() only
+  // records the size; the ring is allocated in setup() (PSRAM if present).
+  void set_trace_capacity([[maybe_unused]] uint32_t records) {
+#ifdef HOTCIRC_TRACE
+    trace_capacity_ = records;
+#endif
+  }
+#ifdef HOTCIRC_TRACE
+  uint32_t trace_count() const { return trace_count_.load(std::memory_order_relaxed); }
+  // Writes header + ring (oldest first) to `sink` in pieces of at most 4 KB;
+  // `sink` returns false to abort. Called from the web server task by the
+  // /hotcirc/trace.bin handler. Recording pauses for the duration.
+  // Returns the number of records written.
+  uint32_t stream_trace(const std::function<bool(const uint8_t *, size_t)> &sink);
+#endif
+
   // Parameters (configurable)
   // FIX #9: default aligned with the shipped YAML (1.0 °C, reduced from 1.5
   // to match the slower temperature response of the 40 cm sensor pipe).
@@ -143,10 +815,25 @@ class HotWaterController : public Component {
   uint8_t SCHEDULE_THRESHOLD = 120;      // Threshold to trigger scheduled run
   float DECAY = 0.98f;                   // Daily decay factor for learning matrix
 
-  // Learning matrix [day_of_week][half_hour_slot]
-  // Slots: 0=00:00-00:29, 1=00:30-00:59, 2=01:00-01:29, ..., 47=23:30-23:59
-  uint8_t learn_[7][48] = {0};
-  uint32_t last_decay_day_ = 0;
+  // Learning matrix [day_of_week][slot], SLOT_MINUTES per slot.
+  // At 48 slots: 0=00:00-00:29, 1=00:30-00:59, ..., 47=23:30-23:59
+  // Decay is lazy: row d holds its values as of local day decay_day_[d],
+  // and readers see them scaled by decay_factor_[d] = DECAY^(today -
+  // decay_day_[d]) - always through cell_(). Writers fold the factor in first
+  // (age_row_()). So a row ages by exactly the elapsed days, also across
+  // power cuts and vacation mode, without a daily pass over the matrix.
+  LearnMatrix learn_;
+  int32_t decay_day_[7] = {0};           // 0 = not stamped yet (clock was invalid)
+  uint16_t decay_factor_[7] = {256, 256, 256, 256, 256, 256, 256};  // Q8 (LearnMatrix::scale_word)
+  int32_t decay_today_{0};               // Local day number of the last valid pass
+  uint32_t decay_pow_q16_[9] = {0};      // DECAY^(2^k) in Q16, built in setup()
+  static constexpr int32_t DECAY_MAX_DAYS = 511;  // Beyond: 255 * 0.98^511 < 1, the value is 0
+
+  // Change tracking (see get_matrix_generation())
+  uint32_t matrix_generation_{0};        // Monotonic, bumped on every matrix mutation
+  uint32_t matrix_dirty_[(MATRIX_CELLS + 31) / 32] = {0};  // 1 bit per slot, d * SLOTS_PER_DAY + s
+  uint32_t saved_generation_{0};         // Generation last written to flash
+  CallbackManager<void(uint32_t)> matrix_change_callback_;
 
   // Water draw detection state (tracks sustained temperature RISE)
   float last_outlet_value_{NAN};
@@ -158,9 +845,44 @@ class HotWaterController : public Component {
   time_t last_water_draw_time_{0};       // Timestamp of last detected water draw
   bool vacation_mode_{false};            // True when no water draw for 24h
   bool draw_pending_{false};             // True in case potential water draw detected (read by GUI)
+  DrawDetector draw_detector_{DrawDetector::CLASSIC};
+  SlopeWindow draw_slope_;               // SLOPE detector window (raw samples)
+  float draw_slope_min_rate_{0.05f};     // °C/s
+  float draw_slope_min_t_{5.0f};
+  // DS18B20 12-bit step is 0.0625 °C: its uniform quantization variance is
+  // the floor for the fit residual, so a perfectly clean staircase does not
+  // produce an infinite t-statistic.
+  static constexpr float DRAW_SLOPE_NOISE_VAR = 0.0625f * 0.0625f / 12.0f;
+
+  // Predictive stop (StopMode::PREDICTIVE): return slope of the current run,
+  // fed from the ret_ publish callback.
+  StopMode stop_mode_{StopMode::THRESHOLD};
+  float return_lag_s_{10.0f};
+  bool return_lag_auto_{false};          // return_sensor_lag not set: follow calibration
+  SlopeWindow return_slope_;
+  static constexpr uint8_t RETURN_SLOPE_WINDOW = 5;  // samples
+
+  // Pulsed circulation (see set_pulsed_circulation() / pulse_control_()).
+  // pump_running_ stays true for the whole run; the relay is off while
+  // pulse_soaking_.
+  bool pulse_enabled_{false};
+  float pulse_arrival_rate_{0.05f};      // °C/s return slope that means "hot water arrived"
+  bool pulse_active_{false};             // Current run is pulsed
+  bool pulse_soaking_{false};
+  uint32_t pulse_phase_end_ms_{0};       // millis() when the current burst / soak ends
+  uint32_t pulse_soak_start_ms_{0};
+  uint32_t pulse_paused_ms_{0};          // Finished soaks of the run
+  uint32_t pulse_burst_ms_{0};           // Follow-up burst length
+  uint32_t pulse_soak_ms_{10000};
+  uint8_t pulse_count_{0};               // Bursts so far (0 = continuous run)
+  static constexpr float PULSE_FIRST_BURST = 0.8f;    // x transit time: front just short of the return
+  static constexpr float PULSE_NEXT_BURST = 0.1f;     // x transit time per follow-up burst
+  static constexpr uint32_t PULSE_MIN_BURST_MS = 3000;
+  static constexpr float PULSE_ARRIVAL_MIN_RISE = 0.25f;  // x return_rise, with the slope
 
   // Pump control state
   bool pump_running_{false};
+  uint32_t pump_divergences_{0};         // Switch reported a state != pump_running_
   bool disinfection_mode_{false};        // Flag when disinfection cycle detected
   PumpTrigger pump_trigger_{PumpTrigger::NONE};  // What triggered the current pump run
   time_t last_disinfection_start_{0};    // Timestamp of last disinfection cycle start (prevents re-trigger)
@@ -178,7 +900,8 @@ class HotWaterController : public Component {
   // Energy tracking for current/last pump cycle
   float energy_sum_{0.0f};               // Accumulated energy during current cycle (Wh)
   uint32_t energy_samples_{0};           // Number of samples taken
-  uint32_t last_energy_calc_time_{0};    // Last time energy was calculated (millis)
+  uint32_t last_energy_calc_time_{0};    // Time of the last integration step (millis)
+  float last_power_w_{NAN};              // Loop power at that step (W), NAN = none yet
   float last_cycle_energy_{0.0f};        // Energy consumed in last completed cycle (kWh)
   uint32_t last_cycle_duration_{0};      // Duration of last cycle (seconds)
 
@@ -194,15 +917,240 @@ class HotWaterController : public Component {
   uint8_t led_flash_remaining_{0};       // Toggles left in the flash sequence
   uint32_t led_flash_next_ms_{0};        // millis() deadline for next toggle
 
+  // Heatmap renderer state (see render_heatmap())
+  uint32_t heatmap_generation_{0};       // Matrix generation of the last paint
+  uint8_t heatmap_eco_{0};               // ECO threshold of the last paint
+  bool heatmap_valid_{false};            // false = canvas content unknown, repaint all
+  bool heatmap_lut_swapped_{false};      // Byte order the LUT was built for
+  uint16_t heatmap_lut_[5][2] = {{0}};   // RGB565 colour by [value bucket][above ECO]
+
+  // Multi-circuit mode (see set_circuit() / CircuitCoordinator)
+  std::string circuit_;
+  std::string log_prefix_;               // "[<circuit>] " or empty
+  CircuitCoordinator *coordinator_{nullptr};
+  uint32_t start_stagger_ms_{0};
+  PumpTrigger deferred_trigger_{PumpTrigger::NONE};  // Automatic start held back by the stagger
+  uint32_t deferred_until_ms_{0};        // millis() when it is retried
+
+  // Adaptive sampling (see set_adaptive_sampling() / update_sampling_())
+  PollingComponent *sample_outlet_poller_{nullptr};
+  PollingComponent *sample_return_poller_{nullptr};
+  uint32_t sample_idle_ms_{0};           // 0 = adaptive sampling off
+  uint32_t sample_active_ms_{0};
+  uint32_t sample_hold_ms_{0};
+  uint32_t sample_fast_until_ms_{0};     // millis() until which the fast rate is held
+  bool sample_fast_{false};              // Rate currently applied to the pollers
+  bool sample_applied_{false};           // A rate has been applied at all
+  float sample_last_outlet_{NAN};        // Previous outlet reading, for the rise wake-up
+  // Rise between two readings that switches to the fast rate: the classic
+  // detector's gate on the filtered value, more than one 0.0625 °C step on
+  // the raw readings the SLOPE detector gets (quantization flicker)
+  static constexpr float SAMPLING_WAKE_RISE = 0.03f;
+  static constexpr float SAMPLING_WAKE_RISE_RAW = 0.1f;
+
+  UiStatus ui_status_{};                 // Last snapshot handed out (get_ui_status())
+
+  // Sensor fusion (see set_fast_sensor() / on_fast_sample_())
+  sensor::Sensor *fast_{nullptr};
+  FuseTarget fuse_target_{FuseTarget::RETURN};
+  float fuse_tau_s_{60.0f};
+  float fuse_offset_{NAN};               // fast - slow, learned while both are steady
+  float fuse_value_{NAN};                // fast - offset
+  float fuse_fast_level_{NAN};           // Fast reading, smoothed for the steadiness test
+  uint32_t fuse_fast_ms_{0};             // millis() of the last fast reading
+  bool fuse_diverged_{false};            // |fast - slow| out of range: fast input ignored
+  // Steadiness test: change over one FUSE_STEADY_WINDOW_MS window each
+  float fuse_fast_anchor_{NAN};
+  float fuse_slow_anchor_{NAN};
+  uint32_t fuse_fast_anchor_ms_{0};
+  uint32_t fuse_slow_anchor_ms_{0};
+  bool fuse_fast_steady_{false};
+  bool fuse_slow_steady_{false};
+  static constexpr uint32_t FUSE_STEADY_WINDOW_MS = 10000;
+  static constexpr float FUSE_STEADY_RATE = 0.02f;     // °C/s, both signals, to learn the offset
+  static constexpr float FUSE_FAST_SMOOTH_S = 3.0f;    // Noise filter of the steadiness test only
+  static constexpr float FUSE_MAX_OFFSET = 10.0f;      // °C; beyond: sensor fault, not an offset
+  static constexpr uint32_t FUSE_STALE_MS = 5000;      // Fast reading older than this: not used
+
+  // Sensor readings, either handled in the publish callback or queued for
+  // the control task (see feed_sample_())
+  enum class SampleSource : uint8_t { OUTLET_RAW, OUTLET, RETURN, FAST };
+  // Work the control task leaves to loop() (defer_to_main_()); bits
+  // coalesce, the pump output is applied as the state commanded by then
+  static constexpr uint8_t MAIN_PUMP_OUTPUT = 1 << 0;       // Switch write / publish
+  static constexpr uint8_t MAIN_LEARN_DRAW = 1 << 1;        // learn_draw_(pending_draw_tick_)
+  static constexpr uint8_t MAIN_SAVE_ENERGY = 1 << 2;
+  static constexpr uint8_t MAIN_PUBLISH_ENERGY = 1 << 3;
+  static constexpr uint8_t MAIN_SAVE_CALIBRATION = 1 << 4;
+  static constexpr uint8_t MAIN_LEDS = 1 << 5;              // Green = pump_running_, yellow via update_leds()
+  TickContext pending_draw_tick_{};      // Confirmed draw waiting for MAIN_LEARN_DRAW
+#ifdef HOTCIRC_CONTROL_TASK
+  struct ControlSample {
+    SampleSource source;
+    float value;
+  };
+  bool control_enabled_{false};
+  uint8_t control_core_{1};
+  uint8_t control_priority_{5};
+  TaskHandle_t control_task_{nullptr};
+  SmartPlugSwitch *pump_plug_{nullptr};
+  // Recursive: public entry points lock too and call each other
+  std::recursive_mutex core_lock_;
+  SpscQueue<ControlSample, 16> samples_;
+  uint32_t sample_overruns_{0};          // Main task only: readings the full queue dropped
+  uint32_t logged_overruns_{0};
+  std::atomic<uint8_t> main_work_{0};    // MAIN_* bits
+  static constexpr uint32_t CONTROL_TICK_MS = 100;  // pump_control() period while the pump runs
+  static constexpr uint32_t CONTROL_TASK_STACK = 4096;
+#endif
+
+  // Clock holdover (see set_clock_holdover() / make_tick_())
+  uint32_t clock_holdover_s_{86400};
+  bool clock_anchored_{false};           // A valid time was seen (and holdover not expired)
+  bool clock_estimated_{false};          // The last tick was an estimate
+  time_t clock_anchor_epoch_{0};         // Last valid reading ...
+  uint32_t clock_anchor_ms_{0};          // ... and millis() when it was taken
+  // Confirmed draws while no time was known at all (boot after a power cut
+  // before the first sync): learned retroactively in their own slots
+  static constexpr uint8_t EARLY_DRAWS = 8;
+  uint32_t early_draw_ms_[EARLY_DRAWS] = {0};
+  uint8_t early_draw_count_{0};
+
+  // Former function-local statics: per instance, so several circuits on one
+  // node no longer share them
+  uint32_t last_loop_ms_{0};             // loop gap warning
+  time_t last_vacation_log_{0};          // hourly vacation status log
+  bool anti_stag_ran_this_week_{false};
+  int anti_stag_last_log_hour_{-1};      // anti-stagnation status log on Sundays
+
   // Scheduled trigger tracking (prevents re-triggering same 30-min slot)
   int last_scheduled_day_{-1};   // Last day when scheduled trigger fired
   int last_scheduled_slot_{-1};  // Last 30-min slot when scheduled trigger fired
 
+#ifdef HOTCIRC_PROFILER
+  // Profiler state: one window of samples per channel, published and reset
+  // every profile_interval_ms_ by publish_profile_().
+  LatencyHistogram profile_[PROFILE_CHANNELS]{};
+  sensor::Sensor *profile_sensor_[PROFILE_CHANNELS][3]{};
+  uint32_t profile_interval_ms_{60000};
+  uint32_t profile_next_publish_ms_{0};
+  uint32_t last_loop_us_{0};
+#endif
+
+  // Event log ring (see dump_event_log())
+  static constexpr uint8_t EVENT_LOG_SIZE = 128;
+  TraceRecord event_log_[EVENT_LOG_SIZE]{};
+  // Records written so far; slot = total % EVENT_LOG_SIZE. Published after
+  // the record, so stream_event_log() (web server task) copies without a lock
+  // and drops what was overwritten meanwhile.
+  std::atomic<uint32_t> event_total_{0};
+
+#ifdef HOTCIRC_TRACE
+  // Trace ring. Written from the main loop task (sensor callbacks,
+  // run_pump/stop_pump) or, with control_task, under core_lock_ from the
+  // control task as well; stream_trace() reads it from the httpd task while
+  // trace_paused_ makes trace_event_() drop (and count) new records.
+  // trace_writing_ brackets a write, so stream_trace() can wait out a writer
+  // that passed the pause check just before the pause was set.
+  TraceRecord *trace_{nullptr};
+  uint32_t trace_capacity_{0};
+  std::atomic<uint32_t> trace_head_{0};  // Next write index
+  std::atomic<uint32_t> trace_count_{0}; // Valid records (<= capacity)
+  uint16_t trace_dropped_{0};            // Dropped while paused, reported as GAP
+  std::atomic<bool> trace_paused_{false};
+  std::atomic<bool> trace_writing_{false};
+#endif
+
+  // Deadline scheduler (see loop()); atomic: the control task sets it too
+  std::atomic<bool> wake_pending_{true};  // Set by sensor/button callbacks and wake()
+  uint32_t next_deadline_ms_{0};         // millis() of the next due pass
+  uint32_t last_matrix_log_s_{0};        // millis()/1000 of the last matrix dump
+  uint32_t logged_generation_{0};        // matrix_generation_ of the last dump
+  int sched_cell_{-1};                   // check_schedule() inputs of the last
+  int sched_ahead_cell_{-1};             //   evaluation: current / lookahead cell
+  int sched_threshold_{-1};              //   and ECO level (-1 = never evaluated)
+  uint32_t sched_generation_{0};         //   and matrix_generation_ (cells read)
+
+  // Lookahead preheat (see set_preheat_lead())
+  uint32_t preheat_lead_s_{0};           // Configured lead time (seconds), 0 = off
+  bool preheat_lead_auto_{false};        // Learn lead from SCHEDULED heat-up time
+  float learned_lead_s_{NAN};            // EWMA of SCHEDULED heat-up durations (s)
+  static constexpr uint32_t PREHEAT_LEAD_MAX_S = 1800;  // Never look further than one slot
+
   // Flash storage
+  uint32_t pref_key_(const char *name) const;  // name, suffixed with the circuit
   ESPPreferenceObject pref_;
+  ESPPreferenceObject journal_pref_;
+  ESPPreferenceObject calibration_pref_;
+  CalibrationData calibration_{};
+  bool calibration_valid_{false};
+  float loop_volume_l_{0.0f};
+  // Return rise curve of the running calibration, one entry per return
+  // reading (only allocated while calibrating, <= MAX_RUN_TIME entries).
+  struct CalibrationSample {
+    uint16_t t_ds;                       // Since pump start, 0.1 s
+    int16_t rise_cc;                     // Return - start value, 0.01 °C
+  };
+  std::vector<CalibrationSample> calibration_curve_;
+  ESPPreferenceObject energy_pref_;
+  EnergyTotalsData energy_totals_{};
+  struct EnergySensor {
+    EnergyPeriod period;
+    EnergyStat stat;
+    int8_t trigger;                      // PumpTrigger index, -1 = sum of all
+    sensor::Sensor *sensor;
+  };
+  std::vector<EnergySensor> energy_sensors_;
+
+  // Warm-start record (see RuntimeStateData); runtime_saved_ is the last
+  // written copy, so a pass only writes when something actually changed
+  ESPPreferenceObject runtime_pref_;
+  RuntimeStateData runtime_saved_{};
+  // A draw moves last_water_draw_time_ only in steps of this size: the
+  // vacation timer (24 h) does not need every draw on flash
+  static constexpr uint32_t RUNTIME_DRAW_RESOLUTION_S = 900;
+
+  // Scheduled-run analytics / ECO auto-tuner (see set_schedule_auto_tune())
+  ESPPreferenceObject sched_stats_pref_;
+  ScheduleStatsData sched_stats_{};
+  uint32_t sched_hit_window_s_{1800};
+  int sched_pending_cell_{-1};           // Cell of the SCHEDULED run awaiting its outcome
+  time_t sched_pending_epoch_{0};        //   its start
+  float sched_pending_wh_{0.0f};         //   its energy (set when the run stops)
+  bool sched_tune_{false};
+  float sched_tune_target_{0.6f};
+  uint8_t sched_tune_step_{5};
+  uint8_t sched_tune_min_{60};
+  uint8_t sched_tune_max_{240};
+  uint8_t sched_tune_outcomes_{0};       // Outcomes since the last adjustment
+  static constexpr uint8_t SCHED_TUNE_MIN_OUTCOMES = 5;
+  static constexpr float SCHED_HIT_RATE_ALPHA = 0.1f;  // EWMA weight of one outcome
+  sensor::Sensor *sched_hit_rate_sensor_{nullptr};
+  sensor::Sensor *sched_wasted_sensor_{nullptr};
+  sensor::Sensor *sched_threshold_sensor_{nullptr};
+  static constexpr float CALIBRATION_MIN_DELTA = 5.0f;   // Outlet - return at start (°C) = "cold loop"
+  static constexpr float CALIBRATION_MIN_RISE = 2.0f;    // Smaller total rise = no usable curve
+  LearnJournalData journal_{};           // RAM copy of the journal in flash
+  uint8_t snapshot_epoch_{0};            // Epoch of the snapshot in flash
+  bool journal_sync_{true};              // See set_journal_sync()
 
   void setup() override;
+  // Deadline-driven: every pass computes the earliest moment anything can
+  // change (slot boundary, lookahead boundary, midnight decay, hour boundary
+  // for anti-stagnation/vacation, thermal hold expiry, pump runtime limits,
+  // LED timers, matrix log) and loop() returns immediately until then, or
+  // until a sensor/button callback or wake() requests a pass.
   void loop() override;
+  // Request a full pass on the next loop() (e.g. after changing parameters
+  // such as SCHEDULE_THRESHOLD from YAML). Without it the change is picked
+  // up within MAX_IDLE_MS.
+  void wake() {
+    wake_pending_ = true;
+#ifdef HOTCIRC_CONTROL_TASK
+    if (control_task_ != nullptr) xTaskNotifyGive(control_task_);  // pump deadlines tick there
+#endif
+  }
+  static constexpr uint32_t MAX_IDLE_MS = 30000;
 
   // Public control methods (callable from YAML)
   void manual_pump_on() {
@@ -210,9 +1158,30 @@ class HotWaterController : public Component {
   }
 
   void manual_pump_off() {
-    stop_pump("Manual stop (Web UI)");
+    stop_pump(StopReason::MANUAL_WEBUI);
   }
 
+  // Event log: the last EVENT_LOG_SIZE controller events (draw start /
+  // confirm / reset, pump on / off with reason, decay, flash writes, mode
+  // changes) as 8-byte TraceRecords, independent of `trace:`. Nothing is
+  // formatted until a client asks: dump_event_log() writes it to the logger
+  // (e.g. from a button), stream_event_log() hands out one text line per
+  // event, oldest first (GET /hotcirc/events.txt with web_server); a false
+  // return stops it. Returns the number of lines.
+  void dump_event_log();
+  uint32_t stream_event_log(const std::function<bool(const char *)> &line);
+
+  // Loop calibration: runs the pump from a cold loop (outlet at least
+  // CALIBRATION_MIN_DELTA above return) until the return reading levels off
+  // and derives transit time, rise time constant, heat-up time and - with
+  // loop_volume - the flow rate. The result is persisted and replaces the
+  // static guesses: pump_flow_rate (energy), return_sensor_lag (predictive
+  // stop, unless set in YAML) and the initial preheat lead.
+  void start_calibration();
+  bool is_calibrating() const { return pump_running_ && pump_trigger_ == PumpTrigger::CALIBRATION; }
+  bool has_calibration() const { return calibration_valid_; }
+  const CalibrationData &get_calibration() const { return calibration_; }
+
   void enable_pump();
 
   void disable_pump();
@@ -221,34 +1190,119 @@ class HotWaterController : public Component {
   void save_learning_matrix();
 
   void run_pump(PumpTrigger trigger = PumpTrigger::MANUAL_BUTTON);
-  void stop_pump(const char *reason);
+  void stop_pump(StopReason reason);
+  static const char *stop_reason_to_str_(StopReason r);
+  // Times the pump switch reported a state other than the commanded one
+  uint32_t get_pump_divergences() const { return pump_divergences_; }
 
  protected:
+  void on_pump_feedback_(bool on);
+  void feed_sample_(SampleSource source, float v);  // From the sensor callbacks
+  void on_sample_(SampleSource source, float v);    // Detection / fusion / energy for one reading
+  void set_pump_output_(bool on);        // Relay command (see MAIN_PUMP_OUTPUT)
+  void set_green_led_(bool on);          // Pump LED (see MAIN_LEDS)
+  // On the control task: leave `work` (MAIN_* bits) to the next loop() and
+  // return true. Elsewhere false - the caller does it right away.
+  bool defer_to_main_(uint8_t work);
+#ifdef HOTCIRC_CONTROL_TASK
+  void start_control_task_();
+  static void control_task_entry_(void *arg);
+  void control_loop_();
+  void run_main_work_();                 // Drain main_work_ (loop())
+#endif
   // FIX #10: the deprecated poll-based detect_water_draw() has been removed
   // entirely (history lives in Git). Detection runs exclusively in
   // on_outlet_sample_(), fed by the outlet sensor's publish callback and
   // therefore immune to loop() starvation on the display node.
   void on_outlet_sample_(float t_now);
   void reset_water_draw_detection_();    // Resets draw detection state
-  void detect_disinfection_cycle_();     // Detects boiler disinfection by monitoring outlet temp
-  void check_vacation_mode_();           // Check if entering/exiting vacation mode
-  void check_anti_stagnation_();         // Check if anti-stagnation run is needed
-  void check_thermal_stagnation_();      // Check if return >= outlet (summer heat soak flush)
-  void handle_user_request();
-  void learn_now();
-  void decay_table();
-  void save_learning_matrix_();          // Save learning matrix to flash
-  void load_learning_matrix_();          // Load learning matrix from flash
+  void detect_draw_slope_(const TickContext &t, float t_now, uint32_t now_ms);  // DrawDetector::SLOPE
+  void on_return_sample_(float v);       // Return slope for StopMode::PREDICTIVE
+  bool calibration_plateau_() const;     // Return reading has levelled off
+  void finish_calibration_(const TickContext &t, uint32_t elapsed_s);  // Evaluate curve, persist, apply
+  void save_calibration_();
+  void load_calibration_();
+  void apply_calibration_();
+  static uint32_t prefs_checksum_(const void *data, size_t len);  // CRC-32 of the small blobs
+  void integrate_energy_(uint32_t now_ms);   // Trapezoid step, from the sensor callbacks
+  void account_energy_(const TickContext &t, PumpTrigger trigger, uint32_t runtime_s, float wh);
+  bool roll_energy_periods_(const TickContext &t);  // true if a row was reset
+  void load_energy_totals_();
+  void save_energy_totals_();
+  void publish_energy_();
+  void note_schedule_hit_(const TickContext &t);       // Confirmed draw
+  void check_schedule_outcome_(const TickContext &t);  // Hit window expiry
+  void record_schedule_outcome_(bool hit);
+  void tune_schedule_threshold_();
+  void load_schedule_stats_();
+  void load_runtime_state_();
+  void save_runtime_state_();           // No-op unless the record changed
+  void publish_schedule_stats_();
+  TickContext make_tick_();             // One clock_->now() for the current pass (or the holdover estimate)
+  void learn_early_draws_(const TickContext &t, uint32_t now_ms);  // Draws from before the first valid time
+  void update_sampling_(uint32_t now_ms);  // Apply the idle / active sensor poll rate
+  void on_fast_sample_(float v);          // Complementary filter, fast sensor callback
+  void on_fuse_slow_sample_(float v);     // Steadiness of the slow sensor it is fused with
+  bool fuse_active_(uint32_t now_ms) const;
+  static bool steady_window_(float v, uint32_t now_ms, float &anchor, uint32_t &anchor_ms, bool steady);
+  float stop_return_value_() const;       // Return value for the pump stop threshold
+  bool pulse_control_(uint32_t elapsed_s);  // Bursts / soaks of a pulsed run; true if it stopped the pump
+  void resume_burst_(uint32_t now_ms);   // End a soak: pump back on
+  uint32_t pump_on_ms_(uint32_t now_ms) const;  // Pump-on time of the current run
+  static TickContext tick_from_time_(const ESPTime &n);
+  void detect_disinfection_cycle_(const TickContext &t);  // Detects boiler disinfection by monitoring outlet temp
+  void check_vacation_mode_(const TickContext &t);        // Check if entering/exiting vacation mode
+  void check_anti_stagnation_(const TickContext &t);      // Check if anti-stagnation run is needed
+  void check_thermal_stagnation_(const TickContext &t);   // Check if return >= outlet (summer heat soak flush)
+  void handle_user_request(const TickContext &t);
+  void learn_draw_(const TickContext &t);  // Schedule hit + learning of a confirmed draw
+  void learn_now(const TickContext &t);
+  uint8_t cell_(int day, int slot) const {
+    return (uint8_t) (((uint32_t) learn_[day][slot] * decay_factor_[day]) >> 8);
+  }
+  void advance_decay_day_(const TickContext &t);  // New local day: recompute the row factors
+  void age_row_(int day);                // Fold the pending decay of a row into learn_
+  uint32_t decay_q16_(int32_t days) const;
+  // Rounded, but below 256 for days >= 1 like decay_q16_()
+  uint16_t decay_q8_(int32_t days) const {
+    return days <= 0 ? 256 : (uint16_t) std::min<uint32_t>((decay_q16_(days) + 128) >> 8, 255);
+  }
+  void save_learning_matrix_();          // Full snapshot to flash (compacts the journal)
+  void load_learning_matrix_();          // Load snapshot + replay journal
+  void journal_append_(int day, int slot, uint8_t inc);  // Record one learn increment
+  void journal_reset_();                 // Empty journal for the current snapshot epoch
+  bool journal_save_();
+  static uint32_t journal_checksum_(const LearnJournalData &j);
+  static uint32_t journal_checksum_legacy_(const LearnJournalData &j);
   void init_default_pattern_();          // FIX #11: single helper for the typical daily pattern
-  uint32_t calculate_checksum_() const;  // Checksum over learn_[][]
-  static uint32_t calculate_checksum_(const uint8_t (&m)[7][48]);  // Checksum over arbitrary matrix
+  static uint32_t calculate_checksum_(const uint8_t (&m)[7][MATRIX_ROW_BYTES]);  // CRC-32 over stored snapshot bytes
+  static uint32_t calculate_checksum_legacy_(const uint8_t (&m)[7][MATRIX_ROW_BYTES]);  // Additive (old snapshots)
   void reset_learning_matrix_();         // Reset learning matrix (10+ sec button press)
-  void check_schedule();
+  void check_schedule(const TickContext &t);
+  uint32_t next_deadline_ms_from_(const TickContext &t, uint32_t now_ms) const;
+  bool try_schedule_slot_(const TickContext &t, int wd, int slot, const char *kind, int hr, int min);
+  void learn_preheat_lead_(uint32_t heatup_s);
   void pump_control();
   void handle_button();
   void toggle_learning();
   void update_leds();
   void log_learning_matrix_();
+  void mark_slot_dirty_(int day, int slot) {
+    const int i = day * SLOTS_PER_DAY + slot;
+    matrix_dirty_[i >> 5] |= 1u << (i & 31);
+  }
+  void mark_matrix_dirty_();             // All MATRIX_CELLS slots
+  void notify_matrix_change_();          // Bump generation + fire callbacks
+  void publish_profile_();
+  void trace_event_(TraceEvent type, uint8_t arg, int16_t value);
+  // Controller event: event log, and the trace when recording
+  void record_event_(TraceEvent type, uint8_t arg, int16_t value);
+  void record_save_(SaveTarget target, bool ok) { record_event_(TraceEvent::SAVE, (uint8_t) target, ok ? 1 : 0); }
+  void record_mode_(ModeChange mode) { record_event_(TraceEvent::MODE, (uint8_t) mode, 0); }
+  static void format_event_(const TraceRecord &r, char *buf, size_t len);
+  static int16_t trace_temp_(float t);
+  void build_heatmap_lut_(bool swap_bytes);
+  static uint8_t heatmap_bucket_(uint8_t val);
 };
 
 }  // namespace esphome_hotcirc
@@ -0,0 +1,683 @@
+#include "smart_plug_switch.h"
+#include "esphome/core/log.h"
+#include "esphome/core/hal.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#ifdef USE_ESP_IDF
+#include <cerrno>
+#include <unistd.h>
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#endif
+
+namespace esphome {
+namespace esphome_hotcirc {
+
+static const char *const TAG = "smart_plug";
+
+void SmartPlugSwitch::setup() {
+#ifdef USE_ESP_IDF
+  // Always start OFF (restore_mode ALWAYS_OFF of the old template switch);
+  // the worker sends it as soon as the plug is reachable.
+  this->publish_state(false);
+  desired_.store(false);
+  desired_gen_.fetch_add(1);
+  if (connected_sensor_ != nullptr) connected_sensor_->publish_state(false);
+
+  // "/switch/relay" -> "switch-relay", the entity id in event messages
+  event_id_ = relay_path_.substr(relay_path_[0] == '/' ? 1 : 0);
+  std::replace(event_id_.begin(), event_id_.end(), '/', '-');
+
+  // Same priority as the loop task: the workers mostly wait on a socket.
+  if (xTaskCreate(&SmartPlugSwitch::worker_entry_, "smart_plug", 4096, this, 1, &worker_task_) != pdPASS ||
+      (events_ && xTaskCreate(&SmartPlugSwitch::event_entry_, "smart_plug_ev", 4096, this, 1, nullptr) != pdPASS)) {
+    ESP_LOGE(TAG, "Failed to start the smart plug worker tasks");
+    this->mark_failed();
+  }
+#else
+  ESP_LOGE(TAG, "The smart plug switch requires ESP-IDF");
+  this->mark_failed();
+#endif
+}
+
+void SmartPlugSwitch::dump_config() {
+  ESP_LOGCONFIG(TAG, "Smart plug pump switch:");
+  const std::string host = get_host();
+  ESP_LOGCONFIG(TAG, "  Host: %s:%u", host.empty() ? "(not set)" : host.c_str(), port_);
+  ESP_LOGCONFIG(TAG, "  Relay path: %s", relay_path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Timeout: %u ms, %u attempts per command", timeout_ms_, max_retries_);
+  if (verify_interval_ms_ > 0)
+    ESP_LOGCONFIG(TAG, "  Read-back every %u s", verify_interval_ms_ / 1000);
+  else
+    ESP_LOGCONFIG(TAG, "  Read-back: off");
+  ESP_LOGCONFIG(TAG, "  Event stream: %s", events_ ? "/events" : "off");
+}
+
+void SmartPlugSwitch::set_host(const std::string &host) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (host == host_) return;
+    host_ = host;
+  }
+  wake_worker_();
+}
+
+std::string SmartPlugSwitch::get_host() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return host_;
+}
+
+void SmartPlugSwitch::write_state(bool state) {
+  // Never blocks: record the latest wish, the worker sends it. A toggle that
+  // arrives before the previous one went out simply replaces it.
+  desired_.store(state);
+  desired_gen_.fetch_add(1);
+  wake_worker_();
+  this->publish_state(state);
+}
+
+void SmartPlugSwitch::request_state(bool state) {
+  if (desired_.exchange(state) == state) return;
+  desired_gen_.fetch_add(1);
+  wake_worker_();
+}
+
+void SmartPlugSwitch::verify() {
+  verify_requested_.store(true);
+  wake_worker_();
+}
+
+void SmartPlugSwitch::wake_worker_() {
+#ifdef USE_ESP_IDF
+  if (worker_task_ != nullptr) xTaskNotifyGive(worker_task_);
+#endif
+}
+
+void SmartPlugSwitch::push_result_(const Result &r) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (result_count_ == RESULT_QUEUE) {
+    // loop() stalled: keep the newest results
+    result_head_ = (result_head_ + 1) % RESULT_QUEUE;
+    result_count_--;
+    if (results_dropped_ < 255) results_dropped_++;
+  }
+  results_[(result_head_ + result_count_) % RESULT_QUEUE] = r;
+  result_count_++;
+  results_ready_.store(true);
+}
+
+const char *SmartPlugSwitch::error_str_(Error e) {
+  switch (e) {
+    case Error::NONE: return "ok";
+    case Error::NO_HOST: return "no host set";
+    case Error::CONNECT: return "connect failed";
+    case Error::SEND: return "send failed";
+    case Error::RECEIVE: return "no response";
+    case Error::STATUS: return "HTTP error status";
+    case Error::PARSE: return "unparsable response";
+  }
+  return "?";
+}
+
+void SmartPlugSwitch::loop() {
+  if (!results_ready_.load()) return;
+
+  Result batch[RESULT_QUEUE];
+  uint8_t n, dropped;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    n = result_count_;
+    for (uint8_t i = 0; i < n; i++) batch[i] = results_[(result_head_ + i) % RESULT_QUEUE];
+    result_head_ = 0;
+    result_count_ = 0;
+    dropped = results_dropped_;
+    results_dropped_ = 0;
+    results_ready_.store(false);
+  }
+  if (dropped > 0) ESP_LOGW(TAG, "%u request result(s) dropped (loop stalled)", dropped);
+
+  const bool was_connected = connected_;
+  for (uint8_t i = 0; i < n; i++) {
+    const Result &r = batch[i];
+    const bool ok = r.error == Error::NONE;
+    if (r.op != Op::EVENT) request_callback_.call(ok, r.rtt_us);
+    if (r.op == Op::EVENT && r.error == Error::STATUS) {
+      // Says nothing about reachability
+      ESP_LOGW(TAG, "Smart plug has no event stream at /events - relying on the %u s read-back",
+               verify_interval_ms_ / 1000);
+      continue;
+    }
+
+    if (ok) {
+      fail_streak_ = 0;
+      connected_ = true;
+      plug_state_ = r.state ? 1 : 0;
+      if (r.op == Op::COMMAND) {
+        ESP_LOGD(TAG, "Relay %s confirmed (%.0f ms, attempt %u)", r.state ? "ON" : "OFF", r.rtt_us / 1000.0f,
+                 r.attempt);
+        // Back in line after a mismatch (an older ack must not undo a newer command)
+        if (r.state == desired_.load() && this->state != r.state) this->publish_state(r.state);
+      } else if (r.mismatch) {
+        ESP_LOGW(TAG, "State mismatch (%s): plug=%s, expected=%s -> re-sending command",
+                 r.op == Op::EVENT ? "event" : "read-back", r.state ? "ON" : "OFF", r.state ? "OFF" : "ON");
+        // Report the real state until the re-sent command is confirmed, so
+        // HotWaterController sees the divergence through the switch state
+        this->publish_state(r.state);
+      } else {
+        ESP_LOGV(TAG, "Relay %s: %s", r.op == Op::EVENT ? "event" : "read back", r.state ? "ON" : "OFF");
+      }
+      continue;
+    }
+
+    if (fail_streak_ < 255) fail_streak_++;
+    if (fail_streak_ >= offline_threshold_) connected_ = false;
+    if (r.op == Op::COMMAND && r.attempt >= max_retries_) {
+      ESP_LOGE(TAG, "Turning the relay %s failed after %u attempts (%s, HTTP %d) - retrying on the next read-back",
+               r.state ? "ON" : "OFF", r.attempt, error_str_(r.error), r.status);
+    } else if (r.op == Op::COMMAND) {
+      ESP_LOGW(TAG, "Turning the relay %s: attempt %u/%u failed (%s, HTTP %d)", r.state ? "ON" : "OFF", r.attempt,
+               max_retries_, error_str_(r.error), r.status);
+    } else if (r.op == Op::EVENT) {
+      ESP_LOGD(TAG, "Event stream lost (%s, %u in a row) - reconnecting", error_str_(r.error), fail_streak_);
+    } else {
+      // FIX #21 of the YAML check: single failures are tolerated silently
+      ESP_LOGD(TAG, "Read-back failed (%s, HTTP %d, %u in a row)", error_str_(r.error), r.status, fail_streak_);
+    }
+  }
+
+  if (connected_ != was_connected) {
+    if (connected_)
+      ESP_LOGI(TAG, "Smart plug is now ONLINE");
+    else
+      ESP_LOGW(TAG, "Smart plug is now OFFLINE (after %u consecutive fails)", fail_streak_);
+    if (connected_sensor_ != nullptr) connected_sensor_->publish_state(connected_);
+  }
+}
+
+#ifdef USE_ESP_IDF
+void SmartPlugSwitch::worker_entry_(void *arg) { static_cast<SmartPlugSwitch *>(arg)->worker_(); }
+
+void SmartPlugSwitch::worker_() {
+  const TickType_t verify_ticks = verify_interval_ms_ > 0 ? pdMS_TO_TICKS(verify_interval_ms_) : portMAX_DELAY;
+  TickType_t next_verify = xTaskGetTickCount() + verify_ticks;
+  uint8_t attempt = 0;       // Attempts made for pending_gen
+  uint32_t pending_gen = 0;
+
+  for (;;) {
+    const std::string host = get_host();
+    if (host != last_host_) {
+      // New plug (or the first one): it has not seen the desired state yet
+      last_host_ = host;
+      acked_gen_ = desired_gen_.load() - 1;
+      close_socket_();
+    }
+    if (event_pending_.exchange(false)) {
+      // Relay state pushed by the event stream: reconcile right away
+      Result r{};
+      r.op = Op::EVENT;
+      r.state = event_state_.load();
+      reconcile_(r);
+      push_result_(r);
+    }
+
+    const uint32_t gen = desired_gen_.load();
+    if (gen != pending_gen) {
+      pending_gen = gen;
+      attempt = 0;  // A newer command starts a fresh round of retries
+    }
+    const TickType_t now = xTaskGetTickCount();
+    const bool verify_due = verify_interval_ms_ > 0 && (int32_t) (now - next_verify) >= 0;
+    const bool pending = !host.empty() && gen != acked_gen_;
+
+    if (pending && (attempt < max_retries_ || verify_due)) {
+      if (attempt >= max_retries_) {
+        attempt = 0;  // Retries used up: one more round per verify tick
+        next_verify = now + verify_ticks;
+      }
+      // The state is read after the generation: a write in between is sent
+      // now and re-sent (same state) once more - never lost.
+      if (send_command_(host, desired_.load(), ++attempt)) {
+        acked_gen_ = gen;
+        attempt = 0;
+        continue;
+      }
+      if (attempt < max_retries_) {
+        // Backoff 250 ms, 500 ms, 1 s, ... (a new command or set_host() cuts it short)
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(std::min<uint32_t>(250u << (attempt - 1), 4000)));
+      }
+      continue;
+    }
+
+    if (!host.empty() && (verify_due || verify_requested_.exchange(false))) {
+      read_back_(host);
+      next_verify = xTaskGetTickCount() + verify_ticks;
+      continue;
+    }
+
+    // Idle: sleep until write_state()/verify()/set_host() or the next verify tick
+    TickType_t wait = portMAX_DELAY;
+    if (verify_interval_ms_ > 0 && !host.empty()) {
+      const int32_t left = (int32_t) (next_verify - xTaskGetTickCount());
+      wait = left > 0 ? (TickType_t) left : 0;
+    }
+    if (wait > 0) ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+
+bool SmartPlugSwitch::send_command_(const std::string &host, bool state, uint8_t attempt) {
+  Result r{};
+  r.op = Op::COMMAND;
+  r.state = state;
+  r.attempt = attempt;
+  const uint32_t start = micros();
+  char body[64];
+  const int status =
+      request_(host, "POST", relay_path_ + (state ? "/turn_on" : "/turn_off"), body, sizeof(body), &r.error);
+  r.rtt_us = micros() - start;
+  r.status = (int16_t) status;
+  if (status != 0 && status != 200) r.error = Error::STATUS;
+  push_result_(r);
+  return r.error == Error::NONE;
+}
+
+void SmartPlugSwitch::read_back_(const std::string &host) {
+  Result r{};
+  r.op = Op::VERIFY;
+  const uint32_t start = micros();
+  char body[RESPONSE_BUF];
+  const int status = request_(host, "GET", relay_path_, body, sizeof(body), &r.error);
+  r.rtt_us = micros() - start;
+  r.status = (int16_t) status;
+  if (status != 0 && status != 200) {
+    r.error = Error::STATUS;
+  } else if (status == 200 && !parse_state_(body, &r.state)) {
+    r.error = Error::PARSE;
+  }
+  if (r.error == Error::NONE) reconcile_(r);
+  push_result_(r);
+}
+
+void SmartPlugSwitch::reconcile_(Result &r) {
+  const uint32_t gen = desired_gen_.load();
+  // Only a settled command can mismatch; a pending one is sent anyway
+  if (gen == acked_gen_ && r.state != desired_.load()) {
+    r.mismatch = true;
+    acked_gen_ = gen - 1;  // Plug rebooted or was switched locally: re-send
+  }
+}
+
+bool SmartPlugSwitch::parse_state_(const char *json, bool *state) {
+  if (strstr(json, "\"value\":true") != nullptr) {
+    *state = true;
+  } else if (strstr(json, "\"value\":false") != nullptr) {
+    *state = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Value of header `name` (case-insensitive) in the NUL-terminated header
+// block, nullptr if absent.
+static const char *find_header(const char *headers, const char *name) {
+  const size_t n = strlen(name);
+  for (const char *line = headers; line != nullptr && *line != '\0';) {
+    if (strncasecmp(line, name, n) == 0 && line[n] == ':') {
+      const char *v = line + n + 1;
+      while (*v == ' ') v++;
+      return v;
+    }
+    line = strstr(line, "\r\n");
+    if (line != nullptr) line += 2;
+  }
+  return nullptr;
+}
+
+namespace {
+// Incremental reader for the plug's event stream: HTTP headers, optional
+// chunked transfer coding, then SSE lines ("event:", "data:", blank line
+// ends a message).
+class EventStreamReader {
+ public:
+  // on_message(event, data) for every complete message
+  template<typename F> bool feed(const char *p, size_t n, F &&on_message) {
+    for (size_t i = 0; i < n; i++) {
+      const char c = p[i];
+      if (!in_body_) {
+        if (hdr_len_ < sizeof(hdr_) - 1) hdr_[hdr_len_++] = c;
+        hdr_[hdr_len_] = '\0';
+        if (hdr_len_ >= 4 && memcmp(hdr_ + hdr_len_ - 4, "\r\n\r\n", 4) == 0) {
+          int status = 0;
+          if (sscanf(hdr_, "HTTP/1.%*d %d", &status) != 1 || status != 200) return false;
+          const char *te = find_header(hdr_, "Transfer-Encoding");
+          chunked_ = te != nullptr && strncasecmp(te, "chunked", 7) == 0;
+          in_body_ = true;
+        } else if (hdr_len_ == sizeof(hdr_) - 1) {
+          return false;  // Header block too large
+        }
+        continue;
+      }
+      if (!chunked_) {
+        sse_char_(c, on_message);
+        continue;
+      }
+      // Chunked: "<hex size>[;ext]\r\n" <size bytes> "\r\n"
+      if (chunk_left_ > 0) {
+        sse_char_(c, on_message);
+        if (--chunk_left_ == 0) skip_crlf_ = 2;
+      } else if (skip_crlf_ > 0) {
+        skip_crlf_--;
+      } else if (c == '\n') {
+        chunk_left_ = chunk_size_;
+        chunk_size_ = 0;
+        in_ext_ = false;
+        if (chunk_left_ == 0) return false;  // Last chunk: stream ended
+      } else if (!in_ext_ && isxdigit((unsigned char) c)) {
+        chunk_size_ = chunk_size_ * 16 + (uint32_t) (isdigit((unsigned char) c) ? c - '0' : (tolower(c) - 'a' + 10));
+      } else if (c != '\r') {
+        in_ext_ = true;
+      }
+    }
+    return true;
+  }
+
+ protected:
+  template<typename F> void sse_char_(char c, F &on_message) {
+    if (c != '\n') {
+      if (line_len_ < sizeof(line_) - 1) line_[line_len_++] = c;
+      return;
+    }
+    if (line_len_ > 0 && line_[line_len_ - 1] == '\r') line_len_--;
+    line_[line_len_] = '\0';
+    if (line_len_ == 0) {
+      if (data_len_ > 0 || event_[0] != '\0') on_message(event_, data_);
+      event_[0] = '\0';
+      data_len_ = 0;
+      data_[0] = '\0';
+    } else if (strncmp(line_, "event:", 6) == 0) {
+      const char *v = line_ + 6 + (line_[6] == ' ');
+      snprintf(event_, sizeof(event_), "%s", v);
+    } else if (strncmp(line_, "data:", 5) == 0) {
+      const char *v = line_ + 5 + (line_[5] == ' ');
+      const int w = snprintf(data_ + data_len_, sizeof(data_) - data_len_, "%s", v);
+      if (w > 0) data_len_ = std::min(data_len_ + (size_t) w, sizeof(data_) - 1);
+    }
+    line_len_ = 0;
+  }
+
+  char hdr_[512];
+  size_t hdr_len_{0};
+  bool in_body_{false};
+  bool chunked_{false};
+  uint32_t chunk_left_{0};
+  uint32_t chunk_size_{0};
+  uint8_t skip_crlf_{0};
+  bool in_ext_{false};
+  char line_[256];
+  size_t line_len_{0};
+  char event_[16] = {0};
+  char data_[256] = {0};
+  size_t data_len_{0};
+};
+}  // namespace
+
+void SmartPlugSwitch::event_entry_(void *arg) { static_cast<SmartPlugSwitch *>(arg)->event_task_(); }
+
+// Subscribes to the plug web_server's event stream (GET /events). On connect
+// it sends the state of every entity, then one message per change and a
+// ping every 10 s. Relay states go to the worker, which re-sends on mismatch
+// within one round trip instead of at the next read-back.
+void SmartPlugSwitch::event_task_() {
+  uint32_t backoff_ms = 1000;
+  for (;;) {
+    const std::string host = get_host();
+    if (host.empty()) {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+    Result r{};
+    r.op = Op::EVENT;
+    if (stream_events_(host, &r.error)) backoff_ms = 1000;  // Was up: retry soon
+    if (r.error == Error::STATUS) {
+      // Reachable, but no event stream (web_server without events?): say so
+      // once, then only look again every 5 min. Read-back still reconciles.
+      if (backoff_ms < EVENT_NO_STREAM_MS) push_result_(r);
+      backoff_ms = EVENT_NO_STREAM_MS;
+    } else if (r.error != Error::NONE) {
+      push_result_(r);
+    }
+    vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+    if (backoff_ms < EVENT_NO_STREAM_MS) backoff_ms = std::min<uint32_t>(backoff_ms * 2, 30000);
+  }
+}
+
+bool SmartPlugSwitch::stream_events_(const std::string &host, Error *error) {
+  const int s = open_socket_(host, EVENT_STALL_MS, error);
+  if (s < 0) return false;
+  char req[160];
+  const int req_len = snprintf(req, sizeof(req),
+                               "GET /events HTTP/1.1\r\nHost: %s\r\nAccept: text/event-stream\r\n"
+                               "Cache-Control: no-cache\r\n\r\n",
+                               host.c_str());
+  if (req_len <= 0 || req_len >= (int) sizeof(req) || send(s, req, req_len, 0) != req_len) {
+    ::close(s);
+    *error = Error::SEND;
+    return false;
+  }
+
+  EventStreamReader reader;
+  bool live = false;
+  char id_key[48];
+  snprintf(id_key, sizeof(id_key), "\"id\":\"%s\"", event_id_.c_str());
+  auto on_message = [&](const char *event, const char *data) {
+    live = true;
+    bool state;
+    if (strcmp(event, "state") != 0 || strstr(data, id_key) == nullptr || !parse_state_(data, &state)) return;
+    event_state_.store(state);
+    event_pending_.store(true);
+    wake_worker_();
+  };
+
+  char buf[256];
+  *error = Error::RECEIVE;
+  for (;;) {
+    // Times out after EVENT_STALL_MS without even a ping
+    const ssize_t n = recv(s, buf, sizeof(buf), 0);
+    if (n <= 0) break;
+    if (!reader.feed(buf, (size_t) n, on_message)) {
+      *error = live ? Error::RECEIVE : Error::STATUS;
+      break;
+    }
+    if (get_host() != host) {
+      *error = Error::NONE;  // Re-subscribe to the new plug, not a failure
+      break;
+    }
+  }
+  ::close(s);
+  return live;
+}
+
+void SmartPlugSwitch::close_socket_() {
+  if (sock_ >= 0) ::close(sock_);
+  sock_ = -1;
+  conn_host_.clear();
+}
+
+bool SmartPlugSwitch::ensure_connected_(const std::string &host, Error *error) {
+  if (sock_ >= 0 && conn_host_ == host) return true;
+  close_socket_();
+  sock_ = open_socket_(host, timeout_ms_, error);
+  if (sock_ < 0) return false;
+  conn_host_ = host;
+  return true;
+}
+
+// TCP connection to the plug, connect bounded by timeout_ms_; receives time
+// out after recv_timeout_ms. Returns the socket or -1.
+int SmartPlugSwitch::open_socket_(const std::string &host, uint32_t recv_timeout_ms, Error *error) {
+  struct addrinfo hints {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  char port[6];
+  snprintf(port, sizeof(port), "%u", port_);
+  struct addrinfo *res = nullptr;
+  if (getaddrinfo(host.c_str(), port, &hints, &res) != 0 || res == nullptr) {
+    *error = Error::CONNECT;
+    return -1;
+  }
+  const int s = socket(res->ai_family, res->ai_socktype, 0);
+  if (s < 0) {
+    freeaddrinfo(res);
+    *error = Error::CONNECT;
+    return -1;
+  }
+
+  // Non-blocking connect bounded by the request timeout
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+  int rc = connect(s, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc != 0 && errno == EINPROGRESS) {
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(s, &wfds);
+    struct timeval tv {};
+    tv.tv_sec = timeout_ms_ / 1000;
+    tv.tv_usec = (timeout_ms_ % 1000) * 1000;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    rc = select(s + 1, nullptr, &wfds, nullptr, &tv) == 1 && getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+                 err == 0
+             ? 0
+             : -1;
+  }
+  if (rc != 0) {
+    ::close(s);
+    *error = Error::CONNECT;
+    return -1;
+  }
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) & ~O_NONBLOCK);
+
+  struct timeval tv {};
+  tv.tv_sec = recv_timeout_ms / 1000;
+  tv.tv_usec = (recv_timeout_ms % 1000) * 1000;
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  tv.tv_sec = timeout_ms_ / 1000;
+  tv.tv_usec = (timeout_ms_ % 1000) * 1000;
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  const int one = 1;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return s;
+}
+
+int SmartPlugSwitch::request_(const std::string &host, const char *method, const std::string &path, char *body,
+                              size_t body_size, Error *error) {
+  body[0] = '\0';
+  char req[192];
+  const int req_len = snprintf(req, sizeof(req),
+                               "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\nContent-Length: 0\r\n\r\n",
+                               method, path.c_str(), host.c_str());
+  if (req_len <= 0 || req_len >= (int) sizeof(req)) {
+    *error = Error::SEND;
+    return 0;
+  }
+
+  // Second pass only when a reused connection turned out to be closed by
+  // the plug (idle keep-alive timeout): reconnect once, not a failure.
+  for (int pass = 0; pass < 2; pass++) {
+    const bool reused = sock_ >= 0 && conn_host_ == host;
+    if (!ensure_connected_(host, error)) return 0;
+
+    if (send(sock_, req, req_len, 0) != req_len) {
+      close_socket_();
+      if (reused) continue;
+      *error = Error::SEND;
+      return 0;
+    }
+
+    // Status line and headers
+    char buf[RESPONSE_BUF];
+    size_t len = 0;
+    char *end = nullptr;
+    bool stale = false;
+    while (end == nullptr) {
+      if (len == sizeof(buf) - 1) break;
+      const ssize_t r = recv(sock_, buf + len, sizeof(buf) - 1 - len, 0);
+      if (r <= 0) {
+        stale = reused && len == 0 && r == 0;
+        break;
+      }
+      len += (size_t) r;
+      buf[len] = '\0';
+      end = strstr(buf, "\r\n\r\n");
+    }
+    if (end == nullptr) {
+      close_socket_();
+      if (stale) continue;
+      *error = Error::RECEIVE;
+      return 0;
+    }
+    *end = '\0';
+    int status = 0;
+    if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1 || status <= 0) {
+      close_socket_();
+      *error = Error::PARSE;
+      return 0;
+    }
+    const char *cl = find_header(buf, "Content-Length");
+    const char *te = find_header(buf, "Transfer-Encoding");
+    const char *conn = find_header(buf, "Connection");
+    const bool chunked = te != nullptr && strncasecmp(te, "chunked", 7) == 0;
+    const bool keep = conn == nullptr || strncasecmp(conn, "close", 5) != 0;
+    const long content_length = cl != nullptr ? strtol(cl, nullptr, 10) : -1;
+
+    // Body: keep the first body_size - 1 bytes, drain the rest so the
+    // connection stays usable. Chunked bodies are kept raw (the state match
+    // does not care about chunk-size lines) and end at "0\r\n\r\n".
+    size_t total = 0, kept = 0;
+    char tail[5] = {0};
+    auto take = [&](const char *p, size_t n) {
+      const size_t k = std::min(n, body_size - 1 - kept);
+      memcpy(body + kept, p, k);
+      kept += k;
+      total += n;
+      for (size_t i = 0; i < n; i++) {
+        memmove(tail, tail + 1, sizeof(tail) - 1);
+        tail[sizeof(tail) - 1] = p[i];
+      }
+    };
+    auto done = [&]() {
+      if (chunked) return memcmp(tail, "0\r\n\r\n", 5) == 0;
+      return content_length >= 0 && (long) total >= content_length;
+    };
+    take(end + 4, len - (size_t) (end + 4 - buf));
+    bool complete = done();
+    while (!complete) {
+      const ssize_t r = recv(sock_, buf, sizeof(buf), 0);
+      if (r <= 0) {
+        // Without length or chunking the body ends with the connection
+        complete = r == 0 && !chunked && content_length < 0;
+        break;
+      }
+      take(buf, (size_t) r);
+      complete = done();
+    }
+    body[kept] = '\0';
+    if (!complete) {
+      close_socket_();
+      *error = Error::RECEIVE;
+      return 0;
+    }
+    if (!keep || (!chunked && content_length < 0)) close_socket_();
+    *error = Error::NONE;
+    return status;
+  }
+  *error = Error::RECEIVE;
+  return 0;
+}
+#endif
+
+}  // namespace esphome_hotcirc
+}  // namespace esphome
@@ -0,0 +1,168 @@
+#pragma once
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/components/switch/switch.h"
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#ifdef USE_ESP_IDF
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+namespace esphome {
+namespace esphome_hotcirc {
+
+// Pump switch for an ESPHome smart plug, driven over the plug's web_server
+// REST API (POST <relay_path>/turn_on | turn_off, GET <relay_path> for the
+// read-back, e.g. {"id":"switch-relay","state":"ON","value":true}).
+//
+// Replaces the template switch + http_request.post of the plug variants,
+// which opened a new TCP connection per command and blocked the main loop
+// (run_pump()/stop_pump() and with them pump_control()'s MAX_RUN_TIME check)
+// for up to the HTTP timeout. Here write_state() only records the desired
+// state and wakes a worker task, which
+//  - keeps one HTTP/1.1 keep-alive connection open, so a command costs one
+//    round trip (a stale connection is reopened once without counting as a
+//    failure),
+//  - always sends the LATEST desired state: ON/OFF toggles issued while a
+//    request is in flight or being retried merge into one command,
+//  - retries a failed command max_retries times with backoff, then again on
+//    every verify tick,
+//  - subscribes to the plug's event stream (GET /events) and re-sends
+//    within one round trip when the plug reports a state that differs from
+//    the commanded one (plug rebooted, switched at the plug, lost command),
+//  - reads the relay back every verify_interval as a slow fallback and
+//    re-sends on mismatch (controller is master; was check_smart_plug_script).
+// A mismatch is also published as the switch state until the re-sent
+// command is confirmed, which is how HotWaterController learns about it.
+// The tasks never touch ESPHome state or the logger: their results are
+// applied in loop() (log, connected sensor, request callbacks). The switch
+// is optimistic like the template switch it replaces and always starts OFF.
+class SmartPlugSwitch : public switch_::Switch, public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::AFTER_WIFI; }
+
+  // Plug address; may change at runtime (IP text input). Empty = no plug
+  // configured, commands stay pending until one is set.
+  void set_host(const std::string &host);
+  void set_port(uint16_t port) { port_ = port; }
+  void set_relay_path(const std::string &path) { relay_path_ = path; }
+  void set_request_timeout(uint32_t ms) { timeout_ms_ = ms; }
+  void set_max_retries(uint8_t n) { max_retries_ = n; }
+  void set_verify_interval(uint32_t ms) { verify_interval_ms_ = ms; }  // 0 = no periodic read-back
+  void set_offline_threshold(uint8_t n) { offline_threshold_ = n; }
+  void set_events(bool events) { events_ = events; }  // subscribe to the plug's /events stream
+  void set_connected_sensor(binary_sensor::BinarySensor *s) { connected_sensor_ = s; }
+
+  // Queue a read-back now (e.g. a "Test Smart Plug" button); non-blocking.
+  void verify();
+  // Hand a state to the worker without publishing it; safe from any task
+  // (HotWaterController's control task). The owner publishes the state later
+  // from the main loop. Repeating the pending state sends nothing new.
+  void request_state(bool state);
+  // Reachable: fewer than offline_threshold consecutive failed requests.
+  bool is_connected() const { return connected_; }
+  // Last relay state read back from the plug: -1 unknown, 0 OFF, 1 ON.
+  int8_t get_plug_state() const { return plug_state_; }
+  std::string get_host() const;
+
+  // Called from loop() once per finished request: success and round trip in
+  // microseconds (e.g. for profile_record(ProfileChannel::HTTP, ...)).
+  void add_on_request_callback(std::function<void(bool, uint32_t)> &&callback) {
+    request_callback_.add(std::move(callback));
+  }
+
+ protected:
+  void write_state(bool state) override;
+
+  enum class Op : uint8_t { COMMAND, VERIFY, EVENT };
+  enum class Error : uint8_t { NONE, NO_HOST, CONNECT, SEND, RECEIVE, STATUS, PARSE };
+  // One finished request, handed from the worker to loop()
+  struct Result {
+    Op op;
+    Error error;
+    bool state;       // COMMAND: state sent; VERIFY / EVENT: state reported
+    bool mismatch;    // VERIFY / EVENT: differs from the desired state, re-sending
+    uint8_t attempt;  // COMMAND: 1-based attempt number
+    int16_t status;   // HTTP status, 0 = none
+    uint32_t rtt_us;
+  };
+  static constexpr uint8_t RESULT_QUEUE = 8;
+  static constexpr size_t RESPONSE_BUF = 512;
+  static constexpr uint32_t EVENT_STALL_MS = 30000;  // No message (not even a ping): reconnect
+  static constexpr uint32_t EVENT_NO_STREAM_MS = 300000;  // Retry period when /events is not served
+
+  static const char *error_str_(Error e);
+  static bool parse_state_(const char *json, bool *state);  // "value":true|false
+  void push_result_(const Result &r);
+  void wake_worker_();
+
+#ifdef USE_ESP_IDF
+  static void worker_entry_(void *arg);
+  void worker_();
+  bool send_command_(const std::string &host, bool state, uint8_t attempt);
+  void read_back_(const std::string &host);
+  void reconcile_(Result &r);
+  // One request on the keep-alive connection. Returns the HTTP status (0 =
+  // transport error, see *error); the body is truncated to body_size - 1.
+  int request_(const std::string &host, const char *method, const std::string &path, char *body,
+               size_t body_size, Error *error);
+  bool ensure_connected_(const std::string &host, Error *error);
+  int open_socket_(const std::string &host, uint32_t recv_timeout_ms, Error *error);
+  void close_socket_();
+  static void event_entry_(void *arg);
+  void event_task_();
+  // Reads the event stream until it ends or the host changes; true once it
+  // delivered a message.
+  bool stream_events_(const std::string &host, Error *error);
+
+  // Worker only
+  TaskHandle_t worker_task_{nullptr};
+  int sock_{-1};
+  std::string conn_host_;   // Host the open socket belongs to
+  std::string last_host_;   // Host the acked state was sent to
+  uint32_t acked_gen_{0};   // Last desired_gen_ the plug confirmed
+#endif
+  std::string event_id_;    // Relay entity id in event messages, from relay_path_
+
+  uint16_t port_{80};
+  std::string relay_path_{"/switch/relay"};
+  uint32_t timeout_ms_{1000};
+  uint8_t max_retries_{3};
+  uint32_t verify_interval_ms_{60000};
+  uint8_t offline_threshold_{2};
+  bool events_{true};
+  binary_sensor::BinarySensor *connected_sensor_{nullptr};
+
+  // Main loop -> worker
+  std::atomic<bool> desired_{false};
+  std::atomic<uint32_t> desired_gen_{0};  // Bumped on every write_state()
+  std::atomic<bool> verify_requested_{false};
+  // Event task -> worker: latest relay state from the event stream
+  std::atomic<bool> event_state_{false};
+  std::atomic<bool> event_pending_{false};
+
+  // Shared, guarded by lock_
+  mutable std::mutex lock_;
+  std::string host_;
+  Result results_[RESULT_QUEUE]{};
+  uint8_t result_head_{0};
+  uint8_t result_count_{0};
+  uint8_t results_dropped_{0};
+  std::atomic<bool> results_ready_{false};  // Lets loop() skip the lock
+
+  // Main loop only
+  bool connected_{false};
+  uint8_t fail_streak_{0};
+  int8_t plug_state_{-1};
+  CallbackManager<void(bool, uint32_t)> request_callback_;
+};
+
+}  // namespace esphome_hotcirc
+}  // namespace esphome
@@ -0,0 +1,72 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import binary_sensor, switch
+from esphome.const import (
+    CONF_PORT,
+    CONF_TIMEOUT,
+    DEVICE_CLASS_CONNECTIVITY,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+from . import esphome_hotcirc_ns
+
+# Smart-plug pump switch: keep-alive HTTP to an ESPHome plug's web_server
+# REST API from a worker task, so a slow plug never blocks the main loop
+DEPENDENCIES = ["network"]
+AUTO_LOAD = ["binary_sensor"]
+
+SmartPlugSwitch = esphome_hotcirc_ns.class_("SmartPlugSwitch", switch.Switch, cg.Component)
+
+CONF_HOST = "host"
+CONF_RELAY_PATH = "relay_path"
+CONF_MAX_RETRIES = "max_retries"
+CONF_VERIFY_INTERVAL = "verify_interval"
+CONF_OFFLINE_THRESHOLD = "offline_threshold"
+CONF_CONNECTED = "connected"
+CONF_EVENTS = "events"
+
+CONFIG_SCHEMA = cv.All(
+    switch.switch_schema(SmartPlugSwitch, block_inverted=True)
+    .extend({
+        # Optional: the variants set it at runtime from the IP text input
+        cv.Optional(CONF_HOST): cv.string_strict,
+        cv.Optional(CONF_PORT, default=80): cv.port,
+        cv.Optional(CONF_RELAY_PATH, default="/switch/relay"): cv.string_strict,
+        cv.Optional(CONF_TIMEOUT, default="1s"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(milliseconds=100))
+        ),
+        cv.Optional(CONF_MAX_RETRIES, default=3): cv.int_range(min=1, max=10),  # attempts per command
+        # Subscribe to the plug's /events stream: mismatches are fixed within
+        # one round trip, the read-back below is then only a slow fallback
+        cv.Optional(CONF_EVENTS, default=True): cv.boolean,
+        # Relay read-back / reconciliation; 0s = off
+        cv.Optional(CONF_VERIFY_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+        # Consecutive failed requests before the plug counts as offline
+        cv.Optional(CONF_OFFLINE_THRESHOLD, default=2): cv.int_range(min=1, max=10),
+        cv.Optional(CONF_CONNECTED): binary_sensor.binary_sensor_schema(
+            device_class=DEVICE_CLASS_CONNECTIVITY,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            icon="mdi:lan-connect",
+        ),
+    })
+    .extend(cv.COMPONENT_SCHEMA),
+    cv.only_with_esp_idf,
+)
+
+
+async def to_code(config):
+    var = await switch.new_switch(config)
+    await cg.register_component(var, config)
+
+    if CONF_HOST in config:
+        cg.add(var.set_host(config[CONF_HOST]))
+    cg.add(var.set_port(config[CONF_PORT]))
+    cg.add(var.set_relay_path(config[CONF_RELAY_PATH]))
+    cg.add(var.set_request_timeout(config[CONF_TIMEOUT]))
+    cg.add(var.set_max_retries(config[CONF_MAX_RETRIES]))
+    cg.add(var.set_verify_interval(config[CONF_VERIFY_INTERVAL]))
+    cg.add(var.set_offline_threshold(config[CONF_OFFLINE_THRESHOLD]))
+    cg.add(var.set_events(config[CONF_EVENTS]))
+    if CONF_CONNECTED in config:
+        sens = await binary_sensor.new_binary_sensor(config[CONF_CONNECTED])
+        cg.add(var.set_connected_sensor(sens))
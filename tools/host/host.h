@@ -0,0 +1,20 @@
+#pragma once
+// Simulated hardware clock for the host build. millis()/micros() and
+// RealTimeClock::now() read these; the replay advances them explicitly.
+#include <cstdint>
+#include <ctime>
+
+namespace esphome {
+namespace host {
+
+void set_uptime_us(uint64_t us);
+uint64_t uptime_us();
+// Wall clock at uptime 0 (UTC, 0 = RTC not synced yet).
+void set_epoch_base(time_t epoch);
+time_t epoch_now();
+// Forget everything saved to the (per thread) RAM preferences, so the next
+// controller starts from an empty flash.
+void reset_preferences();
+
+}  // namespace host
+}  // namespace esphome
@@ -0,0 +1,80 @@
+// Host implementations of the ESPHome symbols the controller links against:
+// clock, RAM-backed preferences, setup priorities and RealTimeClock::now().
+// Clock and preferences are per thread, so the sweep can run one controller
+// per worker thread.
+#include "host.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/time/real_time_clock.h"
+
+#include <map>
+#include <memory>
+
+namespace esphome {
+
+namespace host {
+int log_level = 0;
+
+static thread_local uint64_t uptime_us_ = 0;
+static thread_local time_t epoch_base_ = 0;
+
+void set_uptime_us(uint64_t us) { uptime_us_ = us; }
+uint64_t uptime_us() { return uptime_us_; }
+void set_epoch_base(time_t epoch) { epoch_base_ = epoch; }
+time_t epoch_now() { return epoch_base_ ? epoch_base_ + (time_t) (uptime_us_ / 1000000) : 0; }
+}  // namespace host
+
+uint32_t millis() { return (uint32_t) (host::uptime_us_ / 1000); }
+uint32_t micros() { return (uint32_t) host::uptime_us_; }
+void delay(uint32_t ms) { host::uptime_us_ += (uint64_t) ms * 1000; }
+
+namespace {
+struct RamBackend : ESPPreferenceBackend {
+  std::vector<uint8_t> data;
+  bool save(const uint8_t *d, size_t l) override {
+    data.assign(d, d + l);
+    return true;
+  }
+  bool load(uint8_t *d, size_t l) override {
+    if (data.size() != l) return false;
+    memcpy(d, data.data(), l);
+    return true;
+  }
+};
+
+// One slot per (type hash, length), like the real NVS/flash backends.
+struct RamPreferences : ESPPreferences {
+  std::map<uint64_t, std::unique_ptr<RamBackend>> slots;
+  ESPPreferenceObject make_preference(size_t length, uint32_t type, bool) override {
+    return make_preference(length, type);
+  }
+  ESPPreferenceObject make_preference(size_t length, uint32_t type) override {
+    auto &slot = slots[((uint64_t) type << 32) | length];
+    if (!slot) slot.reset(new RamBackend());
+    return ESPPreferenceObject(slot.get());
+  }
+  bool sync() override { return true; }
+};
+thread_local RamPreferences ram_preferences;
+}  // namespace
+
+thread_local ESPPreferences *global_preferences = &ram_preferences;
+
+void host::reset_preferences() { ram_preferences.slots.clear(); }
+
+namespace setup_priority {
+const float HARDWARE = 800.0f;
+const float DATA = 600.0f;
+const float PROCESSOR = 400.0f;
+const float AFTER_WIFI = 200.0f;
+const float LATE = -100.0f;
+}  // namespace setup_priority
+
+// The replay runs with TZ=UTC, so from_epoch_local() is UTC wall time.
+ESPTime time::RealTimeClock::now() {
+  const time_t epoch = host::epoch_now();
+  return epoch ? ESPTime::from_epoch_local(epoch) : ESPTime{};
+}
+
+}  // namespace esphome
@@ -0,0 +1,462 @@
+// Host replay harness for HotWaterController.
+//
+// Compiles the unmodified component against the stubs in stubs/ and drives it
+// with a simulated clock, so detector / pump-control changes can be measured
+// before flashing. Input is one of
+//   - a trace download from the device (/hotcirc/trace.bin, format "HCT1"),
+//   - a CSV of samples:  t_s,outlet,return[,tap]  (empty field = no sample),
+//   - --synth DAYS: a closed-loop plant model with randomized tap draws.
+// Reports detection latency (tap open -> WATER_DRAW pump start), missed draws,
+// false positives and pump runtime per trigger. See tools/host/README.md.
+#include "sim.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using esphome_hotcirc::HotWaterController;
+using esphome_hotcirc::EnergyPeriod;
+using esphome_hotcirc::ENERGY_TRIGGERS;
+using PumpTrigger = HotWaterController::PumpTrigger;
+using host::DEFAULT_EPOCH;
+using host::Draw;
+using host::PumpRun;
+using host::ReplayClock;
+using host::ReplayPump;
+using host::Source;
+using host::STEP_MS;
+using host::SynthSource;
+using host::percentile;
+
+namespace {
+
+constexpr uint64_t MATCH_WINDOW_MS = 90000;  // pump start up to 90 s after tap close still counts
+constexpr uint64_t RECENT_RUN_MS = 1800000;  // HotWaterController::USER_REQUEST_MAX_AGE
+
+struct Options {
+  const char *input{nullptr};
+  double synth_days{0};
+  const char *draw_profile{nullptr};  // --synth: recorded draws instead of the Poisson pattern
+  uint32_t seed{1};
+  time_t epoch{0};
+  float outlet_rise{1.5f};
+  float return_rise{1.5f};
+  float disinfection_rise{10.0f};
+  float min_return{30.0f};
+  esphome_hotcirc::DrawDetector detector{esphome_hotcirc::DrawDetector::CLASSIC};
+  uint8_t slope_window{6};
+  float slope_min_rate{0.05f};
+  float slope_min_t{5.0f};
+  size_t filter_window{3};
+  esphome_hotcirc::StopMode stop_mode{esphome_hotcirc::StopMode::THRESHOLD};
+  float return_lag_s{-1.0f};  // < 0: calibrated, else 10 s
+  float loop_volume{0.0f};
+  bool calibrate{false};
+  int eco{120};               // SCHEDULE_THRESHOLD (ECO slider)
+  float auto_tune{0.0f};      // schedule_stats auto_tune target, 0 = off
+  bool list_events{false};
+  float sampling_idle_s{0.0f};  // adaptive_sampling idle_interval, 0 = off (fixed 1 s)
+  bool pulsed{false};           // pulsed_circulation (needs --calibrate, bursts use the transit time)
+  float pulse_soak_s{10.0f};    // pulsed_circulation soak
+  bool fast_return{false};      // synthetic pump NTC as fast_temperature_sensor (fuse: return)
+  float fast_tau_s{60.0f};      // fast_temperature_tau
+};
+
+// Open-loop replay of recorded samples. The recorded return temperature
+// reflects what the pump did on the device, not what the replayed controller
+// decides - runtime figures are only meaningful while both agree.
+class RecordedSource : public Source {
+ public:
+  struct Sample {
+    uint64_t t_ms;
+    bool is_return;
+    float value;
+  };
+
+  void step(uint64_t now_ms, bool) override {
+    while (next_ < samples.size() && samples[next_].t_ms <= now_ms) {
+      const Sample &s = samples[next_++];
+      (s.is_return ? ret : outlet).publish_state(s.value);
+      published++;
+    }
+  }
+  bool done(uint64_t) const override { return next_ >= samples.size(); }
+  const char *describe() const override { return label.c_str(); }
+
+  std::vector<Sample> samples;
+  std::string label;
+
+ protected:
+  size_t next_{0};
+};
+
+bool load_trace_bin(const char *path, RecordedSource &src) {
+  std::ifstream f(path, std::ios::binary);
+  uint32_t header[6];
+  if (!f.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != 0x31544348u) return false;
+  if ((header[1] & 0xFFFF) != 1 || (header[1] >> 16) != sizeof(esphome_hotcirc::TraceRecord)) {
+    std::fprintf(stderr, "%s: unsupported trace version/record size\n", path);
+    return false;
+  }
+  std::vector<esphome_hotcirc::TraceRecord> recs(header[2]);
+  f.read(reinterpret_cast<char *>(recs.data()), recs.size() * sizeof(recs[0]));
+  recs.resize(f.gcount() / sizeof(recs[0]));
+  if (recs.empty()) return false;
+
+  // Uptime at the first record becomes replay time 0.
+  const uint32_t t0 = recs.front().t_ds;
+  if (header[5] != 0) src.epoch_base = (time_t) header[5] - (time_t) ((header[4] - t0) / 10);
+
+  // No tap ground truth on the device: the reference is the recorded
+  // detector itself (start of every rise it later confirmed).
+  uint64_t candidate_ms = 0;
+  bool have_candidate = false;
+  for (const auto &r : recs) {
+    const uint64_t t_ms = (uint64_t) (r.t_ds - t0) * 100;
+    switch ((esphome_hotcirc::TraceEvent) r.type) {
+      case esphome_hotcirc::TraceEvent::OUTLET:
+      case esphome_hotcirc::TraceEvent::RETURN:
+        src.samples.push_back({t_ms, r.type == (uint8_t) esphome_hotcirc::TraceEvent::RETURN,
+                               r.value == INT16_MIN ? NAN : r.value / 100.0f});
+        break;
+      case esphome_hotcirc::TraceEvent::DRAW_START:
+        candidate_ms = t_ms;
+        have_candidate = true;
+        break;
+      case esphome_hotcirc::TraceEvent::DRAW_CONFIRMED:
+        if (have_candidate) src.draws.push_back({candidate_ms, t_ms});
+        have_candidate = false;
+        break;
+      default:
+        break;
+    }
+  }
+  src.label = std::string(path) + " (reference: recorded detector)";
+  return true;
+}
+
+bool load_csv(const char *path, RecordedSource &src) {
+  std::ifstream f(path);
+  if (!f) return false;
+  std::string line;
+  bool tap = false;
+  uint64_t tap_on_ms = 0;
+  uint64_t last_ms = 0;
+  bool has_tap_column = false;
+  while (std::getline(f, line)) {
+    if (line.empty() || line[0] == '#' || !(std::isdigit((unsigned char) line[0]) || line[0] == '.')) continue;
+    std::stringstream ss(line);
+    std::string field[4];
+    for (int i = 0; i < 4 && std::getline(ss, field[i], ','); i++) {
+    }
+    const uint64_t t_ms = (uint64_t) std::llround(std::atof(field[0].c_str()) * 1000.0);
+    if (!field[1].empty()) src.samples.push_back({t_ms, false, (float) std::atof(field[1].c_str())});
+    if (!field[2].empty()) src.samples.push_back({t_ms, true, (float) std::atof(field[2].c_str())});
+    if (!field[3].empty()) {
+      has_tap_column = true;
+      const bool now_tap = std::atoi(field[3].c_str()) != 0;
+      if (now_tap && !tap) tap_on_ms = t_ms;
+      if (!now_tap && tap) src.draws.push_back({tap_on_ms, t_ms});
+      tap = now_tap;
+    }
+    last_ms = t_ms;
+  }
+  if (tap) src.draws.push_back({tap_on_ms, last_ms});
+  std::stable_sort(src.samples.begin(), src.samples.end(),
+                   [](const RecordedSource::Sample &a, const RecordedSource::Sample &b) { return a.t_ms < b.t_ms; });
+  src.label = std::string(path) + (has_tap_column ? " (reference: tap column)" : " (no tap column)");
+  return !src.samples.empty();
+}
+
+void usage() {
+  std::fprintf(stderr,
+               "usage: replay [options] <trace.bin | samples.csv>\n"
+               "       replay [options] --synth DAYS\n"
+               "  --seed N           synthetic draw pattern seed (default 1)\n"
+               "  --draws FILE       synthetic plant: draw profile t_s,duration_s (repeats weekly)\n"
+               "  --epoch SECONDS    wall clock at replay start (default: trace header, else 2026-01-05)\n"
+               "  --outlet-rise K    outlet_rise_threshold (default 1.5)\n"
+               "  --return-rise K    return_rise_threshold (default 1.5)\n"
+               "  --min-return C     min_return_temp (default 30)\n"
+               "  --detector NAME    classic (default) or slope\n"
+               "  --slope-window N   draw_slope_window in samples (default 6)\n"
+               "  --slope-rate R     draw_slope_min_rate in C/s (default 0.05)\n"
+               "  --slope-t T        draw_slope_min_t (default 5)\n"
+               "  --stop-mode NAME   threshold (default) or predictive\n"
+               "  --return-lag S     return_sensor_lag in seconds (default: calibrated, else 10)\n"
+               "  --calibrate        run start_calibration() 2 min into the replay\n"
+               "  --loop-volume L    loop_volume in litres (flow rate from calibration)\n"
+               "  --eco N            ECO level / SCHEDULE_THRESHOLD (default 120)\n"
+               "  --auto-tune RATE   schedule_stats auto_tune with this target hit rate (0..1)\n"
+               "  --filter-window N  outlet/return moving average as in the YAML (default 3, 1 = off)\n"
+               "  --adaptive-sampling S  synthetic sensors: S s idle, 1 s fast (adaptive_sampling)\n"
+               "  --pulsed [SOAK_S]  pulsed_circulation (with --calibrate; soak default 10 s)\n"
+               "  --fast-return      synthetic pump NTC as fast_temperature_sensor, fused with the return\n"
+               "  --fast-tau S       fast_temperature_tau in seconds (default 60)\n"
+               "  --events           list every draw and pump run\n"
+               "  -v                 controller log level, repeat for more (E/W/I/D/V)\n");
+}
+
+bool parse_args(int argc, char **argv, Options &o) {
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    auto value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+    const char *v = nullptr;
+    if (!std::strcmp(a, "--synth") && (v = value())) {
+      o.synth_days = std::atof(v);
+    } else if (!std::strcmp(a, "--draws") && (v = value())) {
+      o.draw_profile = v;
+    } else if (!std::strcmp(a, "--seed") && (v = value())) {
+      o.seed = (uint32_t) std::strtoul(v, nullptr, 10);
+    } else if (!std::strcmp(a, "--epoch") && (v = value())) {
+      o.epoch = (time_t) std::strtoll(v, nullptr, 10);
+    } else if (!std::strcmp(a, "--outlet-rise") && (v = value())) {
+      o.outlet_rise = std::atof(v);
+    } else if (!std::strcmp(a, "--return-rise") && (v = value())) {
+      o.return_rise = std::atof(v);
+    } else if (!std::strcmp(a, "--min-return") && (v = value())) {
+      o.min_return = std::atof(v);
+    } else if (!std::strcmp(a, "--detector") && (v = value())) {
+      if (!std::strcmp(v, "slope")) {
+        o.detector = esphome_hotcirc::DrawDetector::SLOPE;
+      } else if (std::strcmp(v, "classic")) {
+        return false;
+      }
+    } else if (!std::strcmp(a, "--slope-window") && (v = value())) {
+      o.slope_window = (uint8_t) std::atoi(v);
+    } else if (!std::strcmp(a, "--slope-rate") && (v = value())) {
+      o.slope_min_rate = std::atof(v);
+    } else if (!std::strcmp(a, "--slope-t") && (v = value())) {
+      o.slope_min_t = std::atof(v);
+    } else if (!std::strcmp(a, "--stop-mode") && (v = value())) {
+      if (!std::strcmp(v, "predictive")) {
+        o.stop_mode = esphome_hotcirc::StopMode::PREDICTIVE;
+      } else if (std::strcmp(v, "threshold")) {
+        return false;
+      }
+    } else if (!std::strcmp(a, "--return-lag") && (v = value())) {
+      o.return_lag_s = std::atof(v);
+    } else if (!std::strcmp(a, "--calibrate")) {
+      o.calibrate = true;
+    } else if (!std::strcmp(a, "--eco") && (v = value())) {
+      o.eco = std::atoi(v);
+    } else if (!std::strcmp(a, "--auto-tune") && (v = value())) {
+      o.auto_tune = std::atof(v);
+    } else if (!std::strcmp(a, "--loop-volume") && (v = value())) {
+      o.loop_volume = std::atof(v);
+    } else if (!std::strcmp(a, "--filter-window") && (v = value())) {
+      o.filter_window = (size_t) std::atoi(v);
+    } else if (!std::strcmp(a, "--adaptive-sampling") && (v = value())) {
+      o.sampling_idle_s = std::atof(v);
+    } else if (!std::strcmp(a, "--pulsed")) {
+      o.pulsed = true;
+      if (i + 1 < argc && std::isdigit((unsigned char) argv[i + 1][0])) o.pulse_soak_s = std::atof(argv[++i]);
+    } else if (!std::strcmp(a, "--fast-return")) {
+      o.fast_return = true;
+    } else if (!std::strcmp(a, "--fast-tau") && (v = value())) {
+      o.fast_tau_s = std::atof(v);
+    } else if (!std::strcmp(a, "--events")) {
+      o.list_events = true;
+    } else if (!std::strncmp(a, "-v", 2) && a[strspn(a + 1, "v") + 1] == '\0') {
+      host::log_level += (int) std::strlen(a) - 1;
+    } else if (a[0] != '-' && o.input == nullptr) {
+      o.input = a;
+    } else {
+      return false;
+    }
+  }
+  return o.input != nullptr || o.synth_days > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_args(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  std::unique_ptr<Source> src;
+  if (opt.synth_days > 0 && opt.draw_profile != nullptr) {
+    std::vector<Draw> profile;
+    uint64_t period_ms = 0;
+    if (!host::load_draw_profile(opt.draw_profile, profile, &period_ms)) {
+      std::fprintf(stderr, "%s: cannot read draws\n", opt.draw_profile);
+      return 1;
+    }
+    src.reset(new SynthSource(opt.synth_days, opt.seed, profile, period_ms, opt.draw_profile));
+  } else if (opt.synth_days > 0) {
+    src.reset(new SynthSource(opt.synth_days, opt.seed));
+  } else {
+    auto *rec = new RecordedSource();
+    src.reset(rec);
+    const size_t n = std::strlen(opt.input);
+    const bool is_bin = n > 4 && !std::strcmp(opt.input + n - 4, ".bin");
+    if (!(is_bin ? load_trace_bin(opt.input, *rec) : load_csv(opt.input, *rec))) {
+      std::fprintf(stderr, "%s: cannot read samples\n", opt.input);
+      return 1;
+    }
+  }
+  host::set_uptime_us(0);
+  host::set_epoch_base(opt.epoch ? opt.epoch : (src->epoch_base ? src->epoch_base : DEFAULT_EPOCH));
+
+  HotWaterController controller;
+  ReplayPump pump(&controller);
+  ReplayClock clock;
+  controller.set_outlet_sensor(&src->outlet);
+  controller.set_return_sensor(&src->ret);
+  controller.set_pump_switch(&pump);
+  controller.set_time_source(&clock);
+  controller.set_thresholds(opt.outlet_rise, opt.return_rise, opt.disinfection_rise, opt.min_return);
+  controller.set_draw_detector(opt.detector, opt.slope_window, opt.slope_min_rate, opt.slope_min_t);
+  controller.set_stop_mode(opt.stop_mode, opt.return_lag_s);
+  controller.set_loop_volume(opt.loop_volume);
+  controller.SCHEDULE_THRESHOLD = (uint8_t) opt.eco;
+  if (opt.auto_tune > 0.0f) controller.set_schedule_auto_tune(opt.auto_tune, 5, 60, 240);
+  if (opt.sampling_idle_s > 0)
+    controller.set_adaptive_sampling(&src->outlet_poller, &src->ret_poller, (uint32_t) (opt.sampling_idle_s * 1000),
+                                     1000, 60000);
+  if (opt.pulsed) controller.set_pulsed_circulation((uint32_t) (opt.pulse_soak_s * 1000), 0.05f);
+  if (opt.fast_return && opt.synth_days > 0) {
+    src->fast_enabled = true;
+    controller.set_fast_sensor(&src->fast, esphome_hotcirc::FuseTarget::RETURN, opt.fast_tau_s);
+  }
+  src->outlet.host_set_moving_average(opt.filter_window);
+  src->ret.host_set_moving_average(opt.filter_window);
+  controller.setup();
+
+  const auto wall_start = std::chrono::steady_clock::now();
+  uint64_t now_ms = 0;
+  uint64_t loops = 0;
+  while (!src->done(now_ms)) {
+    now_ms += STEP_MS;
+    host::set_uptime_us(now_ms * 1000);
+    src->step(now_ms, pump.state);
+    if (opt.calibrate && now_ms == 120000) controller.start_calibration();
+    controller.loop();
+    loops++;
+  }
+  if (!pump.runs.empty() && pump.runs.back().off_ms == 0) {
+    if (pump.state) pump.runs.back().pumped_ms += now_ms - pump.runs.back().burst_on_ms;
+    pump.runs.back().off_ms = now_ms;
+  }
+  const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+  // Match WATER_DRAW starts to draws: a start belongs to the earliest
+  // unmatched draw whose [tap open, tap close + window] contains it.
+  std::vector<bool> matched(src->draws.size(), false);
+  std::vector<double> latency_s;
+  uint32_t false_positives = 0;
+  for (const auto &run : pump.runs) {
+    if (run.trigger != PumpTrigger::WATER_DRAW) continue;
+    bool hit = false;
+    for (size_t i = 0; i < src->draws.size() && src->draws[i].on_ms <= run.on_ms; i++) {
+      if (!matched[i] && run.on_ms <= src->draws[i].off_ms + MATCH_WINDOW_MS) {
+        matched[i] = true;
+        latency_s.push_back((run.on_ms - src->draws[i].on_ms) / 1000.0);
+        hit = true;
+        break;
+      }
+    }
+    if (!hit) false_positives++;
+  }
+  // A draw that starts while the pump runs, or within USER_REQUEST_MAX_AGE
+  // of the last run, needs no run: the loop is still hot and the controller
+  // deliberately skips the request.
+  uint32_t masked = 0, missed = 0;
+  for (size_t i = 0; i < src->draws.size(); i++) {
+    if (matched[i]) continue;
+    bool loop_hot = false;
+    for (const auto &run : pump.runs) {
+      if (run.on_ms <= src->draws[i].on_ms && src->draws[i].on_ms < run.off_ms + RECENT_RUN_MS) loop_hot = true;
+    }
+    loop_hot ? masked++ : missed++;
+  }
+
+  const double sim_s = now_ms / 1000.0;
+  const double days = sim_s / 86400.0;
+  std::printf("replay: %s\n", src->describe());
+  std::printf("  simulated       %.0f s in %.3f s wall (%.0fx real time, %llu loop passes)\n", sim_s, wall_s,
+              wall_s > 0 ? sim_s / wall_s : 0.0, (unsigned long long) loops);
+  std::printf("  draws           %zu (%u masked: pump running or ran < 30 min ago)\n", src->draws.size(), masked);
+  const size_t detectable = src->draws.size() - masked;
+  std::printf("  detected        %zu / %zu (%.1f %%)\n", latency_s.size(), detectable,
+              detectable ? 100.0 * latency_s.size() / detectable : 0.0);
+  std::printf("  latency         p50 %.1f s  p90 %.1f s  max %.1f s\n", percentile(latency_s, 50),
+              percentile(latency_s, 90), percentile(latency_s, 100));
+  std::printf("  missed          %u\n", missed);
+  std::printf("  false positives %u (%.2f / day)\n", false_positives, days > 0 ? false_positives / days : 0.0);
+  std::vector<double> wait_s;
+  for (const auto &d : src->draws) {
+    if (!std::isnan(d.wait_s)) wait_s.push_back(d.wait_s);
+  }
+  if (!wait_s.empty()) {
+    double sum = 0;
+    for (double w : wait_s) sum += w;
+    std::printf("  hot water wait  mean %.1f s  p90 %.1f s  (%.0f %% of draws hot at once)\n", sum / wait_s.size(),
+                percentile(wait_s, 90),
+                100.0 * std::count_if(wait_s.begin(), wait_s.end(), [](double w) { return w < 1.0; }) / wait_s.size());
+  }
+  std::printf("  sensor readings %llu (%.1f / min)\n", (unsigned long long) src->published,
+              sim_s > 0 ? src->published * 60.0 / sim_s : 0.0);
+
+  double total_s = 0;
+  double per_trigger_s[16] = {0};
+  uint32_t per_trigger_n[16] = {0};
+  for (const auto &run : pump.runs) {
+    const double s = run.pumped_ms / 1000.0;
+    total_s += s;
+    per_trigger_s[(int) run.trigger & 15] += s;
+    per_trigger_n[(int) run.trigger & 15]++;
+  }
+  std::printf("  pump runtime    %.0f s total, %.0f s / day, %zu cycles, %.3f kWh\n", total_s,
+              days > 0 ? total_s / days : 0.0, pump.runs.size(), controller.get_energy_kwh(EnergyPeriod::LIFETIME));
+  for (int i = 0; i < 16; i++) {
+    if (per_trigger_n[i] == 0) continue;
+    std::printf("    %-25s %5u cycles %8.0f s (%.1f s / cycle) %8.3f kWh\n",
+                HotWaterController::trigger_to_str_((PumpTrigger) i), per_trigger_n[i], per_trigger_s[i],
+                per_trigger_s[i] / per_trigger_n[i],
+                i < ENERGY_TRIGGERS ? controller.get_energy_kwh(EnergyPeriod::LIFETIME, (int8_t) i) : 0.0f);
+  }
+
+  const float hit_rate = controller.get_schedule_hit_rate();
+  if (!std::isnan(hit_rate))
+    std::printf("  scheduled       hit rate %.0f %%, wasted %.3f kWh, threshold %u\n", hit_rate * 100.0f,
+                controller.get_schedule_wasted_kwh(), controller.get_schedule_threshold());
+
+  if (controller.has_calibration()) {
+    const auto &c = controller.get_calibration();
+    char flow[16] = "n/a";  // no loop_volume configured
+    if (!std::isnan(c.flow_lpm)) std::snprintf(flow, sizeof(flow), "%.2f L/min", c.flow_lpm);
+    std::printf("  calibration     dead time %.1f s, rise tau %.1f s, heat-up %.1f s, rise %.2f K, flow %s\n",
+                c.dead_time_s, c.rise_tau_s, c.heatup_s, c.total_rise, flow);
+  }
+
+  if (opt.list_events) {
+    for (size_t i = 0; i < src->draws.size(); i++) {
+      std::printf("draw %8.1f s .. %8.1f s%s\n", src->draws[i].on_ms / 1000.0, src->draws[i].off_ms / 1000.0,
+                  matched[i] ? "" : "  (not detected)");
+    }
+    for (const auto &run : pump.runs) {
+      std::printf("pump %8.1f s .. %8.1f s  %s", run.on_ms / 1000.0, run.off_ms / 1000.0,
+                  HotWaterController::trigger_to_str_(run.trigger));
+      if (run.bursts > 1) std::printf("  (%u bursts, %.1f s on)", run.bursts, run.pumped_ms / 1000.0);
+      std::printf("\n");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,323 @@
+#pragma once
+// Simulation pieces shared by the host tools (replay, sweep): the sensor
+// sources with the closed-loop synthetic plant, and the pump switch that
+// records every run. See tools/host/README.md.
+#include "host.h"
+#include "esphome_hotcirc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace host {
+
+using PumpTrigger = esphome_hotcirc::HotWaterController::PumpTrigger;
+
+constexpr uint32_t STEP_MS = 100;             // loop() cadence of the simulation
+constexpr time_t DEFAULT_EPOCH = 1767571200;  // 2026-01-05 00:00 UTC, a Monday
+
+struct Draw {
+  uint64_t on_ms;
+  uint64_t off_ms;
+  float wait_s{NAN};  // SynthSource: tap open -> hot water at the tap (NAN = unresolved)
+};
+
+// ---------------------------------------------------------------------------
+// Sample sources
+
+// Stands in for the dallas_temp poller behind a sensor: adaptive sampling
+// changes its period; start_poller() re-arms it from "now" as on the device.
+class ReplayPoller : public PollingComponent {
+ public:
+  ReplayPoller() : PollingComponent(1000) {}
+  void update() override {}
+  void set_update_interval(uint32_t ms) override {
+    PollingComponent::set_update_interval(ms);
+    rearmed = true;
+  }
+  bool rearmed{false};
+};
+
+class Source {
+ public:
+  virtual ~Source() = default;
+  // Publish everything due at or before now_ms. pump_on is the actuator
+  // state, only used by the closed-loop model.
+  virtual void step(uint64_t now_ms, bool pump_on) = 0;
+  virtual bool done(uint64_t now_ms) const = 0;
+  virtual const char *describe() const = 0;
+
+  sensor::Sensor outlet;
+  sensor::Sensor ret;
+  ReplayPoller outlet_poller;  // Sample period of the synthetic sensors
+  ReplayPoller ret_poller;
+  sensor::Sensor fast;         // Pump NTC (synthetic plant only, --fast-return)
+  bool fast_enabled{false};
+  uint64_t published{0};       // Sensor readings (bus transactions)
+  std::vector<Draw> draws;  // Ground truth
+  time_t epoch_base{0};
+};
+
+// Closed-loop plant: tank, the 40 cm outlet pipe the sensor sits on, and the
+// circulation loop behind the return sensor. Both sensors are DS18B20-like
+// (1 s period, 0.0625 K steps, small noise) and lag the water by a
+// first-order thermal contact (3 s outlet, 8 s return clamp-on). The tank is reheated by the
+// boiler twice a day, which warms the outlet pipe slowly - a rise the
+// detector must NOT take for a draw.
+//
+// Hot-water wait (Draw::wait_s): the taps sit along the loop, on average
+// halfway. Once the circulating front has passed them the loop water there
+// is at tank temperature and cools over ~40 min after the pump stops. A draw
+// gets hot water at once while that water is within LOOP_HOT_MARGIN of the
+// tank, otherwise when a run makes it so, at the latest after COLD_WAIT_S of
+// running the cold pipe empty at the tap.
+class SynthSource : public Source {
+ public:
+  SynthSource(double days, uint32_t seed) : end_ms_((uint64_t) (days * 86400000.0)), rng_(seed) {
+    label_ = "synthetic plant, " + std::to_string(days) + " days, seed " + std::to_string(seed);
+    generate_draws_();
+  }
+  // Recorded household profile (load_draw_profile()) instead of the Poisson
+  // draws, repeated every `period_ms` to fill the run.
+  SynthSource(double days, uint32_t seed, const std::vector<Draw> &profile, uint64_t period_ms, const char *name)
+      : end_ms_((uint64_t) (days * 86400000.0)), rng_(seed) {
+    label_ = "synthetic plant, " + std::to_string(days) + " days, draws from " + name;
+    for (uint64_t base = 0; base < end_ms_; base += period_ms) {
+      for (const auto &d : profile) {
+        if (base + d.on_ms < end_ms_) draws.push_back({base + d.on_ms, base + d.off_ms});
+      }
+    }
+    merge_draws_();
+  }
+
+  void step(uint64_t now_ms, bool pump_on) override {
+    const float dt = (now_ms - last_ms_) / 1000.0f;
+    last_ms_ = now_ms;
+    const double tod = std::fmod(now_ms / 1000.0, 86400.0);
+
+    // Tank: loses 0.4 K/h, boiler reheats to 56 °C at 04:00 and 17:00 (20 min).
+    const bool reheat = (tod >= 4 * 3600 && tod < 4 * 3600 + 1200) || (tod >= 17 * 3600 && tod < 17 * 3600 + 1200);
+    tank_ += reheat ? std::max(0.0f, 56.0f - tank_) * dt / 300.0f : -0.4f * dt / 3600.0f;
+
+    while (draw_idx_ < draws.size() && draws[draw_idx_].off_ms <= now_ms) draw_idx_++;
+    const bool tap = draw_idx_ < draws.size() && draws[draw_idx_].on_ms <= now_ms;
+
+    // Outlet pipe: hot water flows past the sensor whenever a tap is open or
+    // the pump circulates; otherwise it settles between room and tank.
+    const float idle_eq = AMBIENT + 0.3f * (tank_ - AMBIENT);
+    if (tap || pump_on) {
+      outlet_t_ += (tank_ - 0.5f - outlet_t_) * dt / 8.0f;
+    } else {
+      outlet_t_ += (idle_eq - outlet_t_) * dt / 300.0f;
+    }
+
+    // Return: hot water arrives after the loop dead time, cools over ~40 min.
+    // The hot front stands still while the pump is off and fades as the
+    // pipe cools, so a short soak keeps a pulsed run's progress
+    pump_run_s_ = pump_on ? pump_run_s_ + dt : pump_run_s_ * std::exp(-dt / FRONT_FADE_S);
+    if (pump_on && pump_run_s_ > LOOP_DEAD_TIME_S) {
+      ret_t_ += (tank_ - 4.0f - ret_t_) * dt / 35.0f;
+    } else {
+      ret_t_ += (AMBIENT + 2.0f - ret_t_) * dt / 2400.0f;
+    }
+    if (pump_on && pump_run_s_ > LOOP_DEAD_TIME_S * TAP_POSITION) {
+      loop_t_ += (tank_ - 0.5f - loop_t_) * dt / 10.0f;
+    } else {
+      loop_t_ += (AMBIENT - loop_t_) * dt / 2400.0f;
+    }
+    track_waits_(now_ms);
+
+    outlet_sensor_t_ += (outlet_t_ - outlet_sensor_t_) * dt / OUTLET_SENSOR_TAU_S;
+    ret_sensor_t_ += (ret_t_ - ret_sensor_t_) * dt / RETURN_SENSOR_TAU_S;
+    next_sample_(outlet_poller, now_ms, next_outlet_ms_);
+    next_sample_(ret_poller, now_ms, next_return_ms_);
+    if (now_ms >= next_outlet_ms_) {
+      outlet.publish_state(quantize_(outlet_sensor_t_));
+      published++;
+      next_outlet_ms_ += outlet_poller.get_update_interval();
+    }
+    if (now_ms >= next_return_ms_) {
+      ret.publish_state(quantize_(ret_sensor_t_));
+      published++;
+      next_return_ms_ += ret_poller.get_update_interval();
+    }
+
+    // Pump NTC: in the pump housing on the return line, follows the flowing
+    // water within ~1 s, the stagnant housing slowly otherwise. ADC noise,
+    // 0.1 K resolution and a fixed curve-fit offset.
+    pump_ntc_t_ += ((pump_on ? ret_t_ : AMBIENT + 4.0f) - pump_ntc_t_) * dt / (pump_on ? 1.0f : 600.0f);
+    if (fast_enabled && now_ms >= next_fast_ms_) {
+      fast.publish_state(std::round((pump_ntc_t_ + PUMP_NTC_OFFSET + ntc_noise_(ntc_rng_)) / 0.1f) * 0.1f);
+      next_fast_ms_ += 1000;
+    }
+  }
+  bool done(uint64_t now_ms) const override { return now_ms >= end_ms_; }
+  const char *describe() const override { return label_.c_str(); }
+
+ protected:
+  static constexpr float AMBIENT = 21.0f;
+  static constexpr float LOOP_DEAD_TIME_S = 40.0f;
+  static constexpr float OUTLET_SENSOR_TAU_S = 3.0f;
+  static constexpr float RETURN_SENSOR_TAU_S = 8.0f;
+  static constexpr float PUMP_NTC_OFFSET = 1.5f;
+  static constexpr float FRONT_FADE_S = 600.0f;
+  static constexpr float TAP_POSITION = 0.5f;      // Share of the loop dead time before the taps
+  static constexpr float LOOP_HOT_MARGIN = 10.0f;  // Loop water this close to the tank counts as hot
+  static constexpr float COLD_WAIT_S = 60.0f;      // Cold loop without circulation: purge time at the tap
+
+  void track_waits_(uint64_t now_ms) {
+    const bool hot = loop_t_ >= tank_ - LOOP_HOT_MARGIN;
+    while (wait_idx_ < draws.size() && draws[wait_idx_].on_ms <= now_ms) {
+      const float waited = (now_ms - draws[wait_idx_].on_ms) / 1000.0f;
+      if (!hot && waited < COLD_WAIT_S) break;
+      draws[wait_idx_++].wait_s = hot ? waited : COLD_WAIT_S;
+    }
+  }
+
+  static void next_sample_(ReplayPoller &poller, uint64_t now_ms, uint64_t &next_ms) {
+    if (!poller.rearmed) return;
+    poller.rearmed = false;
+    next_ms = now_ms + poller.get_update_interval();
+  }
+  float quantize_(float t) { return std::round((t + noise_(rng_)) / 0.0625f) * 0.0625f; }
+
+  // Poisson draws clustered around morning, midday and evening.
+  void generate_draws_() {
+    struct Window {
+      double from_h, to_h, per_day;
+    };
+    const Window windows[] = {{6.0, 8.0, 4.0}, {12.0, 13.5, 1.5}, {18.0, 22.0, 4.0}, {0.0, 24.0, 1.0}};
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::lognormal_distribution<double> duration_s(3.4, 0.8);  // median ~30 s
+    const int days = (int) std::ceil(end_ms_ / 86400000.0);
+    for (int d = 0; d < days; d++) {
+      for (const auto &w : windows) {
+        std::poisson_distribution<int> count(w.per_day);
+        for (int n = count(rng_); n > 0; n--) {
+          const double start_s = d * 86400.0 + (w.from_h + uni(rng_) * (w.to_h - w.from_h)) * 3600.0;
+          const double len_s = std::min(300.0, std::max(5.0, duration_s(rng_)));
+          const uint64_t on = (uint64_t) (start_s * 1000.0);
+          if (on < end_ms_) draws.push_back({on, on + (uint64_t) (len_s * 1000.0)});
+        }
+      }
+    }
+    merge_draws_();
+  }
+
+  void merge_draws_() {
+    std::sort(draws.begin(), draws.end(), [](const Draw &a, const Draw &b) { return a.on_ms < b.on_ms; });
+    // Overlapping taps count as one draw.
+    std::vector<Draw> merged;
+    for (const auto &d : draws) {
+      if (!merged.empty() && d.on_ms <= merged.back().off_ms) {
+        merged.back().off_ms = std::max(merged.back().off_ms, d.off_ms);
+      } else {
+        merged.push_back(d);
+      }
+    }
+    draws.swap(merged);
+  }
+
+  uint64_t end_ms_;
+  std::mt19937 rng_;
+  std::normal_distribution<float> noise_{0.0f, 0.015f};
+  std::string label_;
+  size_t draw_idx_{0};
+  size_t wait_idx_{0};
+  uint64_t last_ms_{0};
+  uint64_t next_outlet_ms_{0};
+  uint64_t next_return_ms_{500};
+  float tank_{52.0f};
+  float outlet_t_{AMBIENT + 0.3f * (52.0f - AMBIENT)};
+  float ret_t_{AMBIENT + 2.0f};
+  float loop_t_{AMBIENT};  // Loop water at the taps
+  float outlet_sensor_t_{outlet_t_};
+  float ret_sensor_t_{ret_t_};
+  float pump_run_s_{0.0f};
+  std::mt19937 ntc_rng_{7};  // Own stream: the DS18B20 noise stays the same with or without it
+  std::normal_distribution<float> ntc_noise_{0.0f, 0.15f};
+  uint64_t next_fast_ms_{250};
+  float pump_ntc_t_{AMBIENT + 4.0f};
+};
+
+// Recorded household draw profile for SynthSource: one draw per line,
+// "t_s,duration_s" with t_s counted from Monday 00:00 (lines not starting
+// with a digit are skipped). The profile repeats in whole weeks, so weekday
+// patterns stay on their weekday; *period_ms receives that length.
+inline bool load_draw_profile(const char *path, std::vector<Draw> &draws, uint64_t *period_ms) {
+  std::ifstream f(path);
+  if (!f) return false;
+  std::string line;
+  uint64_t last_ms = 0;
+  while (std::getline(f, line)) {
+    if (line.empty() || !(std::isdigit((unsigned char) line[0]) || line[0] == '.')) continue;
+    std::stringstream ss(line);
+    std::string on, len;
+    if (!std::getline(ss, on, ',') || !std::getline(ss, len, ',')) continue;
+    const uint64_t on_ms = (uint64_t) std::llround(std::atof(on.c_str()) * 1000.0);
+    const uint64_t off_ms = on_ms + (uint64_t) std::llround(std::max(1.0, std::atof(len.c_str())) * 1000.0);
+    draws.push_back({on_ms, off_ms});
+    last_ms = std::max(last_ms, off_ms);
+  }
+  const uint64_t week_ms = 7ull * 86400000ull;
+  *period_ms = (last_ms / week_ms + 1) * week_ms;
+  return !draws.empty();
+}
+
+// ---------------------------------------------------------------------------
+// Actuator + bookkeeping
+
+struct PumpRun {
+  uint64_t on_ms;
+  uint64_t off_ms;
+  PumpTrigger trigger;
+  uint64_t pumped_ms{0};   // Relay on time; < off - on for a pulsed run
+  uint32_t bursts{1};
+  uint64_t burst_on_ms{0};
+};
+
+class ReplayPump : public switch_::Switch {
+ public:
+  explicit ReplayPump(const esphome_hotcirc::HotWaterController *controller) : controller_(controller) {}
+  std::vector<PumpRun> runs;
+
+ protected:
+  // The bursts of a pulsed run are one run: the relay goes off for a soak
+  // while the controller still counts the pump as running.
+  void write_state(bool on) override {
+    const uint64_t now_ms = host::uptime_us() / 1000;
+    if (on && !state) {
+      if (controller_->is_pulsed_run() && !runs.empty() && runs.back().off_ms == 0) {
+        runs.back().bursts++;
+      } else {
+        runs.push_back({now_ms, 0, controller_->get_pump_trigger()});
+      }
+      runs.back().burst_on_ms = now_ms;
+    }
+    if (!on && !runs.empty() && runs.back().off_ms == 0) {
+      if (state) runs.back().pumped_ms += now_ms - runs.back().burst_on_ms;
+      if (!controller_->pump_running_) runs.back().off_ms = now_ms;  // Also when stopped in a soak
+    }
+    publish_state(on);
+  }
+  const esphome_hotcirc::HotWaterController *controller_;
+};
+
+class ReplayClock : public time::RealTimeClock {};
+
+inline double percentile(std::vector<double> v, double pct) {
+  if (v.empty()) return NAN;
+  std::sort(v.begin(), v.end());
+  const size_t idx = std::min(v.size() - 1, (size_t) std::ceil(pct / 100.0 * v.size()) - (pct > 0 ? 1 : 0));
+  return v[idx];
+}
+
+}  // namespace host
+}  // namespace esphome
@@ -0,0 +1,16 @@
+#pragma once
+// Host stub: binary_sensor::BinarySensor (button).
+#include <functional>
+#include "esphome/core/helpers.h"
+namespace esphome {
+namespace binary_sensor {
+class BinarySensor {
+ public:
+  void publish_state(bool state) { this->state = state; callback_.call(state); }
+  void add_on_state_callback(std::function<void(bool)> &&callback) { callback_.add(std::move(callback)); }
+  bool state{false};
+ protected:
+  CallbackManager<void(bool)> callback_;
+};
+}
+}
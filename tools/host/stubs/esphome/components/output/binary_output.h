@@ -0,0 +1,15 @@
+#pragma once
+// Host stub: output::BinaryOutput (LEDs).
+namespace esphome {
+namespace output {
+class BinaryOutput {
+ public:
+  virtual ~BinaryOutput() = default;
+  void set_state(bool state) { if (state) turn_on(); else turn_off(); }
+  virtual void turn_on() { write_state(true); }
+  virtual void turn_off() { write_state(false); }
+ protected:
+  virtual void write_state(bool state) = 0;
+};
+}
+}
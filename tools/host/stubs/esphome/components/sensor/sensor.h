@@ -0,0 +1,46 @@
+#pragma once
+// Host stub: the subset of sensor::Sensor the controller uses (no filters).
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+namespace esphome {
+namespace sensor {
+class Sensor {
+ public:
+  // Raw callbacks see the value as published, state callbacks the filtered
+  // one - the only filter modelled is sliding_window_moving_average with
+  // send_every: 1 (window set via host_set_moving_average()).
+  void publish_state(float state) {
+    raw_state = state;
+    raw_callback_.call(state);
+    this->state = filter_(state);
+    has_state_ = true;
+    callback_.call(this->state);
+  }
+  void add_on_state_callback(std::function<void(float)> &&callback) { callback_.add(std::move(callback)); }
+  void add_on_raw_state_callback(std::function<void(float)> &&callback) { raw_callback_.add(std::move(callback)); }
+  bool has_state() const { return has_state_; }
+  float get_state() const { return state; }
+  void host_set_moving_average(size_t window) { window_ = window; }
+  float state{NAN};
+  float raw_state{NAN};
+ protected:
+  float filter_(float v) {
+    if (window_ <= 1 || std::isnan(v)) return v;
+    queue_.push_back(v);
+    if (queue_.size() > window_) queue_.erase(queue_.begin());
+    float sum = 0.0f;
+    for (float q : queue_) sum += q;
+    return sum / queue_.size();
+  }
+  bool has_state_{false};
+  size_t window_{1};
+  std::vector<float> queue_;
+  CallbackManager<void(float)> callback_;
+  CallbackManager<void(float)> raw_callback_;
+};
+}
+}
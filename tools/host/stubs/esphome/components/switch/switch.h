@@ -0,0 +1,21 @@
+#pragma once
+// Host stub: switch_::Switch; the replay pump derives from it.
+#include <functional>
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+namespace esphome {
+namespace switch_ {
+class Switch {
+ public:
+  virtual ~Switch() = default;
+  void turn_on() { write_state(true); }
+  void turn_off() { write_state(false); }
+  void publish_state(bool state) { this->state = state; callback_.call(state); }
+  void add_on_state_callback(std::function<void(bool)> &&callback) { callback_.add(std::move(callback)); }
+  bool state{false};
+ protected:
+  virtual void write_state(bool state) = 0;
+  CallbackManager<void(bool)> callback_;
+};
+}
+}
@@ -0,0 +1,47 @@
+#pragma once
+// Host stub: ESPTime + RealTimeClock; now() follows the simulated wall clock.
+#include <cstdint>
+#include <ctime>
+#include "esphome/core/component.h"
+namespace esphome {
+struct ESPTime {
+  uint8_t second;
+  uint8_t minute;
+  uint8_t hour;
+  uint8_t day_of_week;
+  uint8_t day_of_month;
+  uint16_t day_of_year;
+  uint8_t month;
+  uint16_t year;
+  bool is_dst;
+  time_t timestamp;
+  bool is_valid() const { return year >= 2019 && fields_in_range(); }
+  bool fields_in_range() const { return second < 61 && minute < 60 && hour < 24 && day_of_week > 0 && day_of_week < 8; }
+  static ESPTime from_c_tm(struct tm *c_tm, time_t c_time) {
+    ESPTime res{};
+    res.second = c_tm->tm_sec;
+    res.minute = c_tm->tm_min;
+    res.hour = c_tm->tm_hour;
+    res.day_of_week = c_tm->tm_wday + 1;
+    res.day_of_month = c_tm->tm_mday;
+    res.day_of_year = c_tm->tm_yday + 1;
+    res.month = c_tm->tm_mon + 1;
+    res.year = c_tm->tm_year + 1900;
+    res.is_dst = c_tm->tm_isdst;
+    res.timestamp = c_time;
+    return res;
+  }
+  static ESPTime from_epoch_local(time_t epoch) {
+    struct tm c_tm;
+    if (::localtime_r(&epoch, &c_tm) == nullptr) return ESPTime{};
+    return ESPTime::from_c_tm(&c_tm, epoch);
+  }
+};
+namespace time {
+class RealTimeClock : public PollingComponent {
+ public:
+  virtual ESPTime now();
+  void update() override {}
+};
+}
+}
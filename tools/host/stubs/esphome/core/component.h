@@ -0,0 +1,42 @@
+#pragma once
+// Host stub: Component / PollingComponent without a scheduler.
+#include <cstdint>
+#include <functional>
+#include <string>
+namespace esphome {
+namespace setup_priority {
+extern const float HARDWARE;
+extern const float DATA;
+extern const float PROCESSOR;
+extern const float AFTER_WIFI;
+extern const float LATE;
+}
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+  void mark_failed() { failed_ = true; }
+  bool is_failed() const { return failed_; }
+ protected:
+  void set_timeout(const std::string &, uint32_t, std::function<void()> &&) {}
+  void set_timeout(uint32_t, std::function<void()> &&) {}
+  bool cancel_timeout(const std::string &) { return true; }
+  void set_interval(const std::string &, uint32_t, std::function<void()> &&) {}
+  bool failed_{false};
+};
+class PollingComponent : public Component {
+ public:
+  PollingComponent() = default;
+  explicit PollingComponent(uint32_t update_interval) : update_interval_(update_interval) {}
+  virtual void update() = 0;
+  virtual void set_update_interval(uint32_t update_interval) { update_interval_ = update_interval; }
+  virtual uint32_t get_update_interval() const { return update_interval_; }
+  void start_poller() {}
+  void stop_poller() {}
+ protected:
+  uint32_t update_interval_{0};
+};
+}
@@ -0,0 +1,3 @@
+#pragma once
+// Host stub: the generated defines.h. HOTCIRC_* / USE_* options are passed
+// with -D on the compiler command line instead (see tools/host/README.md).
@@ -0,0 +1,9 @@
+#pragma once
+// Host stub: millis()/micros() read the simulated clock (host::set_uptime_us()).
+#include <cstdint>
+
+namespace esphome {
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+}  // namespace esphome
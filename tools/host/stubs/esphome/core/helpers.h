@@ -0,0 +1,34 @@
+#pragma once
+// Host stub: CallbackManager, RAMAllocator (plain heap) and fnv1_hash.
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+namespace esphome {
+inline uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+  for (char c : str) { hash *= 16777619UL; hash ^= c; }
+  return hash;
+}
+template<typename... Ts> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) { for (auto &cb : this->callbacks_) cb(args...); }
+  size_t size() const { return this->callbacks_.size(); }
+  void operator()(Ts... args) { call(args...); }
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+template<class T> class RAMAllocator {
+ public:
+  enum Flags { NONE = 0, ALLOC_EXTERNAL = 1, ALLOC_INTERNAL = 2, ALLOW_FAILURE = 4 };
+  RAMAllocator() = default;
+  RAMAllocator(uint8_t flags) {}
+  T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T))); }
+  void deallocate(T *p, size_t n) { ::operator delete(p); }
+};
+template<class T> using ExternalRAMAllocator = RAMAllocator<T>;
+}
@@ -0,0 +1,25 @@
+#pragma once
+// Host stub: ESP_LOGx print to stderr when their level is enabled
+// (esphome::host::log_level, default 0 = errors only, see replay -v).
+#include <cstdio>
+
+namespace esphome {
+namespace host {
+extern int log_level;  // 0 E, 1 W, 2 I, 3 D, 4 V
+}  // namespace host
+}  // namespace esphome
+
+#define HOST_LOG_(lvl, letter, tag, ...) \
+  do { \
+    if (::esphome::host::log_level >= (lvl)) { \
+      std::fprintf(stderr, letter " %s: ", tag); \
+      std::fprintf(stderr, __VA_ARGS__); \
+      std::fputc('\n', stderr); \
+    } \
+  } while (0)
+#define ESP_LOGE(tag, ...) HOST_LOG_(0, "E", tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) HOST_LOG_(1, "W", tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) HOST_LOG_(2, "I", tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) HOST_LOG_(2, "C", tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) HOST_LOG_(3, "D", tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) HOST_LOG_(4, "V", tag, __VA_ARGS__)
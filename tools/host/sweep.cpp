@@ -0,0 +1,322 @@
+// Parallel parameter sweep for the schedule learning of HotWaterController.
+//
+// Runs the unmodified controller - learn_now(), the lazy matrix decay,
+// check_schedule() - against the closed-loop plant of sim.h for every
+// combination of LEARN_INC, DECAY, SCHEDULE_THRESHOLD, USER_REQUEST_MAX_AGE
+// and preheat lead, one simulation per worker thread, and reports the Pareto
+// front of mean hot-water wait against pump energy. Draws are the synthetic
+// Poisson pattern or a recorded household profile repeated to fill the run.
+// See tools/host/README.md.
+#include "sim.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace esphome;
+using esphome_hotcirc::HotWaterController;
+using esphome_hotcirc::EnergyPeriod;
+using host::Draw;
+using host::ReplayClock;
+using host::ReplayPump;
+using host::SynthSource;
+
+namespace {
+
+struct Options {
+  double days{365};
+  uint32_t seed{1};
+  const char *draw_profile{nullptr};
+  std::vector<double> learn_inc{20, 40, 80};
+  std::vector<double> decay{0.95, 0.98};
+  std::vector<double> eco{80, 120, 160};
+  std::vector<double> max_age_min{15, 30};
+  std::vector<double> lead_min{0, 10};
+  unsigned jobs{0};           // 0 = all cores
+  const char *csv{nullptr};
+  bool all{false};
+};
+
+// One point of the grid; the firmware defaults are 40 / 0.98 / 120 / 30 / 0.
+struct Params {
+  uint8_t learn_inc;
+  float decay;
+  uint8_t eco;
+  uint32_t max_age_min;
+  uint32_t lead_min;
+};
+
+struct Result {
+  Params p;
+  double wait_mean_s{NAN};
+  double wait_p90_s{NAN};
+  double hot_pct{0};          // Draws with hot water at once
+  double kwh{0};
+  double pump_h{0};
+  size_t cycles{0};
+  float hit_rate{NAN};
+  float wasted_kwh{0};
+  bool pareto{false};
+};
+
+// "a,b,c" or "from:to:step"
+bool parse_list(const char *s, std::vector<double> &out) {
+  out.clear();
+  double from, to, step;
+  if (std::sscanf(s, "%lf:%lf:%lf", &from, &to, &step) == 3) {
+    if (step <= 0 || to < from) return false;
+    for (double v = from; v <= to + step * 1e-6; v += step) out.push_back(v);
+    return true;
+  }
+  for (const char *p = s; *p;) {
+    char *end;
+    out.push_back(std::strtod(p, &end));
+    if (end == p) return false;
+    p = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != '\0') return false;
+  }
+  return !out.empty();
+}
+
+Result simulate(const Params &p, const Options &o, const std::vector<Draw> &profile, uint64_t period_ms) {
+  host::reset_preferences();
+  host::set_uptime_us(0);
+  host::set_epoch_base(host::DEFAULT_EPOCH);
+
+  std::unique_ptr<SynthSource> src(profile.empty()
+                                       ? new SynthSource(o.days, o.seed)
+                                       : new SynthSource(o.days, o.seed, profile, period_ms, o.draw_profile));
+  HotWaterController controller;
+  ReplayPump pump(&controller);
+  ReplayClock clock;
+  controller.set_outlet_sensor(&src->outlet);
+  controller.set_return_sensor(&src->ret);
+  controller.set_pump_switch(&pump);
+  controller.set_time_source(&clock);
+  controller.set_thresholds(1.5f, 1.5f, 10.0f, 30.0f);  // replay defaults
+  controller.LEARN_INC = p.learn_inc;
+  controller.DECAY = p.decay;  // Read by setup()
+  controller.SCHEDULE_THRESHOLD = p.eco;
+  controller.USER_REQUEST_MAX_AGE = p.max_age_min * 60;
+  controller.set_preheat_lead(p.lead_min, false);
+  src->outlet.host_set_moving_average(3);
+  src->ret.host_set_moving_average(3);
+  controller.setup();
+
+  uint64_t now_ms = 0;
+  while (!src->done(now_ms)) {
+    now_ms += host::STEP_MS;
+    host::set_uptime_us(now_ms * 1000);
+    src->step(now_ms, pump.state);
+    controller.loop();
+  }
+  if (!pump.runs.empty() && pump.runs.back().off_ms == 0) {
+    if (pump.state) pump.runs.back().pumped_ms += now_ms - pump.runs.back().burst_on_ms;
+    pump.runs.back().off_ms = now_ms;
+  }
+
+  Result r;
+  r.p = p;
+  std::vector<double> wait_s;
+  for (const auto &d : src->draws) {
+    if (!std::isnan(d.wait_s)) wait_s.push_back(d.wait_s);
+  }
+  if (!wait_s.empty()) {
+    double sum = 0;
+    size_t hot = 0;
+    for (double w : wait_s) {
+      sum += w;
+      if (w < 1.0) hot++;
+    }
+    r.wait_mean_s = sum / wait_s.size();
+    r.wait_p90_s = host::percentile(wait_s, 90);
+    r.hot_pct = 100.0 * hot / wait_s.size();
+  }
+  for (const auto &run : pump.runs) r.pump_h += run.pumped_ms / 3600000.0;
+  r.cycles = pump.runs.size();
+  r.kwh = controller.get_energy_kwh(EnergyPeriod::LIFETIME);
+  r.hit_rate = controller.get_schedule_hit_rate();
+  r.wasted_kwh = controller.get_schedule_wasted_kwh();
+  return r;
+}
+
+// Minimize both wait and energy: sorted by energy, a point is on the front
+// when it waits less than every cheaper point.
+void mark_pareto(std::vector<Result> &results) {
+  std::vector<Result *> order;
+  for (auto &r : results) {
+    if (!std::isnan(r.wait_mean_s)) order.push_back(&r);
+  }
+  std::sort(order.begin(), order.end(), [](const Result *a, const Result *b) {
+    return a->kwh != b->kwh ? a->kwh < b->kwh : a->wait_mean_s < b->wait_mean_s;
+  });
+  double best_wait = INFINITY;
+  for (Result *r : order) {
+    if (r->wait_mean_s < best_wait) {
+      r->pareto = true;
+      best_wait = r->wait_mean_s;
+    }
+  }
+}
+
+bool is_default(const Params &p) {
+  return p.learn_inc == 40 && std::fabs(p.decay - 0.98f) < 1e-4f && p.eco == 120 && p.max_age_min == 30 &&
+         p.lead_min == 0;
+}
+
+void print_row(const Result &r, double per_year) {
+  char hit[8] = "-";
+  if (!std::isnan(r.hit_rate)) std::snprintf(hit, sizeof(hit), "%.0f", r.hit_rate * 100.0f);
+  std::printf("%c %9u %7.3f %5u %6um %5um %8.1f s %5.0f s %6.0f %9.1f %8.1f %7s %8.1f%s\n", r.pareto ? '*' : ' ',
+              r.p.learn_inc, r.p.decay, r.p.eco, r.p.max_age_min, r.p.lead_min, r.wait_mean_s, r.wait_p90_s,
+              r.hot_pct, r.kwh * per_year, r.pump_h * per_year, hit, r.wasted_kwh * per_year,
+              is_default(r.p) ? "  (defaults)" : "");
+}
+
+void usage() {
+  std::fprintf(stderr,
+               "usage: sweep [options]\n"
+               "  --days N           simulated days per run (default 365)\n"
+               "  --seed N           synthetic draw pattern seed (default 1)\n"
+               "  --draws FILE       recorded draw profile t_s,duration_s (repeats weekly)\n"
+               "  --learn-inc LIST   LEARN_INC values (default 20,40,80)\n"
+               "  --decay LIST       DECAY values (default 0.95,0.98)\n"
+               "  --eco LIST         SCHEDULE_THRESHOLD values (default 80,120,160)\n"
+               "  --max-age LIST     USER_REQUEST_MAX_AGE in minutes (default 15,30)\n"
+               "  --lead LIST        preheat_lead in minutes (default 0,10)\n"
+               "  --jobs N           worker threads (default: all cores)\n"
+               "  --csv FILE         write every run as CSV\n"
+               "  --all              print every run, not only the Pareto front\n"
+               "LIST is a,b,c or from:to:step.\n");
+}
+
+bool parse_args(int argc, char **argv, Options &o) {
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    auto value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+    const char *v = nullptr;
+    if (!std::strcmp(a, "--days") && (v = value())) {
+      o.days = std::atof(v);
+    } else if (!std::strcmp(a, "--seed") && (v = value())) {
+      o.seed = (uint32_t) std::strtoul(v, nullptr, 10);
+    } else if (!std::strcmp(a, "--draws") && (v = value())) {
+      o.draw_profile = v;
+    } else if (!std::strcmp(a, "--learn-inc") && (v = value())) {
+      if (!parse_list(v, o.learn_inc)) return false;
+    } else if (!std::strcmp(a, "--decay") && (v = value())) {
+      if (!parse_list(v, o.decay)) return false;
+    } else if (!std::strcmp(a, "--eco") && (v = value())) {
+      if (!parse_list(v, o.eco)) return false;
+    } else if (!std::strcmp(a, "--max-age") && (v = value())) {
+      if (!parse_list(v, o.max_age_min)) return false;
+    } else if (!std::strcmp(a, "--lead") && (v = value())) {
+      if (!parse_list(v, o.lead_min)) return false;
+    } else if (!std::strcmp(a, "--jobs") && (v = value())) {
+      o.jobs = (unsigned) std::atoi(v);
+    } else if (!std::strcmp(a, "--csv") && (v = value())) {
+      o.csv = v;
+    } else if (!std::strcmp(a, "--all")) {
+      o.all = true;
+    } else {
+      return false;
+    }
+  }
+  return o.days > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_args(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  std::vector<Draw> profile;
+  uint64_t period_ms = 0;
+  if (opt.draw_profile != nullptr && !host::load_draw_profile(opt.draw_profile, profile, &period_ms)) {
+    std::fprintf(stderr, "%s: cannot read draws\n", opt.draw_profile);
+    return 1;
+  }
+
+  std::vector<Params> grid;
+  for (double li : opt.learn_inc)
+    for (double de : opt.decay)
+      for (double ec : opt.eco)
+        for (double ma : opt.max_age_min)
+          for (double le : opt.lead_min) {
+            grid.push_back({(uint8_t) std::max(1.0, std::min(255.0, std::round(li))), (float) de,
+                            (uint8_t) std::max(1.0, std::min(255.0, std::round(ec))), (uint32_t) std::lround(ma),
+                            (uint32_t) std::lround(le)});
+          }
+
+  unsigned jobs = opt.jobs ? opt.jobs : std::max(1u, std::thread::hardware_concurrency());
+  jobs = std::min<unsigned>(jobs, grid.size());
+  std::vector<Result> results(grid.size());
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> finished{0};
+  std::mutex progress_lock;
+  const auto wall_start = std::chrono::steady_clock::now();
+
+  // Every run is independent: the host clock and preferences are per thread
+  auto worker = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < grid.size();) {
+      results[i] = simulate(grid[i], opt, profile, period_ms);
+      std::lock_guard<std::mutex> guard(progress_lock);
+      std::fprintf(stderr, "\r  %zu / %zu runs", ++finished, grid.size());
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < jobs; t++) threads.emplace_back(worker);
+  for (auto &t : threads) t.join();
+  std::fprintf(stderr, "\n");
+  const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+  mark_pareto(results);
+  std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) { return a.kwh < b.kwh; });
+
+  const double per_year = 365.0 / opt.days;
+  std::printf("sweep: %zu runs of %.0f days (%s), %u threads, %.1f s wall\n", grid.size(), opt.days,
+              opt.draw_profile ? opt.draw_profile : "synthetic draws", jobs, wall_s);
+  std::printf("  LEARN_INC   DECAY   ECO MAX_AGE  LEAD  wait mean    p90  hot %%  kWh / yr  pump h  hit %%  "
+              "wasted kWh\n");
+  const Result *defaults = nullptr;
+  for (const auto &r : results) {
+    if (is_default(r.p)) defaults = &r;
+    if (r.pareto || opt.all) print_row(r, per_year);
+  }
+  if (!opt.all && defaults != nullptr && !defaults->pareto) {
+    std::printf("  ...\n");
+    print_row(*defaults, per_year);
+  }
+  std::printf("* Pareto front (no other run waits less for less energy); wait = tap open -> hot water\n");
+
+  if (opt.csv != nullptr) {
+    FILE *f = std::fopen(opt.csv, "w");
+    if (f == nullptr) {
+      std::fprintf(stderr, "%s: cannot write\n", opt.csv);
+      return 1;
+    }
+    std::fprintf(f, "learn_inc,decay,eco,max_age_min,lead_min,wait_mean_s,wait_p90_s,hot_pct,kwh,pump_h,cycles,"
+                    "hit_rate,wasted_kwh,pareto\n");
+    for (const auto &r : results) {
+      std::fprintf(f, "%u,%.4f,%u,%u,%u,%.2f,%.1f,%.1f,%.3f,%.3f,%zu,%.3f,%.3f,%d\n", r.p.learn_inc, r.p.decay, r.p.eco,
+                   r.p.max_age_min, r.p.lead_min, r.wait_mean_s, r.wait_p90_s, r.hot_pct, r.kwh, r.pump_h, r.cycles,
+                   r.hit_rate, r.wasted_kwh, r.pareto ? 1 : 0);
+    }
+    std::fclose(f);
+  }
+  return 0;
+}